@@ -0,0 +1,99 @@
+#include <memory>
+#include <vector>
+
+#include <QMouseEvent>
+#include <QPointF>
+
+#include <mark_action.hpp>
+
+#include "bench_util.hpp"
+
+using namespace std;
+using namespace ican_mark;
+
+// Mouse events of marking one rotated box: moving around, then press and
+// release for each of the four anchor points
+vector<unique_ptr<QMouseEvent>> make_events()
+{
+    vector<unique_ptr<QMouseEvent>> ret;
+    bench::Random rng(0);
+    for (int click = 0; click < 4; click++)
+    {
+        QPointF pos;
+        for (int i = 0; i < 8; i++)
+        {
+            pos = QPointF(rng.uniform(0, 1280), rng.uniform(0, 800));
+            ret.emplace_back(new QMouseEvent(QEvent::MouseMove, pos,
+                                             Qt::NoButton, Qt::NoButton,
+                                             Qt::NoModifier));
+        }
+
+        ret.emplace_back(new QMouseEvent(QEvent::MouseButtonPress, pos,
+                                         Qt::LeftButton, Qt::LeftButton,
+                                         Qt::NoModifier));
+        ret.emplace_back(new QMouseEvent(QEvent::MouseButtonRelease, pos,
+                                         Qt::LeftButton, Qt::NoButton,
+                                         Qt::NoModifier));
+    }
+
+    return ret;
+}
+
+template <typename Action>
+bench::Result run_action(const string& name,
+                         const vector<unique_ptr<QMouseEvent>>& events)
+{
+    Action action;
+    return bench::measure(
+        name,
+        [&]()
+        {
+            for (const auto& event : events)
+            {
+                action.run(event.get());
+                if (action.finish())
+                {
+                    action.reset();
+                }
+            }
+
+            bench::keep(action.state());
+        },
+        events.size());
+}
+
+int main()
+{
+    bench::Report report("action");
+    vector<unique_ptr<QMouseEvent>> events = make_events();
+
+    report.add(run_action<ClickAction>("click_action_run", events));
+    report.add(run_action<TwiceClick>("twice_click_run", events));
+    report.add(run_action<RBoxMark>("rbox_mark_run", events));
+
+    // Sub-state access as used by painting
+    RBoxMark markAction;
+    for (const auto& event : events)
+    {
+        markAction.run(event.get());
+    }
+
+    report.add(bench::measure(
+        "rbox_mark_key_lookup",
+        [&]()
+        {
+            bench::keep(markAction[RBoxMarkKey::DEGREE][TwiceClickKey::POS1]
+                                  [ClickKey::RELEASE]);
+        }));
+    report.add(bench::measure(
+        "rbox_mark_string_lookup",
+        [&]() { bench::keep(markAction["degree"]["pos1"]["release"]); }));
+
+    // Action arithmetic
+    report.add(bench::measure(
+        "rbox_mark_operator",
+        [&]() { bench::keep((markAction - QPointF(1, 1)) * QPointF(2, 2)); }));
+
+    report.print();
+    return 0;
+}
@@ -0,0 +1,73 @@
+#include <vector>
+
+#include <QApplication>
+#include <QPointF>
+
+#include <mark_widget.h>
+
+#include "bench_util.hpp"
+
+using namespace std;
+using namespace ican_mark;
+
+class GeometryBench : public RBoxMarkWidget
+{
+   public:
+    using RBoxMarkWidget::fill_bbox;
+    using RBoxMarkWidget::find_degree;
+};
+
+int main(int argc, char* argv[])
+{
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+    {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+
+    QApplication app(argc, argv);
+
+    // Random anchor point pairs
+    const int count = 1024;
+    bench::Random rng(0);
+    vector<QPointF> fromList, toList;
+    for (int i = 0; i < count; i++)
+    {
+        fromList.push_back(QPointF(rng.uniform(0, 4096), rng.uniform(0, 4096)));
+        toList.push_back(QPointF(rng.uniform(0, 4096), rng.uniform(0, 4096)));
+    }
+
+    bench::Report report("geometry");
+    GeometryBench widget;
+
+    report.add(bench::measure(
+        "find_degree",
+        [&]()
+        {
+            double sum = 0;
+            for (int i = 0; i < count; i++)
+            {
+                sum += widget.find_degree(fromList[i], toList[i]);
+            }
+
+            bench::keep(sum);
+        },
+        count));
+
+    Instance inst;
+    inst.set_degree(30);
+    report.add(bench::measure(
+        "fill_bbox",
+        [&]()
+        {
+            for (int i = 0; i < count; i++)
+            {
+                widget.fill_bbox(inst, fromList[i], toList[i]);
+            }
+
+            bench::keep(inst);
+        },
+        count));
+
+    report.print();
+    return 0;
+}
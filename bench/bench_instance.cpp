@@ -0,0 +1,103 @@
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <string>
+
+#include <mark_codec.hpp>
+#include <mark_dataset.hpp>
+#include <mark_instance.hpp>
+
+#include "bench_util.hpp"
+
+using namespace std;
+using namespace ican_mark;
+
+int main(int argc, char* argv[])
+try
+{
+    int instCount = (argc > 1) ? atoi(argv[1]) : 10000;
+
+    bench::Report report("instance");
+    InstanceStore instList = bench::make_instances(instCount, 4096, 4096);
+    string suffix = "/" + to_string(instCount);
+
+    // YAML::Node round trip
+    YAML::Node node;
+    node = instList;
+    YAML::Emitter out;
+    out << node;
+    string yamlText = out.c_str();
+
+    report.add(bench::measure(
+        "yaml_encode" + suffix,
+        [&]()
+        {
+            YAML::Node node;
+            node = instList;
+            YAML::Emitter out;
+            out << node;
+            bench::keep(out.size());
+        },
+        instCount, yamlText.size()));
+    report.add(bench::measure(
+        "yaml_decode" + suffix,
+        [&]() { bench::keep(YAML::Load(yamlText).as<InstanceStore>()); },
+        instCount, yamlText.size()));
+
+    // Streaming codec
+    string buf;
+    report.add(bench::measure(
+        "codec_encode" + suffix,
+        [&]()
+        {
+            buf.clear();
+            MarkCodec::encode(buf, instList);
+            bench::keep(buf.size());
+        },
+        instCount, yamlText.size()));
+    report.add(bench::measure(
+        "codec_decode" + suffix,
+        [&]() { bench::keep(MarkCodec::decode(yamlText)); }, instCount,
+        yamlText.size()));
+
+    // Binary dataset record
+    string record;
+    DatasetStore::encode(record, instList);
+    report.add(bench::measure(
+        "dataset_encode" + suffix,
+        [&]()
+        {
+            buf.clear();
+            DatasetStore::encode(buf, instList);
+            bench::keep(buf.size());
+        },
+        instCount, record.size()));
+    report.add(bench::measure(
+        "dataset_decode" + suffix,
+        [&]()
+        {
+            bench::keep(
+                DatasetStore::decode(record.data(), record.size()).size());
+        },
+        instCount, record.size()));
+
+    // Column operations
+    report.add(bench::measure(
+        "store_translate" + suffix, [&]() { instList.translate(0.5, -0.5); },
+        instCount));
+    report.add(bench::measure(
+        "store_cull" + suffix,
+        [&]() { bench::keep(instList.cull(1024, 1024, 2048, 2048).size()); },
+        instCount));
+
+    report.print();
+    return 0;
+}
+catch (exception& ex)
+{
+    cout << endl;
+    cout << "Error!" << endl;
+    cout << ex.what() << endl;
+    cout << endl;
+    return -1;
+}
@@ -0,0 +1,160 @@
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <QApplication>
+#include <QFont>
+#include <QImage>
+#include <QMarginsF>
+#include <QPainter>
+#include <QTransform>
+
+#include <mark_widget.h>
+
+#include "bench_util.hpp"
+
+using namespace std;
+using namespace ican_mark;
+
+class RenderBench : public RBoxMarkWidget
+{
+   public:
+    void setup(int instCount)
+    {
+        QImage image(4096, 4096, QImage::Format_RGB32);
+        image.fill(QColor(64, 96, 64));
+
+        this->set_class_names({"car", "truck", "ship", "plane"});
+        this->resize(1280, 800);
+        this->reset(image, bench::make_instances(instCount, 4096, 4096));
+    }
+
+    void invalidate_layers() { this->annoLayerDirty = true; }
+
+    // Per-instance drawing path used before batching
+    void draw_legacy(QImage& target)
+    {
+        for (int i = 0; i < (int)this->annoList.size(); i++)
+        {
+            Instance inst = this->annoList[i];
+            const StyleRBox& style = (i == this->highlightInst)
+                                         ? this->style.rboxHL
+                                         : this->style.rbox;
+
+            QPainter painter(&target);
+            painter.setRenderHint(style.rendHint);
+            painter.setCompositionMode(style.compMode);
+            painter.setPen(QPen(style.penColor, style.lineWidth));
+
+            QPointF center =
+                this->mapping_to_view(QPointF(inst.get_x(), inst.get_y()));
+            double halfWidth = inst.get_w() / 2;
+            double halfHeight = inst.get_h() / 2;
+
+            QTransform transform;
+            transform.translate(center.x(), center.y());
+            transform.rotate(-inst.get_degree());
+            painter.setTransform(transform);
+
+            QRectF boxRect(
+                this->scaling_to_view(QPointF(-halfWidth, -halfHeight)),
+                this->scaling_to_view(QPointF(halfWidth, halfHeight)));
+            painter.drawRect(boxRect);
+
+            int instLabel = inst.get_label();
+            string labelStr = to_string(instLabel);
+            if (instLabel < (int)this->classNames.size())
+            {
+                labelStr += string(": ") + this->classNames[instLabel];
+            }
+
+            QRectF labelRect(boxRect.topLeft() + QPoint(style.lineWidth / 2,
+                                                        style.lineWidth / 2),
+                             QSizeF(boxRect.width() - style.lineWidth,
+                                    style.fontSize + 15));
+
+            QFont font = painter.font();
+            font.setPixelSize(style.fontSize);
+            font.setBold(true);
+            painter.setFont(font);
+
+            painter.fillRect(labelRect, QColor(255, 255, 255, 64));
+            painter.drawText(labelRect.marginsRemoved(QMarginsF(5, 5, 5, 5)),
+                             Qt::AlignVCenter | Qt::AlignLeft,
+                             labelStr.c_str(), &labelRect);
+        }
+    }
+
+    void draw_batched(QImage& target)
+    {
+        QPainter painter(&target);
+        this->draw_annotations(painter);
+    }
+};
+
+int main(int argc, char* argv[])
+{
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+    {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+
+    QApplication app(argc, argv);
+
+    // Instance counts, e.g. "1000,10000,100000"
+    vector<int> countList;
+    stringstream countStr((argc > 1) ? argv[1] : "1000,10000,100000");
+    for (string token; getline(countStr, token, ',');)
+    {
+        countList.push_back(atoi(token.c_str()));
+    }
+
+    bench::Report report("render");
+    for (int instCount : countList)
+    {
+        RenderBench widget;
+        widget.setup(instCount);
+
+        string suffix = "/" + to_string(instCount);
+        QImage target(widget.size(), QImage::Format_ARGB32_Premultiplied);
+
+        // Annotation drawing only
+        if (instCount <= 10000)
+        {
+            report.add(bench::measure(
+                "draw_per_instance" + suffix,
+                [&]()
+                {
+                    target.fill(Qt::transparent);
+                    widget.draw_legacy(target);
+                },
+                instCount));
+        }
+
+        report.add(bench::measure(
+            "draw_batched" + suffix,
+            [&]()
+            {
+                target.fill(Qt::transparent);
+                widget.draw_batched(target);
+            },
+            instCount));
+
+        // Whole paintEvent, with cached layers and with layers rebuilt
+        report.add(bench::measure(
+            "paint_event_cached" + suffix, [&]() { widget.render(&target); },
+            instCount));
+        report.add(bench::measure(
+            "paint_event_full" + suffix,
+            [&]()
+            {
+                widget.invalidate_layers();
+                widget.render(&target);
+            },
+            instCount));
+    }
+
+    report.print();
+    return 0;
+}
@@ -0,0 +1,243 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <QApplication>
+#include <QGuiApplication>
+#include <QImage>
+#include <QScreen>
+
+#include <mark_codec.hpp>
+#include <mark_widget.h>
+
+using namespace std;
+using namespace ican_mark;
+
+// Replay trace with frames served at recorded time instead of event loop
+template <typename Widget>
+class Replayer : public Widget
+{
+   public:
+    bool frame_pending() const { return this->frameTimer.isActive(); }
+
+    void serve_frame(QImage& target)
+    {
+        this->frameTimer.stop();
+        this->frame_update();
+        this->render(&target);
+    }
+};
+
+void setup_widget(RBoxMarkWidget& widget, const QImage& image,
+                  const InputTrace& trace, InstanceStore&& instList)
+{
+    widget.reset(image, std::move(instList));
+    widget.set_mark_label(trace.label);
+    widget.set_scale_ratio(trace.viewScale);
+    widget.set_view_center(trace.viewCenter);
+}
+
+void setup_widget(ImageMap& widget, const QImage& image,
+                  const InputTrace& trace, InstanceStore&& instList)
+{
+    (void)trace;
+    (void)instList;
+    widget.reset(image);
+}
+
+bool check_result(RBoxMarkWidget& widget, const InstanceStore& expected)
+{
+    return widget.annotation_list() == expected;
+}
+
+bool check_result(ImageMap& widget, const InstanceStore& expected)
+{
+    (void)widget;
+    (void)expected;
+    return true;
+}
+
+InstanceStore decode_marks(const QByteArray& content)
+{
+    if (content.isEmpty())
+    {
+        return InstanceStore();
+    }
+
+    return MarkCodec::decode(content.constData(), content.size());
+}
+
+string summary(vector<double> costList)
+{
+    char buf[256];
+    if (costList.empty())
+    {
+        return "{}";
+    }
+
+    sort(costList.begin(), costList.end());
+    auto pick = [&](double ratio)
+    {
+        size_t index = (size_t)(ratio * costList.size());
+        return costList[min(index, costList.size() - 1)];
+    };
+
+    double sum = 0;
+    for (double cost : costList)
+    {
+        sum += cost;
+    }
+
+    snprintf(buf, sizeof(buf),
+             "{\"count\": %zu, \"mean\": %.3f, \"p50\": %.3f, \"p95\": %.3f, "
+             "\"p99\": %.3f, \"max\": %.3f}",
+             costList.size(), sum / costList.size(), pick(0.5), pick(0.95),
+             pick(0.99), costList.back());
+    return buf;
+}
+
+template <typename Widget>
+bool replay(const InputTrace& trace, const QImage& image,
+            InstanceStore&& initList, const InstanceStore& expected)
+{
+    typedef chrono::steady_clock Clock;
+
+    Replayer<Widget> widget;
+    widget.setAttribute(Qt::WA_DontShowOnScreen);
+    widget.resize(trace.viewSize);
+    widget.show();
+    QApplication::processEvents();
+
+    setup_widget(widget, image, trace, std::move(initList));
+
+    QImage target(widget.size(), QImage::Format_ARGB32_Premultiplied);
+    widget.serve_frame(target);
+    widget.reset_render_stats();
+
+    // Frame interval in microseconds
+    qreal refreshRate = 60;
+    QScreen* screen = QGuiApplication::primaryScreen();
+    if (screen && screen->refreshRate() > 0)
+    {
+        refreshRate = screen->refreshRate();
+    }
+
+    qint64 interval = (qint64)(1e6 / refreshRate);
+    qint64 lastFrame = 0;
+
+    vector<double> processCost;
+    vector<double> paintCost;
+    auto paint = [&]()
+    {
+        Clock::time_point start = Clock::now();
+        widget.serve_frame(target);
+        chrono::duration<double, micro> cost = Clock::now() - start;
+        paintCost.push_back(cost.count());
+    };
+
+    for (const InputTrace::Event& event : trace.events())
+    {
+        // Frame timer would have fired before this event
+        if (widget.frame_pending() && event.time - lastFrame >= interval)
+        {
+            paint();
+            lastFrame = event.time;
+        }
+
+        Clock::time_point start = Clock::now();
+        widget.replay_input(event);
+        chrono::duration<double, micro> cost = Clock::now() - start;
+        processCost.push_back(cost.count());
+    }
+
+    if (widget.frame_pending())
+    {
+        paint();
+    }
+
+    bool match = check_result(widget, expected);
+    const ImageView::RenderStats& stats = widget.render_stats();
+
+    cout << "{\"suite\": \"replay\", \"target\": \""
+         << trace.target.toStdString() << "\", \"events\": "
+         << trace.events().size() << ", \"folded\": " << stats.inputFolded
+         << ", \"frames\": " << paintCost.size()
+         << ", \"match\": " << (match ? "true" : "false")
+         << ",\n \"process_us\": " << summary(processCost)
+         << ",\n \"paint_us\": " << summary(paintCost) << "}" << endl;
+
+    return match;
+}
+
+int main(int argc, char* argv[])
+try
+{
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+    {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+
+    QApplication app(argc, argv);
+
+    if (argc < 3)
+    {
+        cerr << "Usage: " << argv[0]
+             << " <trace> <image> [initial .mark] [expected .mark]" << endl;
+        cerr << "Annotations recorded in trace are used by default" << endl;
+        return -1;
+    }
+
+    InputTrace trace;
+    if (!trace.load(argv[1]))
+    {
+        cerr << "Failed to load trace: " << trace.error_string().toStdString()
+             << endl;
+        return -1;
+    }
+
+    QImage image(argv[2]);
+    if (image.isNull())
+    {
+        cerr << "Failed to load image: " << argv[2] << endl;
+        return -1;
+    }
+
+    InstanceStore initList =
+        (argc > 3) ? MarkCodec::load(argv[3]) : decode_marks(trace.initMarks);
+    InstanceStore expected =
+        (argc > 4) ? MarkCodec::load(argv[4]) : decode_marks(trace.finalMarks);
+
+    bool match;
+    if (trace.target == "ImageMap")
+    {
+        match = replay<ImageMap>(trace, image, std::move(initList), expected);
+    }
+    else if (trace.target == "RBoxMarkWidget")
+    {
+        match = replay<RBoxMarkWidget>(trace, image, std::move(initList),
+                                       expected);
+    }
+    else
+    {
+        cerr << "Unknown trace target: " << trace.target.toStdString()
+             << endl;
+        return -1;
+    }
+
+    if (!match)
+    {
+        cerr << "Final annotations mismatch with expected ones" << endl;
+        return 1;
+    }
+
+    return 0;
+}
+catch (exception& ex)
+{
+    cerr << ex.what() << endl;
+    return -1;
+}
@@ -0,0 +1,124 @@
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <QImage>
+
+#include <mark_widget.h>
+
+#include "bench_util.hpp"
+
+using namespace std;
+
+QImage make_image(int size, QImage::Format format)
+{
+    // Noise with one-pixel lines, like masts or power lines. Color pixels
+    // are generated unpremultiplied to be valid after conversion.
+    bench::Random rng(0);
+    QImage image(size, size,
+                 (format == QImage::Format_Grayscale8) ? format
+                                                       : QImage::Format_ARGB32);
+    for (int y = 0; y < size; y++)
+    {
+        uchar* line = image.scanLine(y);
+        for (int i = 0; i < image.bytesPerLine(); i++)
+        {
+            line[i] = (y % 97 == 0) ? 255 : (uchar)rng.next();
+        }
+    }
+
+    return image.convertToFormat(format);
+}
+
+int main(int argc, char* argv[])
+{
+    int size = (argc > 1) ? atoi(argv[1]) : 4096;
+
+    struct Scale
+    {
+        const char* name;
+        double ratio;
+    };
+
+    // Pyramid level building, and view scaling between levels
+    vector<Scale> scaleList = {{"half", 0.5}, {"view", 0.3}};
+
+    struct Format
+    {
+        const char* name;
+        QImage::Format format;
+    };
+
+    vector<Format> formatList = {
+        {"argb32", QImage::Format_ARGB32_Premultiplied},
+        {"gray8", QImage::Format_Grayscale8}};
+
+    struct Method
+    {
+        const char* name;
+        ImageScaler::Isa isa;
+    };
+
+    vector<Method> methodList = {{"area_scalar", ImageScaler::Scalar}};
+    if (ImageScaler::best_isa() >= ImageScaler::SSE41)
+    {
+        methodList.push_back({"area_sse41", ImageScaler::SSE41});
+    }
+
+    if (ImageScaler::best_isa() >= ImageScaler::AVX2)
+    {
+        methodList.push_back({"area_avx2", ImageScaler::AVX2});
+    }
+
+    bench::Report report("scale");
+    for (const Format& format : formatList)
+    {
+        QImage image = make_image(size, format.format);
+        double bytes = (double)image.bytesPerLine() * image.height();
+        for (const Scale& scale : scaleList)
+        {
+            QSize target = image.size() * scale.ratio;
+            string suffix = string("/") + format.name + "/" + scale.name;
+
+            report.add(bench::measure(
+                "qt_fast" + suffix,
+                [&]() { bench::keep(image.scaled(target).constBits()); }, 1,
+                bytes));
+            report.add(bench::measure(
+                "qt_smooth" + suffix,
+                [&]()
+                {
+                    bench::keep(image
+                                    .scaled(target, Qt::IgnoreAspectRatio,
+                                            Qt::SmoothTransformation)
+                                    .constBits());
+                },
+                1, bytes));
+
+            for (const Method& method : methodList)
+            {
+                report.add(bench::measure(
+                    method.name + suffix,
+                    [&]()
+                    {
+                        bench::keep(ImageScaler::scaled(image, target, 1,
+                                                        method.isa)
+                                        .constBits());
+                    },
+                    1, bytes));
+            }
+
+            report.add(bench::measure(
+                "area_threads" + suffix,
+                [&]()
+                {
+                    bench::keep(
+                        ImageScaler::scaled(image, target).constBits());
+                },
+                1, bytes));
+        }
+    }
+
+    report.print();
+    return 0;
+}
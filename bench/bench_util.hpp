@@ -0,0 +1,161 @@
+#ifndef __BENCH_UTIL_HPP__
+#define __BENCH_UTIL_HPP__
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <mark_instance.hpp>
+
+namespace bench
+{
+/** Platform independent random generator (SplitMix64) for reproducible data */
+class Random
+{
+   public:
+    explicit Random(uint64_t seed) : state(seed) {}
+
+    uint64_t next()
+    {
+        uint64_t z = (this->state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+
+    double uniform(double low, double high)
+    {
+        double unit = (this->next() >> 11) / 9007199254740992.0;  // [0, 1)
+        return low + (high - low) * unit;
+    }
+
+    int uniform_int(int low, int high)
+    {
+        return low + (int)(this->next() % (uint64_t)(high - low + 1));
+    }
+
+   private:
+    uint64_t state;
+};
+
+/** Synthetic rotated boxes spread over image of given size */
+inline ican_mark::InstanceStore make_instances(int count, double width,
+                                               double height,
+                                               uint64_t seed = 0)
+{
+    Random rng(seed);
+    ican_mark::InstanceStore ret;
+    ret.reserve(count);
+    for (int i = 0; i < count; i++)
+    {
+        ican_mark::Instance inst;
+        inst.set_label(rng.uniform_int(0, 3));
+        inst.set_degree(rng.uniform(-180, 180));
+        inst.set_x(rng.uniform(0, width));
+        inst.set_y(rng.uniform(0, height));
+        inst.set_w(rng.uniform(16, 96));
+        inst.set_h(rng.uniform(16, 96));
+        ret.push_back(inst);
+    }
+
+    return ret;
+}
+
+/** Keep computed value from being optimized out */
+template <typename T>
+inline void keep(const T& value)
+{
+#if defined(__GNUC__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static volatile char sink;
+    sink = *reinterpret_cast<const volatile char*>(&value);
+#endif
+}
+
+struct Result
+{
+    std::string name;
+    long long iterations;
+    double seconds;
+    double itemsPerOp;  // Processed items in one operation, e.g. events
+    double bytesPerOp;
+
+    double ns_per_op() const { return this->seconds * 1e9 / this->iterations; }
+};
+
+/**
+ * Run function repeatedly until minimum time reached, with iterations being
+ * doubled in each round.
+ */
+template <typename Func>
+Result measure(const std::string& name, Func func, double itemsPerOp = 1,
+               double bytesPerOp = 0, double minSeconds = 0.5)
+{
+    func();  // Warm up
+
+    long long iterations = 1;
+    while (true)
+    {
+        auto start = std::chrono::steady_clock::now();
+        for (long long i = 0; i < iterations; i++)
+        {
+            func();
+        }
+
+        std::chrono::duration<double> cost =
+            std::chrono::steady_clock::now() - start;
+        if (cost.count() >= minSeconds || iterations >= (1LL << 40))
+        {
+            return {name, iterations, cost.count(), itemsPerOp, bytesPerOp};
+        }
+
+        iterations *= 2;
+    }
+}
+
+/** Benchmark results emitted as JSON */
+class Report
+{
+   public:
+    explicit Report(const std::string& suite) : suite(suite) {}
+
+    void add(const Result& result)
+    {
+        this->resultList.push_back(result);
+        std::cerr << result.name << ": " << result.ns_per_op() << " ns/op"
+                  << std::endl;
+    }
+
+    void print(std::ostream& out = std::cout) const
+    {
+        char buf[512];
+        out << "{\"suite\": \"" << this->suite << "\", \"results\": [";
+        for (size_t i = 0; i < this->resultList.size(); i++)
+        {
+            const Result& res = this->resultList[i];
+            double opsPerSec = res.iterations / res.seconds;
+            snprintf(buf, sizeof(buf),
+                     "%s\n  {\"name\": \"%s\", \"iterations\": %lld, "
+                     "\"ns_per_op\": %.3f, \"items_per_sec\": %.3f, "
+                     "\"bytes_per_sec\": %.3f}",
+                     (i > 0) ? "," : "", res.name.c_str(), res.iterations,
+                     res.ns_per_op(), opsPerSec * res.itemsPerOp,
+                     opsPerSec * res.bytesPerOp);
+            out << buf;
+        }
+
+        out << "\n]}" << std::endl;
+    }
+
+   private:
+    std::string suite;
+    std::vector<Result> resultList;
+};
+
+}  // namespace bench
+
+#endif
@@ -0,0 +1,119 @@
+#include <cmath>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include <QColor>
+#include <QDir>
+#include <QGuiApplication>
+#include <QImage>
+#include <QPainter>
+#include <QString>
+
+#include <mark_codec.hpp>
+#include <mark_instance.hpp>
+
+#include "bench_util.hpp"
+
+using namespace std;
+using namespace ican_mark;
+
+// Synthetic image with gradient background and random blobs
+QImage make_image(int size, bench::Random& rng)
+{
+    QImage image(size, size, QImage::Format_RGB32);
+    for (int y = 0; y < size; y++)
+    {
+        QRgb* row = reinterpret_cast<QRgb*>(image.scanLine(y));
+        for (int x = 0; x < size; x++)
+        {
+            row[x] = qRgb(x * 255 / size, y * 255 / size, 128);
+        }
+    }
+
+    QPainter painter(&image);
+    painter.setPen(Qt::NoPen);
+    for (int i = 0; i < 256; i++)
+    {
+        painter.setBrush(QColor(rng.uniform_int(0, 255),
+                                rng.uniform_int(0, 255),
+                                rng.uniform_int(0, 255)));
+        painter.drawEllipse(QPointF(rng.uniform(0, size), rng.uniform(0, size)),
+                            rng.uniform(4, 64), rng.uniform(4, 64));
+    }
+
+    return image;
+}
+
+int main(int argc, char* argv[])
+try
+{
+    if (argc < 2)
+    {
+        cout << "Usage: " << argv[0]
+             << " <out_dir> [images = 10] [min_inst = 1] [max_inst = 100000]"
+                " [image_size = 2048] [seed = 0]"
+             << endl;
+        return -1;
+    }
+
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+    {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+
+    QGuiApplication app(argc, argv);
+
+    QString outDir = QString::fromLocal8Bit(argv[1]);
+    int images = (argc > 2) ? atoi(argv[2]) : 10;
+    int minInst = (argc > 3) ? atoi(argv[3]) : 1;
+    int maxInst = (argc > 4) ? atoi(argv[4]) : 100000;
+    int imageSize = (argc > 5) ? atoi(argv[5]) : 2048;
+    uint64_t seed = (argc > 6) ? strtoull(argv[6], nullptr, 10) : 0;
+
+    if (!QDir().mkpath(outDir))
+    {
+        throw runtime_error("Failed to create " + outDir.toStdString());
+    }
+
+    bench::Random rng(seed);
+    for (int i = 0; i < images; i++)
+    {
+        // Instance counts are log-uniformly distributed
+        int instCount = (int)round(
+            exp(rng.uniform(log((double)minInst), log((double)maxInst))));
+
+        QString imgPath =
+            QDir(outDir).filePath(QString("synthetic_%1.png").arg(i, 6, 10,
+                                                                   QChar('0')));
+        if (!make_image(imageSize, rng).save(imgPath))
+        {
+            throw runtime_error("Failed to save " + imgPath.toStdString());
+        }
+
+        string buf;
+        MarkCodec::encode(buf, bench::make_instances(instCount, imageSize,
+                                                     imageSize, rng.next()));
+        ofstream fWriter((imgPath + ".mark").toStdString(), ios::binary);
+        fWriter.write(buf.data(), buf.size());
+
+        cout << imgPath.toStdString() << ": " << instCount << " instances"
+             << endl;
+    }
+
+    // Class names being found by ICANMark automatically
+    ofstream fWriter(QDir(outDir).filePath("synthetic.names").toStdString());
+    fWriter << "- car\n- truck\n- ship\n- plane\n";
+
+    return 0;
+}
+catch (exception& ex)
+{
+    cout << endl;
+    cout << "Error!" << endl;
+    cout << ex.what() << endl;
+    cout << endl;
+    return -1;
+}
@@ -12,6 +12,13 @@ include_directories(${Qt5Widgets_INCLUDE_DIRS})
 find_package(yaml-cpp REQUIRED)
 include_directories(${YAML_CPP_INCLUDE_DIR})
 
+# Find libtiff, optional for decoding tiled TIFF by regions
+find_package(TIFF)
+if(TIFF_FOUND)
+    add_definitions(-DWITH_TIFF)
+    include_directories(${TIFF_INCLUDE_DIR})
+endif()
+
 set(CMAKE_MODULE_PATH ${CMAKE_MODULE_PATH} ${CMAKE_CURRENT_SOURCE_DIR}/cmake)
 
 # Include subdirectories
@@ -41,3 +48,7 @@ set(PROJECT_DEPS
     ${YAML_CPP_LIBRARIES}
     Qt5::Widgets
     )
+
+if(TIFF_FOUND)
+    set(PROJECT_DEPS ${PROJECT_DEPS} ${TIFF_LIBRARIES})
+endif()
@@ -5,10 +5,7 @@ namespace ican_mark
 void ClickAction::reset()
 {
     this->s = static_cast<int>(State::MOVE);
-    for (auto it = this->varMap.begin(); it != this->varMap.end(); it++)
-    {
-        it->second = QPointF();
-    }
+    this->varList.fill(QPointF());
 }
 
 void ClickAction::run(QInputEvent* event)
@@ -16,13 +13,13 @@ void ClickAction::run(QInputEvent* event)
     QEvent::Type eventType = event->type();
 
     QPointF pos = static_cast<QMouseEvent*>(event)->localPos();
-    this->varMap["move"] = pos;
+    this->var(Key::MOVE) = pos;
     switch (static_cast<State>(this->s))
     {
         case State::MOVE:
             if (eventType == QEvent::MouseButtonPress)
             {
-                this->varMap["press"] = pos;
+                this->var(Key::PRESS) = pos;
                 this->s++;
             }
 
@@ -31,7 +28,7 @@ void ClickAction::run(QInputEvent* event)
         case State::PRESS:
             if (eventType == QEvent::MouseButtonRelease)
             {
-                this->varMap["release"] = pos;
+                this->var(Key::RELEASE) = pos;
                 this->s++;
             }
 
@@ -51,18 +48,10 @@ bool ClickAction::finish() const
 
 int ClickAction::state() const { return this->s; }
 
-const QPointF& ClickAction::operator[](std::string key) const
+const char* ClickAction::key_name(size_t index) const
 {
-    auto it = this->varMap.find(key);
-    if (it == this->varMap.end())
-    {
-        std::string errMsg =
-            std::string("'") + key +
-            std::string("' variable not exist in class 'ClickAction'");
-        throw std::invalid_argument(errMsg);
-    }
-
-    return it->second;
+    static const char* const nameList[] = {"move", "press", "release"};
+    return nameList[index];
 }
 
 }  // namespace ican_mark
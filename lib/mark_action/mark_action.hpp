@@ -1,6 +1,8 @@
 #ifndef __MARK_ACTION_HPP__
 #define __MARK_ACTION_HPP__
 
+#include <array>
+#include <cstddef>
 #include <exception>
 #include <stdexcept>
 #include <string>
@@ -13,21 +15,21 @@ namespace ican_mark
 const QPointF operator*(const QPointF& point, const QPointF& factor);
 const QPointF operator/(const QPointF& point, const QPointF& divisor);
 
-#define MARK_ACTION_OPERATOR_IMPL(ClassName, ArgClass, op, accessor)     \
-    const ClassName operator op(const ArgClass& data) const              \
-    {                                                                    \
-        ClassName ret = (*this);                                         \
-        for (auto it = ret.varMap.begin(); it != ret.varMap.end(); it++) \
-        {                                                                \
-            it->second = it->second op accessor;                         \
-        }                                                                \
-        return ret;                                                      \
+#define MARK_ACTION_OPERATOR_IMPL(ClassName, ArgClass, op, accessor) \
+    const ClassName operator op(const ArgClass& data) const          \
+    {                                                                \
+        ClassName ret = (*this);                                     \
+        for (size_t i = 0; i < ret.varList.size(); i++)              \
+        {                                                            \
+            ret.varList[i] = ret.varList[i] op accessor;             \
+        }                                                            \
+        return ret;                                                  \
     }
 
 #define MARK_ACTION_OPERATOR_QPOINTF(ClassName, op) \
     MARK_ACTION_OPERATOR_IMPL(ClassName, QPointF, op, data)
 #define MARK_ACTION_OPERATOR_CLASSNAME(ClassName, op) \
-    MARK_ACTION_OPERATOR_IMPL(ClassName, ClassName, op, data[it->first])
+    MARK_ACTION_OPERATOR_IMPL(ClassName, ClassName, op, data.varList[i])
 
 #define MARK_ACTION_OPERATOR(ClassName)          \
    public:                                       \
@@ -40,10 +42,18 @@ const QPointF operator/(const QPointF& point, const QPointF& divisor);
     MARK_ACTION_OPERATOR_CLASSNAME(ClassName, *) \
     MARK_ACTION_OPERATOR_CLASSNAME(ClassName, /)
 
-template <typename argType>
+/**
+ * Base of marking actions.
+ *
+ * Sub-states are stored in a fixed array indexed by compile-time keys,
+ * the string keyed access is kept for compatibility only.
+ */
+template <typename argType, typename keyType, size_t keyCount>
 class ActionBase
 {
    public:
+    typedef keyType Key;
+
     virtual void reset() = 0;
     virtual void run(QInputEvent* event) = 0;
     virtual void revert() = 0;
@@ -51,13 +61,47 @@ class ActionBase
     virtual bool finish() const = 0;
     virtual int state() const = 0;
 
-    virtual const argType& operator[](std::string key) const = 0;
+    const argType& operator[](keyType key) const
+    {
+        return this->varList[static_cast<size_t>(key)];
+    }
+
+    const argType& operator[](const std::string& key) const
+    {
+        for (size_t i = 0; i < keyCount; i++)
+        {
+            if (key == this->key_name(i))
+            {
+                return this->varList[i];
+            }
+        }
+
+        std::string errMsg = std::string("'") + key +
+                             std::string("' variable not exist in class '") +
+                             this->class_name() + std::string("'");
+        throw std::invalid_argument(errMsg);
+    }
 
    protected:
-    std::map<std::string, argType> varMap;
+    std::array<argType, keyCount> varList;
+
+    argType& var(keyType key)
+    {
+        return this->varList[static_cast<size_t>(key)];
+    }
+
+    virtual const char* key_name(size_t index) const = 0;
+    virtual const char* class_name() const = 0;
+};
+
+enum class ClickKey
+{
+    MOVE,
+    PRESS,
+    RELEASE
 };
 
-class ClickAction : public ActionBase<QPointF>
+class ClickAction : public ActionBase<QPointF, ClickKey, 3>
 {
     MARK_ACTION_OPERATOR(ClickAction)
 
@@ -69,12 +113,6 @@ class ClickAction : public ActionBase<QPointF>
         RELEASE
     };
 
-    ClickAction()
-    {
-        this->varMap = {
-            {"move", QPointF()}, {"press", QPointF()}, {"release", QPointF()}};
-    }
-
     void reset();
     void run(QInputEvent* event);
     void revert();
@@ -82,13 +120,20 @@ class ClickAction : public ActionBase<QPointF>
     bool finish() const;
     int state() const;
 
-    const QPointF& operator[](std::string key) const;
-
    protected:
     int s = static_cast<int>(State::MOVE);
+
+    const char* key_name(size_t index) const;
+    const char* class_name() const { return "ClickAction"; }
 };
 
-class TwiceClick : public ActionBase<ClickAction>
+enum class TwiceClickKey
+{
+    POS1,
+    POS2
+};
+
+class TwiceClick : public ActionBase<ClickAction, TwiceClickKey, 2>
 {
     MARK_ACTION_OPERATOR(TwiceClick)
 
@@ -100,11 +145,6 @@ class TwiceClick : public ActionBase<ClickAction>
         POS2_FIN
     };
 
-    TwiceClick()
-    {
-        this->varMap = {{"pos1", ClickAction()}, {"pos2", ClickAction()}};
-    }
-
     void reset();
     void run(QInputEvent* event);
     void revert();
@@ -112,13 +152,20 @@ class TwiceClick : public ActionBase<ClickAction>
     bool finish() const;
     int state() const;
 
-    const ClickAction& operator[](std::string key) const;
-
    protected:
     int s = static_cast<int>(State::INIT);
+
+    const char* key_name(size_t index) const;
+    const char* class_name() const { return "TwiceClick"; }
 };
 
-class RBoxMark : public ActionBase<TwiceClick>
+enum class RBoxMarkKey
+{
+    DEGREE,
+    BBOX
+};
+
+class RBoxMark : public ActionBase<TwiceClick, RBoxMarkKey, 2>
 {
     MARK_ACTION_OPERATOR(RBoxMark)
 
@@ -130,11 +177,6 @@ class RBoxMark : public ActionBase<TwiceClick>
         BBOX_FIN
     };
 
-    RBoxMark()
-    {
-        this->varMap = {{"degree", TwiceClick()}, {"bbox", TwiceClick()}};
-    }
-
     void reset();
     void run(QInputEvent* event);
     void revert();
@@ -142,10 +184,11 @@ class RBoxMark : public ActionBase<TwiceClick>
     bool finish() const;
     int state() const;
 
-    const TwiceClick& operator[](std::string key) const;
-
    protected:
     int s = static_cast<int>(State::INIT);
+
+    const char* key_name(size_t index) const;
+    const char* class_name() const { return "RBoxMark"; }
 };
 
 }  // namespace ican_mark
@@ -5,9 +5,9 @@ namespace ican_mark
 void RBoxMark::reset()
 {
     this->s = static_cast<int>(State::INIT);
-    for (auto it = this->varMap.begin(); it != this->varMap.end(); it++)
+    for (TwiceClick& action : this->varList)
     {
-        it->second = TwiceClick();
+        action.reset();
     }
 }
 
@@ -16,8 +16,8 @@ void RBoxMark::run(QInputEvent* event)
     switch (static_cast<State>(this->s))
     {
         case State::INIT:
-            this->varMap["degree"].run(event);
-            if (this->varMap["degree"].finish())
+            this->var(Key::DEGREE).run(event);
+            if (this->var(Key::DEGREE).finish())
             {
                 this->s++;
             }
@@ -25,8 +25,8 @@ void RBoxMark::run(QInputEvent* event)
             break;
 
         case State::DEGREE_FIN:
-            this->varMap["bbox"].run(event);
-            if (this->varMap["bbox"].finish())
+            this->var(Key::BBOX).run(event);
+            if (this->var(Key::BBOX).finish())
             {
                 this->s++;
             }
@@ -43,25 +43,25 @@ void RBoxMark::revert()
     switch (static_cast<State>(this->s))
     {
         case State::INIT:
-            this->varMap["degree"].revert();
+            this->var(Key::DEGREE).revert();
 
             break;
 
         case State::DEGREE_FIN:
-            if (this->varMap["bbox"].state() == 0)
+            if (this->var(Key::BBOX).state() == 0)
             {
-                this->varMap["degree"].revert();
+                this->var(Key::DEGREE).revert();
                 this->s--;
             }
             else
             {
-                this->varMap["bbox"].revert();
+                this->var(Key::BBOX).revert();
             }
 
             break;
 
         case State::BBOX_FIN:
-            this->varMap["bbox"].revert();
+            this->var(Key::BBOX).revert();
             this->s--;
 
             break;
@@ -75,18 +75,10 @@ bool RBoxMark::finish() const
 
 int RBoxMark::state() const { return this->s; }
 
-const TwiceClick& RBoxMark::operator[](std::string key) const
+const char* RBoxMark::key_name(size_t index) const
 {
-    auto it = this->varMap.find(key);
-    if (it == this->varMap.end())
-    {
-        std::string errMsg =
-            std::string("'") + key +
-            std::string("' variable not exist in class 'RBoxMark'");
-        throw std::invalid_argument(errMsg);
-    }
-
-    return it->second;
+    static const char* const nameList[] = {"degree", "bbox"};
+    return nameList[index];
 }
 
 }  // namespace ican_mark
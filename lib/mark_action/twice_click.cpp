@@ -5,9 +5,9 @@ namespace ican_mark
 void TwiceClick::reset()
 {
     this->s = static_cast<int>(State::INIT);
-    for (auto it = this->varMap.begin(); it != this->varMap.end(); it++)
+    for (ClickAction& action : this->varList)
     {
-        it->second = ClickAction();
+        action.reset();
     }
 }
 
@@ -16,8 +16,8 @@ void TwiceClick::run(QInputEvent* event)
     switch (static_cast<State>(this->s))
     {
         case State::INIT:
-            this->varMap["pos1"].run(event);
-            if (this->varMap["pos1"].finish())
+            this->var(Key::POS1).run(event);
+            if (this->var(Key::POS1).finish())
             {
                 this->s++;
             }
@@ -25,8 +25,8 @@ void TwiceClick::run(QInputEvent* event)
             break;
 
         case State::POS1_FIN:
-            this->varMap["pos2"].run(event);
-            if (this->varMap["pos2"].finish())
+            this->var(Key::POS2).run(event);
+            if (this->var(Key::POS2).finish())
             {
                 this->s++;
             }
@@ -46,12 +46,12 @@ void TwiceClick::revert()
             break;
 
         case State::POS1_FIN:
-            this->varMap["pos1"].reset();
+            this->var(Key::POS1).reset();
             this->s--;
             break;
 
         case State::POS2_FIN:
-            this->varMap["pos2"].reset();
+            this->var(Key::POS2).reset();
             this->s--;
             break;
     }
@@ -64,18 +64,10 @@ bool TwiceClick::finish() const
 
 int TwiceClick::state() const { return this->s; }
 
-const ClickAction& TwiceClick::operator[](std::string key) const
+const char* TwiceClick::key_name(size_t index) const
 {
-    auto it = this->varMap.find(key);
-    if (it == this->varMap.end())
-    {
-        std::string errMsg =
-            std::string("'") + key +
-            std::string("' variable not exist in class 'TwiceClick'");
-        throw std::invalid_argument(errMsg);
-    }
-
-    return it->second;
+    static const char* const nameList[] = {"pos1", "pos2"};
+    return nameList[index];
 }
 
 }  // namespace ican_mark
@@ -0,0 +1,365 @@
+#include "mark_codec.hpp"
+
+#include <cctype>
+#include <cerrno>
+#include <climits>
+#include <clocale>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+using namespace std;
+
+namespace ican_mark
+{
+namespace
+{
+// Decimal point of C locale functions, may be changed by setlocale()
+char locale_point()
+{
+    const char* point = localeconv()->decimal_point;
+    return (point && point[0]) ? point[0] : '.';
+}
+
+void put_int(string& buf, int val)
+{
+    char tmp[16];
+    int len = snprintf(tmp, sizeof(tmp), "%d", val);
+    buf.append(tmp, len);
+}
+
+void put_double(string& buf, double val, char point)
+{
+    // Same as yaml-cpp emitter with max_digits10 precision
+    if (std::isnan(val))
+    {
+        buf += ".nan";
+    }
+    else if (std::isinf(val))
+    {
+        buf += (val > 0) ? ".inf" : "-.inf";
+    }
+    else
+    {
+        char tmp[32];
+        int len = snprintf(tmp, sizeof(tmp), "%.17g", val);
+        if (point != '.')
+        {
+            char* pos = (char*)memchr(tmp, point, len);
+            if (pos) *pos = '.';
+        }
+
+        buf.append(tmp, len);
+    }
+}
+
+bool parse_int(const char* beg, const char* end, int& val)
+{
+    char tmp[24];
+    size_t len = end - beg;
+    if (len == 0 || len >= sizeof(tmp))
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < len; i++)
+    {
+        char c = beg[i];
+        if (!((c >= '0' && c <= '9') || (i == 0 && (c == '-' || c == '+'))))
+        {
+            return false;
+        }
+    }
+
+    memcpy(tmp, beg, len);
+    tmp[len] = '\0';
+
+    char* stop;
+    errno = 0;
+    long ret = strtol(tmp, &stop, 10);
+    if (stop != tmp + len || errno == ERANGE || ret < INT_MIN || ret > INT_MAX)
+    {
+        return false;
+    }
+
+    val = (int)ret;
+    return true;
+}
+
+bool parse_double(const char* beg, const char* end, double& val, char point)
+{
+    char tmp[64];
+    size_t len = end - beg;
+    if (len == 0 || len >= sizeof(tmp))
+    {
+        return false;
+    }
+
+    // Special values written by yaml-cpp
+    string token(beg, len);
+    if (token == ".nan")
+    {
+        val = NAN;
+        return true;
+    }
+    else if (token == ".inf" || token == "+.inf")
+    {
+        val = INFINITY;
+        return true;
+    }
+    else if (token == "-.inf")
+    {
+        val = -INFINITY;
+        return true;
+    }
+
+    // Accept plain decimal notation only, and replace decimal point for
+    // locale dependent strtod()
+    for (size_t i = 0; i < len; i++)
+    {
+        char c = beg[i];
+        if (c == '.')
+        {
+            c = point;
+        }
+        else if (!((c >= '0' && c <= '9') || c == '-' || c == '+' ||
+                   c == 'e' || c == 'E'))
+        {
+            return false;
+        }
+
+        tmp[i] = c;
+    }
+
+    tmp[len] = '\0';
+
+    char* stop;
+    errno = 0;
+    val = strtod(tmp, &stop);
+    return (stop == tmp + len && errno != ERANGE);
+}
+
+}  // namespace
+
+void MarkCodec::encode(string& buf, const InstanceStore& instList)
+{
+    size_t size = instList.size();
+    if (size == 0)
+    {
+        buf += "[]";
+        return;
+    }
+
+    const uint8_t* mask = instList.mask_data();
+    const int* label = instList.label_data();
+    const double* degree = instList.degree_data();
+    const double* x = instList.x_data();
+    const double* y = instList.y_data();
+    const double* w = instList.w_data();
+    const double* h = instList.h_data();
+
+    char point = locale_point();
+    buf.reserve(buf.size() + size * 160);
+    for (size_t i = 0; i < size; i++)
+    {
+        if (i > 0)
+        {
+            buf.push_back('\n');
+        }
+
+        if (mask[i] == 0)
+        {
+            buf += "- ~";
+            continue;
+        }
+
+        const char* prefix = "- ";
+
+#define __attr_key(name) \
+    buf += prefix;       \
+    buf += #name ": ";   \
+    prefix = "\n  "
+
+        if (mask[i] & Instance::ATTR_LABEL)
+        {
+            __attr_key(label);
+            put_int(buf, label[i]);
+        }
+
+#define __attr_encode_double(name, flag) \
+    if (mask[i] & flag)                  \
+    {                                    \
+        __attr_key(name);                \
+        put_double(buf, name[i], point); \
+    }
+
+        __attr_encode_double(degree, Instance::ATTR_DEGREE);
+        __attr_encode_double(x, Instance::ATTR_X);
+        __attr_encode_double(y, Instance::ATTR_Y);
+        __attr_encode_double(w, Instance::ATTR_W);
+        __attr_encode_double(h, Instance::ATTR_H);
+    }
+}
+
+InstanceStore MarkCodec::decode(const char* data, size_t size)
+{
+    InstanceStore ret;
+    if (!fast_decode(data, size, ret))
+    {
+        // Leave unusual content to yaml-cpp
+        YAML::Node node = YAML::Load(string(data, size));
+        ret = node.as<InstanceStore>();
+    }
+
+    return ret;
+}
+
+InstanceStore MarkCodec::load(const string& path)
+{
+    ifstream fReader(path, ios::binary);
+    if (!fReader)
+    {
+        throw runtime_error("Failed to open file: " + path);
+    }
+
+    string content((istreambuf_iterator<char>(fReader)),
+                   istreambuf_iterator<char>());
+    return decode(content);
+}
+
+bool MarkCodec::fast_decode(const char* data, size_t size,
+                            InstanceStore& instList)
+{
+    const char* ptr = data;
+    const char* end = data + size;
+    char point = locale_point();
+
+    Instance inst;
+    bool hasInst = false;
+    bool nullInst = false;
+
+    instList.clear();
+    while (ptr < end)
+    {
+        // Find current line without line break and trailing spaces
+        const char* lineEnd = (const char*)memchr(ptr, '\n', end - ptr);
+        const char* next = lineEnd ? lineEnd + 1 : end;
+        const char* last = lineEnd ? lineEnd : end;
+        while (last > ptr && (last[-1] == '\r' || last[-1] == ' '))
+        {
+            last--;
+        }
+
+        if (last == ptr)
+        {
+            ptr = next;
+            continue;
+        }
+
+        // Empty sequence
+        if (last - ptr == 2 && ptr[0] == '[' && ptr[1] == ']' && !hasInst)
+        {
+            for (ptr = next; ptr < end; ptr++)
+            {
+                if (!isspace((unsigned char)*ptr)) return false;
+            }
+
+            return true;
+        }
+
+        // Sequence item or its continued attribute
+        if (last - ptr < 3)
+        {
+            return false;
+        }
+
+        if (ptr[0] == '-' && ptr[1] == ' ')
+        {
+            if (hasInst)
+            {
+                instList.push_back(inst);
+            }
+
+            inst = Instance();
+            hasInst = true;
+            nullInst = (last - ptr == 3 && ptr[2] == '~');
+            if (nullInst)
+            {
+                ptr = next;
+                continue;
+            }
+        }
+        else if (!(ptr[0] == ' ' && ptr[1] == ' ' && hasInst && !nullInst))
+        {
+            return false;
+        }
+
+        // Parse "key: value"
+        const char* key = ptr + 2;
+        const char* keyEnd = key;
+        while (keyEnd < last && *keyEnd >= 'a' && *keyEnd <= 'z')
+        {
+            keyEnd++;
+        }
+
+        if (keyEnd == key || last - keyEnd < 3 || keyEnd[0] != ':' ||
+            keyEnd[1] != ' ' || keyEnd[2] == ' ')
+        {
+            return false;
+        }
+
+        const char* val = keyEnd + 2;
+        size_t keyLen = keyEnd - key;
+
+#define __key_is(name)                                               \
+    (keyLen == sizeof(#name) - 1 && memcmp(key, #name, keyLen) == 0)
+
+        if (__key_is(label))
+        {
+            int label;
+            if (inst.has_label() || !parse_int(val, last, label))
+            {
+                return false;
+            }
+
+            inst.set_label(label);
+        }
+
+#define __attr_decode_double(name)                                      \
+    else if (__key_is(name))                                            \
+    {                                                                   \
+        double name;                                                    \
+        if (inst.has_##name() || !parse_double(val, last, name, point)) \
+        {                                                               \
+            return false;                                               \
+        }                                                               \
+                                                                        \
+        inst.set_##name(name);                                          \
+    }
+
+        __attr_decode_double(degree)
+        __attr_decode_double(x)
+        __attr_decode_double(y)
+        __attr_decode_double(w)
+        __attr_decode_double(h)
+        else
+        {
+            return false;
+        }
+
+        ptr = next;
+    }
+
+    if (hasInst)
+    {
+        instList.push_back(inst);
+    }
+
+    return hasInst;
+}
+
+}  // namespace ican_mark
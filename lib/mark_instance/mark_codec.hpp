@@ -0,0 +1,41 @@
+#ifndef __MARK_CODEC_HPP__
+#define __MARK_CODEC_HPP__
+
+#include <cstddef>
+#include <string>
+
+#include "mark_instance.hpp"
+
+namespace ican_mark
+{
+/**
+ * Streaming reader and writer of .mark files.
+ *
+ * The writer produces the same bytes as emitting YAML::Node converted from
+ * instances. The reader tokenizes the block sequence layout written by the
+ * writer in one pass, and falls back to yaml-cpp for any other content,
+ * e.g. comments, flow style or unknown attributes.
+ */
+class MarkCodec
+{
+   public:
+    /** Append encoded instances to buffer */
+    static void encode(std::string& buf, const InstanceStore& instList);
+
+    static InstanceStore decode(const char* data, size_t size);
+    static InstanceStore decode(const std::string& str)
+    {
+        return decode(str.data(), str.size());
+    }
+
+    /** Read and decode file, throw on failure */
+    static InstanceStore load(const std::string& path);
+
+   protected:
+    static bool fast_decode(const char* data, size_t size,
+                            InstanceStore& instList);
+};
+
+}  // namespace ican_mark
+
+#endif
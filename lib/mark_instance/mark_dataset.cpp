@@ -0,0 +1,684 @@
+#include "mark_dataset.hpp"
+#include "mark_codec.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace ican_mark
+{
+namespace
+{
+const char fileMagic[4] = {'I', 'C', 'M', 'D'};
+const uint32_t fileVersion = 1;
+const uint64_t fileHeaderSize = 8;
+const uint64_t recordHeaderSize = 8;
+const uint32_t tombstone = 0xFFFFFFFF;
+
+void put_u16(string& buf, uint16_t val)
+{
+    buf.push_back((char)(val & 0xFF));
+    buf.push_back((char)(val >> 8));
+}
+
+void put_u32(string& buf, uint32_t val)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        buf.push_back((char)((val >> (i * 8)) & 0xFF));
+    }
+}
+
+void put_f64(string& buf, double val)
+{
+    uint64_t bits;
+    memcpy(&bits, &val, sizeof(bits));
+    for (int i = 0; i < 8; i++)
+    {
+        buf.push_back((char)((bits >> (i * 8)) & 0xFF));
+    }
+}
+
+uint16_t get_u16(const char* ptr)
+{
+    const unsigned char* src = (const unsigned char*)ptr;
+    return (uint16_t)(src[0] | (src[1] << 8));
+}
+
+uint32_t get_u32(const char* ptr)
+{
+    const unsigned char* src = (const unsigned char*)ptr;
+    return (uint32_t)src[0] | ((uint32_t)src[1] << 8) |
+           ((uint32_t)src[2] << 16) | ((uint32_t)src[3] << 24);
+}
+
+double get_f64(const char* ptr)
+{
+    const unsigned char* src = (const unsigned char*)ptr;
+    uint64_t bits = 0;
+    for (int i = 0; i < 8; i++)
+    {
+        bits |= (uint64_t)src[i] << (i * 8);
+    }
+
+    double val;
+    memcpy(&val, &bits, sizeof(val));
+    return val;
+}
+
+uint32_t checksum(const char* data, size_t size)
+{
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= (unsigned char)data[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+string record_header(const string& payload)
+{
+    string buf;
+    put_u32(buf, (uint32_t)payload.size());
+    put_u32(buf, checksum(payload.data(), payload.size()));
+    return buf;
+}
+
+string key_payload(const string& key)
+{
+    if (key.size() > 0xFFFF)
+    {
+        throw invalid_argument("Dataset key is too long: " + key);
+    }
+
+    string buf;
+    put_u16(buf, (uint16_t)key.size());
+    buf += key;
+    return buf;
+}
+
+bool body_valid(const char* body, uint32_t size)
+{
+    // Body is a tombstone or instances filling it exactly
+    uint32_t instCount = get_u32(body);
+    if (instCount == tombstone)
+    {
+        return size == 4;
+    }
+
+    uint32_t used = 4;
+    if (instCount > size - used)
+    {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < instCount; i++)
+    {
+        if (used >= size)
+        {
+            return false;
+        }
+
+        uint8_t mask = (uint8_t)body[used++];
+        if (mask & ~0x3F)
+        {
+            return false;
+        }
+
+        used += (mask & Instance::ATTR_LABEL) ? 4 : 0;
+        for (uint8_t bit = Instance::ATTR_DEGREE; bit <= Instance::ATTR_H;
+             bit <<= 1)
+        {
+            used += (mask & bit) ? 8 : 0;
+        }
+    }
+
+    return used == size;
+}
+
+uint32_t record_size(const char* data, uint64_t size, uint64_t pos)
+{
+    // Payload size of valid record at pos, or 0 if there is none. Garbage is
+    // mostly rejected by its shape, before the costly checksum
+    if (pos + recordHeaderSize > size)
+    {
+        return 0;
+    }
+
+    uint32_t recSize = get_u32(data + pos);
+    const char* payload = data + pos + recordHeaderSize;
+    if (recSize < 6 || pos + recordHeaderSize + recSize > size)
+    {
+        return 0;
+    }
+
+    uint32_t keySize = get_u16(payload);
+    if (keySize + 6 > recSize ||
+        !body_valid(payload + 2 + keySize, recSize - 2 - keySize) ||
+        checksum(payload, recSize) != get_u32(data + pos + 4))
+    {
+        return 0;
+    }
+
+    return recSize;
+}
+
+}  // namespace
+
+DatasetStore::DatasetStore(const string& path, bool skipDamaged)
+{
+    this->open(path, skipDamaged);
+}
+
+DatasetStore::~DatasetStore() { this->close(); }
+
+void DatasetStore::open(const string& path, bool skipDamaged)
+{
+    this->close();
+    this->skipDamaged = skipDamaged;
+
+    this->file = fopen(path.c_str(), "r+b");
+    if (!this->file)
+    {
+        // Create new dataset
+        this->file = fopen(path.c_str(), "w+b");
+        if (!this->file)
+        {
+            throw runtime_error("Failed to open dataset: " + path);
+        }
+
+        string header(fileMagic, sizeof(fileMagic));
+        put_u32(header, fileVersion);
+        if (fwrite(header.data(), 1, header.size(), this->file) !=
+                header.size() ||
+            fflush(this->file) != 0)
+        {
+            this->close();
+            throw runtime_error("Failed to write dataset: " + path);
+        }
+    }
+
+    this->filePath = path;
+
+    try
+    {
+        this->scan();
+    }
+    catch (...)
+    {
+        this->close();
+        throw;
+    }
+}
+
+void DatasetStore::close()
+{
+    this->unmap_file();
+    if (this->file)
+    {
+        fclose(this->file);
+        this->file = nullptr;
+    }
+
+    this->index.clear();
+    this->fileSize = 0;
+    this->liveSize = 0;
+    this->damagedSize = 0;
+}
+
+bool DatasetStore::contains(const string& key) const
+{
+    return this->index.find(key) != this->index.end();
+}
+
+vector<string> DatasetStore::keys() const
+{
+    vector<string> ret;
+    ret.reserve(this->index.size());
+    for (auto it = this->index.begin(); it != this->index.end(); it++)
+    {
+        ret.push_back(it->first);
+    }
+
+    sort(ret.begin(), ret.end());
+    return ret;
+}
+
+InstanceStore DatasetStore::get(const string& key) const
+{
+    auto it = this->index.find(key);
+    if (it == this->index.end())
+    {
+        throw out_of_range("Dataset key not found: " + key);
+    }
+
+    const Record& rec = it->second;
+    if (rec.offset + rec.size > this->mapSize)
+    {
+        this->map_file();
+    }
+
+    return decode(this->mapData + rec.offset, rec.size);
+}
+
+void DatasetStore::put(const string& key, const InstanceStore& instList)
+{
+    string body;
+    encode(body, instList);
+    this->append(key, body);
+}
+
+void DatasetStore::remove(const string& key)
+{
+    if (!this->contains(key))
+    {
+        return;
+    }
+
+    string body;
+    put_u32(body, tombstone);
+    this->append(key, body);
+}
+
+void DatasetStore::flush()
+{
+    if (!this->file)
+    {
+        return;
+    }
+
+    fflush(this->file);
+#ifndef _WIN32
+    fsync(fileno(this->file));
+#endif
+}
+
+void DatasetStore::compact()
+{
+    if (!this->file)
+    {
+        throw runtime_error("Dataset not opened");
+    }
+
+    // Rewrite latest records to temporary file
+    string tmpPath = this->filePath + ".compact";
+    {
+        DatasetStore tmp;
+        std::remove(tmpPath.c_str());
+        tmp.open(tmpPath);
+
+        this->map_file();
+        for (const string& key : this->keys())
+        {
+            const Record& rec = this->index[key];
+            tmp.append(key, string(this->mapData + rec.offset, rec.size));
+        }
+
+        tmp.flush();
+    }
+
+    // Replace dataset file, original one is reopened if failed
+    string path = this->filePath;
+    bool skipDamaged = this->skipDamaged;
+    this->close();
+
+#ifdef _WIN32
+    // Renaming does not replace existing file
+    string oldPath = path + ".old";
+    std::remove(oldPath.c_str());
+    bool replaced = std::rename(path.c_str(), oldPath.c_str()) == 0;
+    if (replaced && std::rename(tmpPath.c_str(), path.c_str()) != 0)
+    {
+        std::rename(oldPath.c_str(), path.c_str());
+        replaced = false;
+    }
+
+    std::remove(oldPath.c_str());
+#else
+    bool replaced = std::rename(tmpPath.c_str(), path.c_str()) == 0;
+#endif
+    this->open(path, skipDamaged);
+    if (!replaced)
+    {
+        std::remove(tmpPath.c_str());
+        throw runtime_error("Failed to replace dataset: " + path);
+    }
+}
+
+bool DatasetStore::compact_if_needed(double garbageRatio)
+{
+    if (this->garbage_ratio() > garbageRatio)
+    {
+        this->compact();
+        return true;
+    }
+
+    return false;
+}
+
+double DatasetStore::garbage_ratio() const
+{
+    if (this->fileSize <= fileHeaderSize)
+    {
+        return 0;
+    }
+
+    return 1.0 - (double)this->liveSize / (this->fileSize - fileHeaderSize);
+}
+
+void DatasetStore::import_mark(const string& key, const string& markPath)
+{
+    this->put(key, MarkCodec::load(markPath));
+}
+
+void DatasetStore::export_mark(const string& key, const string& markPath) const
+{
+    string buf;
+    MarkCodec::encode(buf, this->get(key));
+
+    ofstream fWriter(markPath, ios::binary);
+    fWriter.write(buf.data(), buf.size());
+    if (!fWriter)
+    {
+        throw runtime_error("Failed to write: " + markPath);
+    }
+}
+
+void DatasetStore::encode(string& buf, const InstanceStore& instList)
+{
+    size_t size = instList.size();
+    const uint8_t* mask = instList.mask_data();
+    const int* label = instList.label_data();
+    const double* degree = instList.degree_data();
+    const double* x = instList.x_data();
+    const double* y = instList.y_data();
+    const double* w = instList.w_data();
+    const double* h = instList.h_data();
+
+    buf.reserve(buf.size() + 4 + size * 45);
+    put_u32(buf, (uint32_t)size);
+    for (size_t i = 0; i < size; i++)
+    {
+        buf.push_back((char)mask[i]);
+        if (mask[i] & Instance::ATTR_LABEL) put_u32(buf, (uint32_t)label[i]);
+        if (mask[i] & Instance::ATTR_DEGREE) put_f64(buf, degree[i]);
+        if (mask[i] & Instance::ATTR_X) put_f64(buf, x[i]);
+        if (mask[i] & Instance::ATTR_Y) put_f64(buf, y[i]);
+        if (mask[i] & Instance::ATTR_W) put_f64(buf, w[i]);
+        if (mask[i] & Instance::ATTR_H) put_f64(buf, h[i]);
+    }
+}
+
+InstanceStore DatasetStore::decode(const char* data, size_t size)
+{
+    const char* ptr = data;
+    const char* end = data + size;
+    auto require = [&](size_t len)
+    {
+        if ((size_t)(end - ptr) < len)
+        {
+            throw runtime_error("Corrupted dataset record");
+        }
+    };
+
+    require(4);
+    uint32_t instCount = get_u32(ptr);
+    ptr += 4;
+    if (instCount == tombstone || instCount > size)
+    {
+        throw runtime_error("Corrupted dataset record");
+    }
+
+    InstanceStore ret;
+    ret.reserve(instCount);
+    for (uint32_t i = 0; i < instCount; i++)
+    {
+        Instance inst;
+
+        require(1);
+        uint8_t mask = (uint8_t)*ptr++;
+        if (mask & Instance::ATTR_LABEL)
+        {
+            require(4);
+            inst.set_label((int)get_u32(ptr));
+            ptr += 4;
+        }
+
+#define __attr_decode_f64(name, flag)  \
+    if (mask & flag)                   \
+    {                                  \
+        require(8);                    \
+        inst.set_##name(get_f64(ptr)); \
+        ptr += 8;                      \
+    }
+
+        __attr_decode_f64(degree, Instance::ATTR_DEGREE);
+        __attr_decode_f64(x, Instance::ATTR_X);
+        __attr_decode_f64(y, Instance::ATTR_Y);
+        __attr_decode_f64(w, Instance::ATTR_W);
+        __attr_decode_f64(h, Instance::ATTR_H);
+
+        ret.push_back(inst);
+    }
+
+    return ret;
+}
+
+void DatasetStore::scan()
+{
+    this->map_file();
+    if (this->mapSize < fileHeaderSize ||
+        memcmp(this->mapData, fileMagic, sizeof(fileMagic)) != 0)
+    {
+        throw runtime_error("Invalid dataset file: " + this->filePath);
+    }
+
+    if (get_u32(this->mapData + 4) != fileVersion)
+    {
+        throw runtime_error("Unsupported dataset version: " + this->filePath);
+    }
+
+    // Build index with one sequential pass over all records
+    uint64_t pos = fileHeaderSize;
+    uint64_t end = this->mapSize;
+    while (pos < this->mapSize)
+    {
+        uint32_t size = record_size(this->mapData, this->mapSize, pos);
+        if (size == 0)
+        {
+            // Resynchronize at next valid record
+            uint64_t next = pos + 1;
+            while (next < this->mapSize &&
+                   record_size(this->mapData, this->mapSize, next) == 0)
+            {
+                next++;
+            }
+
+            // Last record running past end of file was not written whole
+            if (next == this->mapSize &&
+                (pos + recordHeaderSize > this->mapSize ||
+                 pos + recordHeaderSize + get_u32(this->mapData + pos) >
+                     this->mapSize))
+            {
+                end = pos;
+                break;
+            }
+
+            if (!this->skipDamaged)
+            {
+                throw runtime_error("Damaged record at offset " +
+                                    to_string(pos) +
+                                    " of dataset: " + this->filePath);
+            }
+
+            this->damagedSize += next - pos;
+            pos = next;
+            continue;
+        }
+
+        const char* payload = this->mapData + pos + recordHeaderSize;
+        uint16_t keySize = get_u16(payload);
+        string key(payload + 2, keySize);
+        uint64_t bodyOffset = pos + recordHeaderSize + 2 + keySize;
+        uint32_t bodySize = size - 2 - keySize;
+
+        auto it = this->index.find(key);
+        if (it != this->index.end())
+        {
+            this->liveSize -=
+                it->second.size + recordHeaderSize + 2 + it->first.size();
+        }
+
+        if (get_u32(this->mapData + bodyOffset) == tombstone)
+        {
+            if (it != this->index.end())
+            {
+                this->index.erase(it);
+            }
+        }
+        else
+        {
+            this->index[key] = {bodyOffset, bodySize};
+            this->liveSize += recordHeaderSize + size;
+        }
+
+        pos += recordHeaderSize + size;
+    }
+
+    // Drop incomplete tail left by interrupted writing
+    if (end < this->mapSize)
+    {
+        this->unmap_file();
+        fflush(this->file);
+#ifdef _WIN32
+        int ret = _chsize_s(_fileno(this->file), end);
+#else
+        int ret = ftruncate(fileno(this->file), end);
+#endif
+        if (ret != 0)
+        {
+            throw runtime_error("Failed to repair dataset: " + this->filePath);
+        }
+    }
+
+    this->fileSize = end;
+}
+
+void DatasetStore::append(const string& key, const string& body)
+{
+    if (!this->file)
+    {
+        throw runtime_error("Dataset not opened");
+    }
+
+    string payload = key_payload(key) + body;
+    string header = record_header(payload);
+
+    if (fseek(this->file, 0, SEEK_END) != 0 ||
+        fwrite(header.data(), 1, header.size(), this->file) != header.size() ||
+        fwrite(payload.data(), 1, payload.size(), this->file) !=
+            payload.size() ||
+        fflush(this->file) != 0)
+    {
+        throw runtime_error("Failed to write dataset: " + this->filePath);
+    }
+
+    // Update index
+    auto it = this->index.find(key);
+    if (it != this->index.end())
+    {
+        this->liveSize -=
+            it->second.size + recordHeaderSize + 2 + it->first.size();
+    }
+
+    uint64_t bodyOffset = this->fileSize + recordHeaderSize + 2 + key.size();
+    if (get_u32(body.data()) == tombstone)
+    {
+        if (it != this->index.end())
+        {
+            this->index.erase(it);
+        }
+    }
+    else
+    {
+        this->index[key] = {bodyOffset, (uint32_t)body.size()};
+        this->liveSize += header.size() + payload.size();
+    }
+
+    this->fileSize += header.size() + payload.size();
+}
+
+void DatasetStore::map_file() const
+{
+    this->unmap_file();
+    fflush(this->file);
+
+#ifdef _WIN32
+    // Fallback to read whole file into memory
+    fseek(this->file, 0, SEEK_END);
+    long size = ftell(this->file);
+    fseek(this->file, 0, SEEK_SET);
+
+    char* buf = new char[size > 0 ? size : 1];
+    if (fread(buf, 1, size, this->file) != (size_t)size)
+    {
+        delete[] buf;
+        throw runtime_error("Failed to read dataset: " + this->filePath);
+    }
+
+    this->mapData = buf;
+    this->mapSize = size;
+#else
+    int fd = fileno(this->file);
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        throw runtime_error("Failed to stat dataset: " + this->filePath);
+    }
+
+    if (st.st_size > 0)
+    {
+        void* ptr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (ptr == MAP_FAILED)
+        {
+            throw runtime_error("Failed to map dataset: " + this->filePath);
+        }
+
+        madvise(ptr, st.st_size, MADV_SEQUENTIAL);
+        this->mapData = (const char*)ptr;
+    }
+
+    this->mapSize = st.st_size;
+#endif
+}
+
+void DatasetStore::unmap_file() const
+{
+    if (this->mapData)
+    {
+#ifdef _WIN32
+        delete[] this->mapData;
+#else
+        munmap((void*)this->mapData, this->mapSize);
+#endif
+    }
+
+    this->mapData = nullptr;
+    this->mapSize = 0;
+}
+
+}  // namespace ican_mark
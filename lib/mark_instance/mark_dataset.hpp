@@ -0,0 +1,109 @@
+#ifndef __MARK_DATASET_HPP__
+#define __MARK_DATASET_HPP__
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "mark_instance.hpp"
+
+namespace ican_mark
+{
+/**
+ * Single file annotation store for a whole dataset.
+ *
+ * The file is an append-only log of per-image records. Writing an image
+ * appends a new record, and the latest record of each key wins. Opening the
+ * file performs one sequential scan over a memory mapped view to build the
+ * key to record index. Stale records are dropped by compact().
+ *
+ * Layout (little endian):
+ *   header: "ICMD" u32(version)
+ *   record: u32(payloadSize) u32(checksum) payload
+ *   payload: u16(keySize) key u32(instCount) instances
+ *   instance: u8(presence mask) [i32(label)] [f64(degree, x, y, w, h)]...
+ *
+ * A record with instCount of 0xFFFFFFFF is a tombstone for removed key.
+ *
+ * A record running past end of file is left by interrupted writing and is
+ * truncated on opening. Damaged records before end of file are never
+ * rewritten on opening, the scan resynchronizes at the next valid record.
+ */
+class DatasetStore
+{
+   public:
+    DatasetStore() = default;
+    explicit DatasetStore(const std::string& path, bool skipDamaged = false);
+    ~DatasetStore();
+
+    DatasetStore(const DatasetStore&) = delete;
+    DatasetStore& operator=(const DatasetStore&) = delete;
+
+    /**
+     * Open dataset file, or create it if not exists. Damaged records throw
+     * unless skipDamaged, then they are kept in file until compact().
+     */
+    void open(const std::string& path, bool skipDamaged = false);
+    void close();
+    bool is_open() const { return this->file != nullptr; }
+    const std::string& path() const { return this->filePath; }
+    uint64_t damaged_size() const { return this->damagedSize; }
+
+    bool contains(const std::string& key) const;
+    std::vector<std::string> keys() const;
+    size_t size() const { return this->index.size(); }
+
+    /** Get latest annotation of given key, throw if key not exists */
+    InstanceStore get(const std::string& key) const;
+
+    /** Append annotation of given key */
+    void put(const std::string& key, const InstanceStore& instList);
+    void remove(const std::string& key);
+
+    /** Flush appended records to storage device */
+    void flush();
+
+    /** Rewrite file with latest records only */
+    void compact();
+    bool compact_if_needed(double garbageRatio = 0.5);
+    double garbage_ratio() const;
+
+    /** Conversion with per-image .mark files */
+    void import_mark(const std::string& key, const std::string& markPath);
+    void export_mark(const std::string& key,
+                     const std::string& markPath) const;
+
+    static void encode(std::string& buf, const InstanceStore& instList);
+    static InstanceStore decode(const char* data, size_t size);
+
+   protected:
+    struct Record
+    {
+        uint64_t offset;  // Payload offset
+        uint32_t size;    // Payload size
+    };
+
+    std::string filePath;
+    std::FILE* file = nullptr;
+    uint64_t fileSize = 0;
+    uint64_t liveSize = 0;     // Bytes occupied by latest records
+    uint64_t damagedSize = 0;  // Bytes of damaged records being skipped
+    bool skipDamaged = false;
+
+    std::unordered_map<std::string, Record> index;
+
+    // Memory mapped view of file content, remapped lazily after appending
+    mutable const char* mapData = nullptr;
+    mutable uint64_t mapSize = 0;
+
+    void scan();
+    void append(const std::string& key, const std::string& body);
+    void map_file() const;
+    void unmap_file() const;
+};
+
+}  // namespace ican_mark
+
+#endif
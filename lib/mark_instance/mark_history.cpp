@@ -0,0 +1,453 @@
+#include "mark_history.hpp"
+
+#include <stdexcept>
+
+using namespace std;
+
+namespace ican_mark
+{
+namespace
+{
+// Nodes created minus nodes released on this thread. Edits are priced by its
+// change during the edit only, so releasing of snapshots elsewhere is not
+// counted against them.
+thread_local ptrdiff_t nodeBalance = 0;
+
+size_t nodes_since(ptrdiff_t balance)
+{
+    return (nodeBalance > balance) ? (size_t)(nodeBalance - balance) : 0;
+}
+
+uint32_t random_priority()
+{
+    // SplitMix64
+    static thread_local uint64_t state = 0x2545F4914F6CDD1DULL;
+    uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return (uint32_t)(z ^ (z >> 31));
+}
+
+}  // namespace
+
+struct InstanceSeq::Node
+{
+    Instance inst;
+    uint32_t priority;
+    size_t size;
+    NodePtr left;
+    NodePtr right;
+
+    Node(const Instance& inst, uint32_t priority, const NodePtr& left,
+         const NodePtr& right)
+        : inst(inst),
+          priority(priority),
+          size(1 + size_of(left) + size_of(right)),
+          left(left),
+          right(right)
+    {
+        nodeBalance++;
+    }
+
+    ~Node()
+    {
+        nodeBalance--;
+    }
+};
+
+InstanceSeq::InstanceSeq(const InstanceStore& instList)
+{
+    // Build treap in linear time with rightmost path as a stack. Nodes are
+    // linked before publishing, and sizes are fixed up from bottom.
+    struct Builder
+    {
+        Instance inst;
+        uint32_t priority;
+        int left = -1;
+        int right = -1;
+    };
+
+    vector<Builder> nodes(instList.size());
+    vector<int> stack;
+    for (size_t i = 0; i < instList.size(); i++)
+    {
+        nodes[i].inst = instList[i];
+        nodes[i].priority = random_priority();
+
+        int last = -1;
+        while (!stack.empty() &&
+               nodes[stack.back()].priority < nodes[i].priority)
+        {
+            last = stack.back();
+            stack.pop_back();
+        }
+
+        nodes[i].left = last;
+        if (!stack.empty())
+        {
+            nodes[stack.back()].right = (int)i;
+        }
+
+        stack.push_back((int)i);
+    }
+
+    if (stack.empty())
+    {
+        return;
+    }
+
+    // Children are created before parents in post-order
+    vector<NodePtr> built(nodes.size());
+    vector<pair<int, bool>> order = {{stack.front(), false}};
+    while (!order.empty())
+    {
+        pair<int, bool> cur = order.back();
+        order.pop_back();
+
+        const Builder& node = nodes[cur.first];
+        if (cur.second)
+        {
+            built[cur.first] = make_node(
+                node.inst, node.priority,
+                (node.left >= 0) ? built[node.left] : nullptr,
+                (node.right >= 0) ? built[node.right] : nullptr);
+        }
+        else
+        {
+            order.push_back({cur.first, true});
+            if (node.left >= 0) order.push_back({node.left, false});
+            if (node.right >= 0) order.push_back({node.right, false});
+        }
+    }
+
+    this->root = built[stack.front()];
+}
+
+size_t InstanceSeq::size() const { return size_of(this->root); }
+
+Instance InstanceSeq::at(size_t index) const
+{
+    if (index >= this->size())
+    {
+        throw out_of_range("Instance index out of range");
+    }
+
+    const Node* node = this->root.get();
+    while (true)
+    {
+        size_t leftSize = size_of(node->left);
+        if (index < leftSize)
+        {
+            node = node->left.get();
+        }
+        else if (index == leftSize)
+        {
+            return node->inst;
+        }
+        else
+        {
+            index -= leftSize + 1;
+            node = node->right.get();
+        }
+    }
+}
+
+InstanceStore InstanceSeq::to_store() const
+{
+    InstanceStore ret;
+    ret.reserve(this->size());
+    collect(this->root, ret);
+    return ret;
+}
+
+size_t InstanceSeq::insert(size_t index, const Instance& inst)
+{
+    if (index > this->size())
+    {
+        throw out_of_range("Instance index out of range");
+    }
+
+    ptrdiff_t balance = nodeBalance;
+    NodePtr left, right;
+    split(this->root, index, left, right);
+    this->root = merge(
+        merge(left, make_node(inst, random_priority(), nullptr, nullptr)),
+        right);
+    return nodes_since(balance);
+}
+
+size_t InstanceSeq::erase(size_t index)
+{
+    if (index >= this->size())
+    {
+        throw out_of_range("Instance index out of range");
+    }
+
+    ptrdiff_t balance = nodeBalance;
+    NodePtr left, rest, mid, right;
+    split(this->root, index, left, rest);
+    split(rest, 1, mid, right);
+    this->root = merge(left, right);
+    return nodes_since(balance);
+}
+
+size_t InstanceSeq::set(size_t index, const Instance& inst)
+{
+    if (index >= this->size())
+    {
+        throw out_of_range("Instance index out of range");
+    }
+
+    ptrdiff_t balance = nodeBalance;
+    this->root = replace(this->root, index, inst);
+    return nodes_since(balance);
+}
+
+size_t InstanceSeq::node_size()
+{
+    // Including control block of shared pointer
+    return sizeof(Node) + 2 * sizeof(void*);
+}
+
+size_t InstanceSeq::size_of(const NodePtr& node)
+{
+    return node ? node->size : 0;
+}
+
+InstanceSeq::NodePtr InstanceSeq::make_node(const Instance& inst,
+                                            uint32_t priority,
+                                            const NodePtr& left,
+                                            const NodePtr& right)
+{
+    return make_shared<const Node>(inst, priority, left, right);
+}
+
+void InstanceSeq::split(const NodePtr& node, size_t index, NodePtr& left,
+                        NodePtr& right)
+{
+    // Left part gets first index elements
+    if (!node)
+    {
+        left = nullptr;
+        right = nullptr;
+        return;
+    }
+
+    size_t leftSize = size_of(node->left);
+    if (index <= leftSize)
+    {
+        NodePtr subRight;
+        split(node->left, index, left, subRight);
+        right = make_node(node->inst, node->priority, subRight, node->right);
+    }
+    else
+    {
+        NodePtr subLeft;
+        split(node->right, index - leftSize - 1, subLeft, right);
+        left = make_node(node->inst, node->priority, node->left, subLeft);
+    }
+}
+
+InstanceSeq::NodePtr InstanceSeq::merge(const NodePtr& left,
+                                        const NodePtr& right)
+{
+    if (!left) return right;
+    if (!right) return left;
+
+    if (left->priority > right->priority)
+    {
+        return make_node(left->inst, left->priority, left->left,
+                         merge(left->right, right));
+    }
+    else
+    {
+        return make_node(right->inst, right->priority,
+                         merge(left, right->left), right->right);
+    }
+}
+
+InstanceSeq::NodePtr InstanceSeq::replace(const NodePtr& node, size_t index,
+                                          const Instance& inst)
+{
+    size_t leftSize = size_of(node->left);
+    if (index < leftSize)
+    {
+        return make_node(node->inst, node->priority,
+                         replace(node->left, index, inst), node->right);
+    }
+    else if (index == leftSize)
+    {
+        return make_node(inst, node->priority, node->left, node->right);
+    }
+    else
+    {
+        return make_node(node->inst, node->priority, node->left,
+                         replace(node->right, index - leftSize - 1, inst));
+    }
+}
+
+void InstanceSeq::collect(const NodePtr& node, InstanceStore& instList)
+{
+    if (node)
+    {
+        collect(node->left, instList);
+        instList.push_back(node->inst);
+        collect(node->right, instList);
+    }
+}
+
+EditHistory::EditHistory(size_t maxSteps, size_t maxBytes)
+    : maxSteps(maxSteps), maxBytes(maxBytes)
+{
+}
+
+void EditHistory::reset(const InstanceStore& instList)
+{
+    this->clear();
+    this->state = InstanceSeq(instList);
+}
+
+void EditHistory::clear()
+{
+    this->stepList.clear();
+    this->state = InstanceSeq();
+    this->cursor = 0;
+    this->usedBytes = 0;
+}
+
+void EditHistory::insert(const vector<size_t>& indList,
+                         const InstanceStore& instList)
+{
+    InstanceSeq before = this->state;
+    size_t created = 0;
+
+    // Ascending insertion places each instance at its final index
+    for (size_t i = 0; i < indList.size(); i++)
+    {
+        created += this->state.insert(indList[i], instList[i]);
+    }
+
+    this->push(Step::INSERT, indList, before, created);
+}
+
+void EditHistory::remove(const vector<size_t>& indList)
+{
+    InstanceSeq before = this->state;
+    size_t created = 0;
+
+    for (auto i = indList.rbegin(); i != indList.rend(); i++)
+    {
+        created += this->state.erase(*i);
+    }
+
+    this->push(Step::REMOVE, indList, before, created);
+}
+
+void EditHistory::modify(const vector<size_t>& indList,
+                         const InstanceStore& instList)
+{
+    InstanceSeq before = this->state;
+    size_t created = 0;
+
+    for (size_t i = 0; i < indList.size(); i++)
+    {
+        created += this->state.set(indList[i], instList[i]);
+    }
+
+    this->push(Step::MODIFY, indList, before, created);
+}
+
+const EditHistory::Step* EditHistory::undo()
+{
+    if (!this->can_undo())
+    {
+        return nullptr;
+    }
+
+    const Step& step = this->stepList[--this->cursor];
+    this->state = step.before;
+    return &step;
+}
+
+const EditHistory::Step* EditHistory::redo()
+{
+    if (!this->can_redo())
+    {
+        return nullptr;
+    }
+
+    const Step& step = this->stepList[this->cursor++];
+    this->state = step.after;
+    return &step;
+}
+
+void EditHistory::set_limit(size_t maxSteps, size_t maxBytes)
+{
+    this->maxSteps = maxSteps;
+    this->maxBytes = maxBytes;
+    this->trim();
+}
+
+void EditHistory::push(Step::Type type, const vector<size_t>& indList,
+                       const InstanceSeq& before, size_t created)
+{
+    // Drop undone steps
+    while (this->stepList.size() > this->cursor)
+    {
+        this->usedBytes -= this->stepList.back().bytes;
+        this->stepList.pop_back();
+    }
+
+    Step step = {type, indList, before, this->state,
+                 created * InstanceSeq::node_size() +
+                     indList.size() * sizeof(size_t) + sizeof(Step)};
+
+    this->usedBytes += step.bytes;
+    this->stepList.push_back(std::move(step));
+    this->cursor = this->stepList.size();
+    this->trim();
+}
+
+void EditHistory::trim()
+{
+    // Drop oldest applied steps, nodes not shared with newer snapshots are
+    // released
+    while (this->cursor > 0 &&
+           (this->stepList.size() > this->maxSteps ||
+            this->usedBytes > this->maxBytes))
+    {
+        this->pop_oldest();
+    }
+}
+
+size_t EditHistory::release(size_t bytes, size_t keepSteps)
+{
+    // Undone steps are kept to redo
+    size_t used = this->usedBytes;
+    while (this->cursor > keepSteps && used - this->usedBytes < bytes)
+    {
+        this->pop_oldest();
+    }
+
+    return used - this->usedBytes;
+}
+
+size_t EditHistory::releasable_memory(size_t keepSteps) const
+{
+    size_t bytes = 0;
+    for (size_t i = 0; i + keepSteps < this->cursor; i++)
+    {
+        bytes += this->stepList[i].bytes;
+    }
+
+    return bytes;
+}
+
+void EditHistory::pop_oldest()
+{
+    this->usedBytes -= this->stepList.front().bytes;
+    this->stepList.pop_front();
+    this->cursor--;
+}
+
+}  // namespace ican_mark
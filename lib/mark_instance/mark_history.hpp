@@ -0,0 +1,135 @@
+#ifndef __MARK_HISTORY_HPP__
+#define __MARK_HISTORY_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <vector>
+
+#include "mark_instance.hpp"
+
+namespace ican_mark
+{
+/**
+ * Persistent sequence of instances.
+ *
+ * Implemented as an implicit treap with immutable nodes. Editing copies the
+ * O(log n) nodes on the path to the edited position and shares the rest, so
+ * copying a sequence is O(1) and old copies stay unchanged.
+ */
+class InstanceSeq
+{
+   public:
+    InstanceSeq() = default;
+    explicit InstanceSeq(const InstanceStore& instList);
+
+    size_t size() const;
+    bool empty() const { return this->root == nullptr; }
+
+    Instance at(size_t index) const;
+    InstanceStore to_store() const;
+
+    /** Editing with path copying, return number of nodes kept by edit */
+    size_t insert(size_t index, const Instance& inst);
+    size_t erase(size_t index);
+    size_t set(size_t index, const Instance& inst);
+
+    /** Memory of one node, edits are priced by nodes they keep */
+    static size_t node_size();
+
+   protected:
+    struct Node;
+    typedef std::shared_ptr<const Node> NodePtr;
+
+    NodePtr root;
+
+    static size_t size_of(const NodePtr& node);
+    static NodePtr make_node(const Instance& inst, uint32_t priority,
+                             const NodePtr& left, const NodePtr& right);
+    static void split(const NodePtr& node, size_t index, NodePtr& left,
+                      NodePtr& right);
+    static NodePtr merge(const NodePtr& left, const NodePtr& right);
+    static NodePtr replace(const NodePtr& node, size_t index,
+                           const Instance& inst);
+    static void collect(const NodePtr& node, InstanceStore& instList);
+};
+
+/**
+ * Undo and redo history of an instance list.
+ *
+ * Each step keeps sequence snapshots before and after the edit, which share
+ * unchanged nodes with each other, and the edited indices. Instances being
+ * restored by undo or redo are read from snapshots, so a step costs
+ * O(k log n) for k edited instances.
+ */
+class EditHistory
+{
+   public:
+    struct Step
+    {
+        enum Type
+        {
+            INSERT,  // Indices in list after insertion
+            REMOVE,  // Indices in list before removal
+            MODIFY
+        };
+
+        Type type;
+        std::vector<size_t> indList;  // Sorted
+        InstanceSeq before;
+        InstanceSeq after;
+        size_t bytes;  // Memory allocated by this step
+    };
+
+    explicit EditHistory(size_t maxSteps = 256, size_t maxBytes = 64 << 20);
+
+    /** Start new history of given list */
+    void reset(const InstanceStore& instList);
+    void clear();
+
+    /** Record edits, indices are sorted and unique */
+    void insert(const std::vector<size_t>& indList,
+                const InstanceStore& instList);
+    void remove(const std::vector<size_t>& indList);
+    void modify(const std::vector<size_t>& indList,
+                const InstanceStore& instList);
+
+    /** Move between steps, return step to be reverted or reapplied */
+    bool can_undo() const { return this->cursor > 0; }
+    bool can_redo() const { return this->cursor < this->stepList.size(); }
+    const Step* undo();
+    const Step* redo();
+
+    const InstanceSeq& current() const { return this->state; }
+
+    /** History limits and usage */
+    void set_limit(size_t maxSteps, size_t maxBytes);
+    size_t step_count() const { return this->stepList.size(); }
+    size_t memory_usage() const { return this->usedBytes; }
+
+    /**
+     * Drop oldest applied steps to free given bytes, keeping keepSteps newest
+     * ones, return freed bytes
+     */
+    size_t release(size_t bytes, size_t keepSteps = 0);
+    size_t releasable_memory(size_t keepSteps = 0) const;
+
+   protected:
+    size_t maxSteps;
+    size_t maxBytes;
+    size_t usedBytes = 0;
+
+    InstanceSeq state;
+    std::deque<Step> stepList;
+    size_t cursor = 0;  // Number of applied steps
+
+    void push(Step::Type type, const std::vector<size_t>& indList,
+              const InstanceSeq& before, size_t created);
+    void trim();
+    void pop_oldest();
+};
+
+}  // namespace ican_mark
+
+#endif
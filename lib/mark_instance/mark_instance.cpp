@@ -1,9 +1,33 @@
 #include "mark_instance.hpp"
 
+#include <cmath>
+
 using namespace std;
 
 namespace ican_mark
 {
+static const double degToRad = 3.14159265358979323846 / 180.0;
+
+bool Instance::operator==(const Instance& other) const
+{
+    if (this->mask != other.mask)
+    {
+        return false;
+    }
+
+#define __attr_equal(name, flag) \
+    if ((this->mask & flag) && this->name != other.name) return false
+
+    __attr_equal(label, ATTR_LABEL);
+    __attr_equal(degree, ATTR_DEGREE);
+    __attr_equal(x, ATTR_X);
+    __attr_equal(y, ATTR_Y);
+    __attr_equal(w, ATTR_W);
+    __attr_equal(h, ATTR_H);
+
+    return true;
+}
+
 Instance::operator string() const
 {
     YAML::Node node;
@@ -16,4 +40,311 @@ Instance::operator string() const
     return out.c_str();
 }
 
+InstanceStore::InstanceStore(const vector<Instance>& instList)
+{
+    this->reserve(instList.size());
+    for (const Instance& inst : instList)
+    {
+        this->push_back(inst);
+    }
+}
+
+InstanceStore::InstanceStore(initializer_list<Instance> instList)
+{
+    this->reserve(instList.size());
+    for (const Instance& inst : instList)
+    {
+        this->push_back(inst);
+    }
+}
+
+#define __store_columns_apply(func) \
+    func(labelCol);                 \
+    func(degreeCol);                \
+    func(xCol);                     \
+    func(yCol);                     \
+    func(wCol);                     \
+    func(hCol);                     \
+    func(maskCol)
+
+void InstanceStore::reserve(size_t size)
+{
+#define __col_reserve(col) this->col.reserve(size)
+    __store_columns_apply(__col_reserve);
+}
+
+void InstanceStore::clear()
+{
+#define __col_clear(col) this->col.clear()
+    __store_columns_apply(__col_clear);
+}
+
+Instance InstanceStore::operator[](size_t index) const
+{
+    Instance inst;
+    inst.label = this->labelCol[index];
+    inst.degree = this->degreeCol[index];
+    inst.x = this->xCol[index];
+    inst.y = this->yCol[index];
+    inst.w = this->wCol[index];
+    inst.h = this->hCol[index];
+    inst.mask = this->maskCol[index];
+    return inst;
+}
+
+Instance InstanceStore::at(size_t index) const
+{
+    if (index >= this->size())
+    {
+        throw out_of_range("Instance index out of range");
+    }
+
+    return (*this)[index];
+}
+
+void InstanceStore::set(size_t index, const Instance& inst)
+{
+    this->labelCol[index] = inst.label;
+    this->degreeCol[index] = inst.degree;
+    this->xCol[index] = inst.x;
+    this->yCol[index] = inst.y;
+    this->wCol[index] = inst.w;
+    this->hCol[index] = inst.h;
+    this->maskCol[index] = inst.mask;
+}
+
+void InstanceStore::push_back(const Instance& inst)
+{
+    this->labelCol.push_back(inst.label);
+    this->degreeCol.push_back(inst.degree);
+    this->xCol.push_back(inst.x);
+    this->yCol.push_back(inst.y);
+    this->wCol.push_back(inst.w);
+    this->hCol.push_back(inst.h);
+    this->maskCol.push_back(inst.mask);
+}
+
+void InstanceStore::append(const InstanceStore& other)
+{
+#define __col_append(col) \
+    this->col.insert(this->col.end(), other.col.begin(), other.col.end())
+    __store_columns_apply(__col_append);
+}
+
+void InstanceStore::insert(size_t index, const Instance& inst)
+{
+    this->labelCol.insert(this->labelCol.begin() + index, inst.label);
+    this->degreeCol.insert(this->degreeCol.begin() + index, inst.degree);
+    this->xCol.insert(this->xCol.begin() + index, inst.x);
+    this->yCol.insert(this->yCol.begin() + index, inst.y);
+    this->wCol.insert(this->wCol.begin() + index, inst.w);
+    this->hCol.insert(this->hCol.begin() + index, inst.h);
+    this->maskCol.insert(this->maskCol.begin() + index, inst.mask);
+}
+
+void InstanceStore::insert(const vector<size_t>& indList,
+                           const InstanceStore& instList)
+{
+    size_t oldSize = this->size();
+    size_t newSize = oldSize + indList.size();
+    if (indList.empty())
+    {
+        return;
+    }
+    else if (indList.back() >= newSize || instList.size() < indList.size())
+    {
+        throw out_of_range("Instance index out of range");
+    }
+
+#define __col_expand(col) this->col.resize(newSize)
+    __store_columns_apply(__col_expand);
+
+    // Move existing instances backward from the end, filling inserted slots
+    size_t src = oldSize;
+    size_t ins = indList.size();
+    for (size_t dst = newSize; dst-- > 0 && ins > 0;)
+    {
+        if (indList[ins - 1] == dst)
+        {
+            ins--;
+#define __col_fill(col) this->col[dst] = instList.col[ins]
+            __store_columns_apply(__col_fill);
+        }
+        else
+        {
+            src--;
+#define __col_shift(col) this->col[dst] = this->col[src]
+            __store_columns_apply(__col_shift);
+        }
+    }
+}
+
+void InstanceStore::erase(size_t index)
+{
+#define __col_erase(col) this->col.erase(this->col.begin() + index)
+    __store_columns_apply(__col_erase);
+}
+
+void InstanceStore::erase(const vector<size_t>& indList)
+{
+    // Mark erased slots, then compact every column in one pass
+    vector<bool> eraseFlag(this->size(), false);
+    for (size_t index : indList)
+    {
+        if (index < eraseFlag.size())
+        {
+            eraseFlag[index] = true;
+        }
+    }
+
+    size_t dst = 0;
+    for (size_t src = 0; src < eraseFlag.size(); src++)
+    {
+        if (!eraseFlag[src])
+        {
+            if (dst != src)
+            {
+#define __col_move(col) this->col[dst] = this->col[src]
+                __store_columns_apply(__col_move);
+            }
+
+            dst++;
+        }
+    }
+
+#define __col_shrink(col) this->col.resize(dst)
+    __store_columns_apply(__col_shrink);
+}
+
+vector<Instance> InstanceStore::to_vector() const
+{
+    vector<Instance> ret;
+    ret.reserve(this->size());
+    for (size_t i = 0; i < this->size(); i++)
+    {
+        ret.push_back((*this)[i]);
+    }
+
+    return ret;
+}
+
+InstanceStore InstanceStore::subset(const vector<size_t>& indList) const
+{
+    InstanceStore ret;
+    ret.reserve(indList.size());
+    for (size_t index : indList)
+    {
+#define __col_gather(col) ret.col.push_back(this->col.at(index))
+        __store_columns_apply(__col_gather);
+    }
+
+    return ret;
+}
+
+bool InstanceStore::operator==(const InstanceStore& other) const
+{
+    if (this->size() != other.size())
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < this->size(); i++)
+    {
+        if ((*this)[i] != other[i])
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void InstanceStore::translate(double dx, double dy)
+{
+    double* xPtr = this->xCol.data();
+    double* yPtr = this->yCol.data();
+    size_t size = this->size();
+    for (size_t i = 0; i < size; i++)
+    {
+        xPtr[i] += dx;
+        yPtr[i] += dy;
+    }
+}
+
+void InstanceStore::scale(double factor, double cx, double cy)
+{
+    double* xPtr = this->xCol.data();
+    double* yPtr = this->yCol.data();
+    double* wPtr = this->wCol.data();
+    double* hPtr = this->hCol.data();
+    size_t size = this->size();
+    for (size_t i = 0; i < size; i++)
+    {
+        xPtr[i] = cx + (xPtr[i] - cx) * factor;
+        yPtr[i] = cy + (yPtr[i] - cy) * factor;
+        wPtr[i] *= factor;
+        hPtr[i] *= factor;
+    }
+}
+
+void InstanceStore::rotate(double degree, double cx, double cy)
+{
+    // Counterclockwise on image coordinate, same as instance degree
+    double rad = degree * degToRad;
+    double cosVal = cos(rad);
+    double sinVal = sin(rad);
+
+    double* xPtr = this->xCol.data();
+    double* yPtr = this->yCol.data();
+    double* degPtr = this->degreeCol.data();
+    uint8_t* maskPtr = this->maskCol.data();
+    size_t size = this->size();
+    for (size_t i = 0; i < size; i++)
+    {
+        double dx = xPtr[i] - cx;
+        double dy = yPtr[i] - cy;
+        xPtr[i] = cx + dx * cosVal + dy * sinVal;
+        yPtr[i] = cy - dx * sinVal + dy * cosVal;
+
+        // Rotated instances always have degree
+        degPtr[i] = ((maskPtr[i] & Instance::ATTR_DEGREE) ? degPtr[i] : 0) +
+                    degree;
+        maskPtr[i] |= Instance::ATTR_DEGREE;
+    }
+}
+
+vector<size_t> InstanceStore::cull(double left, double top, double right,
+                                   double bottom) const
+{
+    const uint8_t boxMask = Instance::ATTR_X | Instance::ATTR_Y |
+                            Instance::ATTR_W | Instance::ATTR_H;
+
+    vector<size_t> ret;
+    size_t size = this->size();
+    for (size_t i = 0; i < size; i++)
+    {
+        if ((this->maskCol[i] & boxMask) != boxMask)
+        {
+            continue;
+        }
+
+        // Bounding size of rotated box
+        double rad = (this->maskCol[i] & Instance::ATTR_DEGREE)
+                         ? this->degreeCol[i] * degToRad
+                         : 0;
+        double absCos = fabs(cos(rad));
+        double absSin = fabs(sin(rad));
+        double halfW = (this->wCol[i] * absCos + this->hCol[i] * absSin) / 2;
+        double halfH = (this->wCol[i] * absSin + this->hCol[i] * absCos) / 2;
+
+        if (this->xCol[i] + halfW >= left && this->xCol[i] - halfW <= right &&
+            this->yCol[i] + halfH >= top && this->yCol[i] - halfH <= bottom)
+        {
+            ret.push_back(i);
+        }
+    }
+
+    return ret;
+}
+
 }  // namespace ican_mark
@@ -1,48 +1,209 @@
 #ifndef __MARK_INSTANCE_HPP__
 #define __MARK_INSTANCE_HPP__
 
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <iterator>
 #include <stdexcept>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include <yaml-cpp/yaml.h>
 
 namespace ican_mark
 {
+/** Single annotated instance with optional attributes */
 class Instance
 {
-#define INSTANCE_ATTR_IFACE_IMPL(type, name)                                   \
-   protected:                                                                  \
-    std::pair<bool, type> name;                                                \
-                                                                               \
+   public:
+    /** Presence flags of attributes */
+    enum Attr : uint8_t
+    {
+        ATTR_LABEL = 0x01,
+        ATTR_DEGREE = 0x02,
+        ATTR_X = 0x04,
+        ATTR_Y = 0x08,
+        ATTR_W = 0x10,
+        ATTR_H = 0x20
+    };
+
+#define INSTANCE_ATTR_IFACE_IMPL(type, name, flag)                             \
    public:                                                                     \
     type get_##name() const                                                    \
     {                                                                          \
-        if (!this->name.first)                                                 \
+        if (!(this->mask & flag))                                              \
         {                                                                      \
             throw std::runtime_error("Instance attribute " #name " not set!"); \
         }                                                                      \
                                                                                \
-        return this->name.second;                                              \
+        return this->name;                                                     \
     }                                                                          \
                                                                                \
     void set_##name(type arg)                                                  \
     {                                                                          \
-        this->name.first = true;                                               \
-        this->name.second = arg;                                               \
+        this->mask |= flag;                                                    \
+        this->name = arg;                                                      \
     }                                                                          \
                                                                                \
-    bool has_##name() const { return this->name.first; }                       \
-    void clear_##name() { this->name.first = false; }
+    bool has_##name() const { return (this->mask & flag) != 0; }               \
+    void clear_##name() { this->mask &= ~flag; }
+
+    INSTANCE_ATTR_IFACE_IMPL(int, label, ATTR_LABEL)
+    INSTANCE_ATTR_IFACE_IMPL(double, degree, ATTR_DEGREE)
+    INSTANCE_ATTR_IFACE_IMPL(double, x, ATTR_X)
+    INSTANCE_ATTR_IFACE_IMPL(double, y, ATTR_Y)
+    INSTANCE_ATTR_IFACE_IMPL(double, w, ATTR_W)
+    INSTANCE_ATTR_IFACE_IMPL(double, h, ATTR_H)
+
+    /** Presence flags of all attributes */
+    uint8_t attr_mask() const { return this->mask; }
 
-    INSTANCE_ATTR_IFACE_IMPL(int, label)
-    INSTANCE_ATTR_IFACE_IMPL(double, degree)
-    INSTANCE_ATTR_IFACE_IMPL(double, x)
-    INSTANCE_ATTR_IFACE_IMPL(double, y)
-    INSTANCE_ATTR_IFACE_IMPL(double, w)
-    INSTANCE_ATTR_IFACE_IMPL(double, h)
+    bool operator==(const Instance& other) const;
+    bool operator!=(const Instance& other) const { return !(*this == other); }
 
     operator std::string() const;
+
+   protected:
+    friend class InstanceStore;
+
+    // Packed fields, valid only if its presence flag is set
+    double degree = 0;
+    double x = 0;
+    double y = 0;
+    double w = 0;
+    double h = 0;
+    int label = 0;
+    uint8_t mask = 0;
+};
+
+/**
+ * Instance container with contiguous columns of attributes.
+ *
+ * Elements are accessed as Instance values, while bulk operations work on
+ * columns directly.
+ */
+class InstanceStore
+{
+   public:
+    /** Elements are returned by value, so it is an input iterator only */
+    class const_iterator
+    {
+       public:
+        typedef std::input_iterator_tag iterator_category;
+        typedef Instance value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const Instance* pointer;
+        typedef Instance reference;
+
+        const_iterator(const InstanceStore* store, size_t index)
+            : store(store), index(index)
+        {
+        }
+
+        Instance operator*() const { return (*this->store)[this->index]; }
+        const_iterator& operator++()
+        {
+            this->index++;
+            return *this;
+        }
+
+        const_iterator operator++(int)
+        {
+            const_iterator ret = *this;
+            this->index++;
+            return ret;
+        }
+
+        difference_type operator-(const const_iterator& other) const
+        {
+            return (difference_type)this->index - (difference_type)other.index;
+        }
+
+        bool operator==(const const_iterator& other) const
+        {
+            return this->index == other.index;
+        }
+
+        bool operator!=(const const_iterator& other) const
+        {
+            return this->index != other.index;
+        }
+
+       private:
+        const InstanceStore* store;
+        size_t index;
+    };
+
+    InstanceStore() = default;
+    InstanceStore(const std::vector<Instance>& instList);
+    InstanceStore(std::initializer_list<Instance> instList);
+
+    size_t size() const { return this->maskCol.size(); }
+    bool empty() const { return this->maskCol.empty(); }
+    void reserve(size_t size);
+    void clear();
+
+    Instance operator[](size_t index) const;
+    Instance at(size_t index) const;
+    void set(size_t index, const Instance& inst);
+
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, this->size()); }
+
+    void push_back(const Instance& inst);
+    void append(const InstanceStore& other);
+    void insert(size_t index, const Instance& inst);
+    void erase(size_t index);
+
+    /**
+     * Insert instances to given sorted indices of the resulting list with
+     * single expanding pass
+     */
+    void insert(const std::vector<size_t>& indList,
+                const InstanceStore& instList);
+
+    /** Erase instances of given indices with single compaction pass */
+    void erase(const std::vector<size_t>& indList);
+
+    std::vector<Instance> to_vector() const;
+
+    /** Instances of given indices */
+    InstanceStore subset(const std::vector<size_t>& indList) const;
+
+    bool operator==(const InstanceStore& other) const;
+    bool operator!=(const InstanceStore& other) const
+    {
+        return !(*this == other);
+    }
+
+    /** Column access */
+    const int* label_data() const { return this->labelCol.data(); }
+    const double* degree_data() const { return this->degreeCol.data(); }
+    const double* x_data() const { return this->xCol.data(); }
+    const double* y_data() const { return this->yCol.data(); }
+    const double* w_data() const { return this->wCol.data(); }
+    const double* h_data() const { return this->hCol.data(); }
+    const uint8_t* mask_data() const { return this->maskCol.data(); }
+
+    /** Bulk transforms on all instances */
+    void translate(double dx, double dy);
+    void scale(double factor, double cx = 0, double cy = 0);
+    void rotate(double degree, double cx = 0, double cy = 0);
+
+    /** Indices of boxes overlapping with given region */
+    std::vector<size_t> cull(double left, double top, double right,
+                             double bottom) const;
+
+   protected:
+    std::vector<int> labelCol;
+    std::vector<double> degreeCol;
+    std::vector<double> xCol;
+    std::vector<double> yCol;
+    std::vector<double> wCol;
+    std::vector<double> hCol;
+    std::vector<uint8_t> maskCol;
 };
 }  // namespace ican_mark
 
@@ -89,6 +250,38 @@ struct convert<ican_mark::Instance>
         return true;
     }
 };
+
+template <>
+struct convert<ican_mark::InstanceStore>
+{
+    static Node encode(const ican_mark::InstanceStore& rhs)
+    {
+        Node node(NodeType::Sequence);
+        for (size_t i = 0; i < rhs.size(); i++)
+        {
+            node.push_back(rhs[i]);
+        }
+
+        return node;
+    }
+
+    static bool decode(const Node& node, ican_mark::InstanceStore& rhs)
+    {
+        if (!node.IsSequence())
+        {
+            return false;
+        }
+
+        rhs.clear();
+        rhs.reserve(node.size());
+        for (const Node& instNode : node)
+        {
+            rhs.push_back(instNode.as<ican_mark::Instance>());
+        }
+
+        return true;
+    }
+};
 }  // namespace YAML
 
 #endif
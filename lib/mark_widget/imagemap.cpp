@@ -17,7 +17,19 @@ void ImageMap::reset(const QImage& image)
     // Call parent reset function
     ImageView::reset(image);
 
-    this->repaint();
+    this->request_frame();
+}
+
+void ImageMap::reset(const shared_ptr<ImageSource>& source)
+{
+    ImageView::reset(source);
+    this->request_frame();
+}
+
+void ImageMap::reset(const shared_ptr<ImageResource>& resource)
+{
+    ImageView::reset(resource);
+    this->request_frame();
 }
 
 void ImageMap::set_select_region(const QRectF& selectRegion)
@@ -28,7 +40,7 @@ void ImageMap::set_select_region(const QRectF& selectRegion)
             (this->selectRegion.center() != selectRegion.center());
 
         this->selectRegion = selectRegion;
-        this->repaint();
+        this->request_frame();
 
         if (selCtrChanged)
             emit this->selectCenterChanged(this->selectRegion.center());
@@ -40,6 +52,7 @@ bool ImageMap::event(QEvent* event)
     bool ret = false;
     bool selCtrChanged = false;
 
+    this->count_render_stats(event);
     QEvent::Type eventType = event->type();
 
     // Run FSM of clicking action
@@ -70,16 +83,16 @@ bool ImageMap::event(QEvent* event)
             do
             {
                 QPointF curPos =
-                    this->mapping_to_image(this->clickAction["move"]);
+                    this->mapping_to_image(this->clickAction[ClickKey::MOVE]);
 
                 // Limit selected center point position
                 if (curPos.x() < 0) curPos.setX(0);
-                if (curPos.x() > this->bgImage.width())
-                    curPos.setX(this->bgImage.width());
+                if (curPos.x() > this->imgSize.width())
+                    curPos.setX(this->imgSize.width());
 
                 if (curPos.y() < 0) curPos.setY(0);
-                if (curPos.y() > this->bgImage.height())
-                    curPos.setY(this->bgImage.height());
+                if (curPos.y() > this->imgSize.height())
+                    curPos.setY(this->imgSize.height());
 
                 // Update selected center point
                 QPointF selCenter = this->selectRegion.center();
@@ -98,7 +111,7 @@ bool ImageMap::event(QEvent* event)
 
     if (ret)
     {
-        this->repaint();
+        this->request_frame();
 
         // Raise signals
         if (selCtrChanged)
@@ -0,0 +1,206 @@
+#include "mark_widget.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <QTransform>
+
+using namespace std;
+
+ImagePyramid::ImagePyramid(int tileSize) : tileSize(tileSize) {}
+
+void ImagePyramid::reset(const QImage& image)
+{
+    this->clear();
+    this->srcKey = image.cacheKey();
+    this->srcSize = image.size();
+    if (image.isNull())
+    {
+        return;
+    }
+
+    // Build power-of-two levels until the whole level fits in a single tile,
+    // area averaging keeps thin details visible on coarse levels
+    this->levels.push_back(image);
+    while (max(this->levels.back().width(), this->levels.back().height()) >
+           this->tileSize)
+    {
+        const QImage& prev = this->levels.back();
+        QSize size((prev.width() + 1) / 2, (prev.height() + 1) / 2);
+        this->levels.push_back(ImageScaler::scaled(prev, size));
+    }
+}
+
+void ImagePyramid::reset(ImageTileCache* tileCache)
+{
+    this->clear();
+    if (!tileCache || !tileCache->source())
+    {
+        return;
+    }
+
+    // Same levels as images in memory, decoded by tiles on demand
+    this->tileCache = tileCache;
+    this->tileSize = tileCache->tile_size();
+    this->srcSize = tileCache->source()->size();
+    this->srcKey = (qint64)tileCache->source().get();
+    this->tileLevels = 1;
+    for (QSize size = this->srcSize;
+         max(size.width(), size.height()) > this->tileSize; this->tileLevels++)
+    {
+        size = QSize((size.width() + 1) / 2, (size.height() + 1) / 2);
+    }
+}
+
+void ImagePyramid::clear()
+{
+    this->srcKey = 0;
+    this->srcSize = QSize();
+    this->levels.clear();
+    this->tileCache = nullptr;
+    this->tileLevels = 0;
+}
+
+bool ImagePyramid::is_null() const { return this->level_count() == 0; }
+qint64 ImagePyramid::cache_key() const { return this->srcKey; }
+QSize ImagePyramid::size() const { return this->srcSize; }
+int ImagePyramid::tile_size() const { return this->tileSize; }
+
+int ImagePyramid::level_count() const
+{
+    return this->tileCache ? this->tileLevels : (int)this->levels.size();
+}
+
+int ImagePyramid::find_level(double scale) const
+{
+    // Pick the smallest level which is still not coarser than the view
+    int level = 0;
+    double factor = 1.0 / scale;
+    while (level + 1 < this->level_count() && factor >= 2.0)
+    {
+        factor /= 2.0;
+        level++;
+    }
+
+    return level;
+}
+
+const QImage& ImagePyramid::level_image(int level) const
+{
+    return this->levels[level];
+}
+
+qint64 ImagePyramid::memory_usage() const
+{
+    qint64 bytes = 0;
+    for (const QImage& level : this->levels)
+    {
+        bytes += (qint64)level.bytesPerLine() * level.height();
+    }
+
+    return bytes;
+}
+
+void ImagePyramid::draw(QPainter& painter, const QRectF& viewRect,
+                        const QPointF& viewCenter, double viewScale,
+                        const void* viewer) const
+{
+    for (const Patch& patch :
+         this->patches(viewRect, viewCenter, viewScale, viewer))
+    {
+        painter.drawImage(patch.target, patch.image, patch.source);
+    }
+}
+
+vector<ImagePyramid::Patch> ImagePyramid::patches(const QRectF& viewRect,
+                                                  const QPointF& viewCenter,
+                                                  double viewScale,
+                                                  const void* viewer) const
+{
+    vector<Patch> ret;
+    if (this->is_null() || viewScale <= 0)
+    {
+        return ret;
+    }
+
+    int level = this->find_level(viewScale);
+    QSize lvSize = ImageSource::level_size(this->srcSize, level);
+
+    // Mapping from level space to view space
+    double sx = viewScale * this->srcSize.width() / lvSize.width();
+    double sy = viewScale * this->srcSize.height() / lvSize.height();
+    QPointF origin = viewCenter - QPointF(this->srcSize.width(),
+                                          this->srcSize.height()) *
+                                      viewScale / 2.0;
+    QTransform lvToView(sx, 0, 0, sy, origin.x(), origin.y());
+
+    // Find level region intersecting with view region
+    QRectF lvRect((viewRect.left() - origin.x()) / sx,
+                  (viewRect.top() - origin.y()) / sy, viewRect.width() / sx,
+                  viewRect.height() / sy);
+    lvRect = lvRect.intersected(QRectF(QPointF(0, 0), lvSize));
+    if (lvRect.isEmpty())
+    {
+        return ret;
+    }
+
+    if (this->tileCache)
+    {
+        this->tile_patches(lvRect, level, lvToView, viewer, ret);
+    }
+    else
+    {
+        // Whole intersected region of level image in one patch
+        QRectF src = lvRect.toAlignedRect() & this->levels[level].rect();
+        ret.push_back({this->levels[level], src, lvToView.mapRect(src)});
+    }
+
+    return ret;
+}
+
+void ImagePyramid::tile_patches(const QRectF& lvRect, int level,
+                                const QTransform& lvToView,
+                                const void* viewer,
+                                vector<Patch>& patchList) const
+{
+    int colBeg = (int)floor(lvRect.left() / this->tileSize);
+    int colEnd = (int)ceil(lvRect.right() / this->tileSize);
+    int rowBeg = (int)floor(lvRect.top() / this->tileSize);
+    int rowEnd = (int)ceil(lvRect.bottom() / this->tileSize);
+
+    // Tiles out of view are not decoded any more
+    this->tileCache->begin_round(viewer);
+    for (int row = rowBeg; row < rowEnd; row++)
+    {
+        for (int col = colBeg; col < colEnd; col++)
+        {
+            QPointF pos(col * this->tileSize, row * this->tileSize);
+            QImage tile = this->tileCache->tile(level, col, row, viewer);
+            if (!tile.isNull())
+            {
+                patchList.push_back(
+                    {tile, QRectF(tile.rect()),
+                     lvToView.mapRect(QRectF(pos, QSizeF(tile.size())))});
+                continue;
+            }
+
+            // Upscale part of coarser tile until the wanted one is ready
+            for (int up = 1; level + up < this->tileLevels; up++)
+            {
+                QImage coarse =
+                    this->tileCache->tile(level + up, col >> up, row >> up);
+                if (coarse.isNull())
+                {
+                    continue;
+                }
+
+                double part = (double)this->tileSize / (1 << up);
+                QRectF src((col - ((col >> up) << up)) * part,
+                           (row - ((row >> up) << up)) * part, part, part);
+                QRectF dst(pos, QSizeF(this->tileSize, this->tileSize));
+                patchList.push_back({coarse, src, lvToView.mapRect(dst)});
+                break;
+            }
+        }
+    }
+}
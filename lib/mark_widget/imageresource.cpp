@@ -0,0 +1,42 @@
+#include "mark_widget.h"
+
+using namespace std;
+
+ImageResource::ImageResource(const QImage& image)
+    : MemoryBudget::Client(MemoryBudget::PinnedPriority), srcImage(image)
+{
+    this->imgPyramid.reset(image);
+
+    // Level 0 of pyramid shares data with source image
+    qint64 srcBytes = (qint64)image.bytesPerLine() * image.height();
+    this->account(MemoryBudget::SourcePixels, srcBytes);
+    this->account(MemoryBudget::ScaledPixels,
+                  this->imgPyramid.memory_usage() - srcBytes);
+}
+
+ImageResource::ImageResource(const shared_ptr<ImageSource>& source)
+    : MemoryBudget::Client(MemoryBudget::PinnedPriority),
+      tileCache(new ImageTileCache())
+{
+    this->tileCache->reset(source);
+    this->imgPyramid.reset(this->tileCache.get());
+}
+
+const QImage& ImageResource::image() const { return this->srcImage; }
+QSize ImageResource::size() const { return this->imgPyramid.size(); }
+
+const ImagePyramid& ImageResource::pyramid() const
+{
+    return this->imgPyramid;
+}
+
+ImageTileCache* ImageResource::tile_cache() const
+{
+    return this->tileCache.get();
+}
+
+qint64 ImageResource::memory_usage() const
+{
+    return this->imgPyramid.memory_usage() +
+           (this->tileCache ? this->tileCache->memory_usage() : 0);
+}
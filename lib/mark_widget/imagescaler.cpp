@@ -0,0 +1,393 @@
+#include "mark_widget.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define SCALER_X86
+#endif
+
+using namespace std;
+
+namespace
+{
+// Weights are fixed-point with weightBits fraction bits and sum to one on
+// each axis. Vertically averaged values keep midBits fraction bits.
+const int weightBits = 14;
+const int midBits = 8;
+const int midShift = weightBits - midBits;
+const int outShift = weightBits + midBits;
+
+// Source pixels covered by each target pixel along an axis
+struct Spans
+{
+    vector<int> first;
+    vector<int> offset;  // Weights of pixel x are in [offset[x], offset[x+1])
+    vector<int32_t> weight;
+
+    Spans(int srcLen, int dstLen)
+    {
+        // Target pixel x covers [x * srcLen, (x + 1) * srcLen) in units of
+        // 1 / dstLen source pixel. Weights are rounded on cumulative coverage
+        // so that they always sum to exactly one.
+        this->offset.push_back(0);
+        for (int x = 0; x < dstLen; x++)
+        {
+            int64_t beg = (int64_t)x * srcLen;
+            int64_t end = beg + srcLen;
+            int first = (int)(beg / dstLen);
+            int last = (int)((end - 1) / dstLen);
+
+            int64_t covered = 0;
+            int32_t prev = 0;
+            for (int i = first; i <= last; i++)
+            {
+                covered += min(end, (int64_t)(i + 1) * dstLen) -
+                           max(beg, (int64_t)i * dstLen);
+                int32_t cum = (int32_t)(
+                    (covered * (1 << weightBits) + srcLen / 2) / srcLen);
+                this->weight.push_back(cum - prev);
+                prev = cum;
+            }
+
+            this->first.push_back(first);
+            this->offset.push_back((int)this->weight.size());
+        }
+    }
+};
+
+struct Kernels
+{
+    // acc[i] += row[i] * weight
+    void (*accumulate)(const uchar* row, int32_t weight, uint32_t* acc,
+                       int count);
+
+    // mid[i] = round(acc[i] >> midShift)
+    void (*narrow)(const uint32_t* acc, uint16_t* mid, int count);
+
+    // Horizontal averaging of 4 channels pixels
+    void (*average4)(const uint16_t* mid, const Spans& spans, uchar* out);
+};
+
+void accumulate_scalar(const uchar* row, int32_t weight, uint32_t* acc,
+                       int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        acc[i] += row[i] * (uint32_t)weight;
+    }
+}
+
+void narrow_scalar(const uint32_t* acc, uint16_t* mid, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        mid[i] = (uint16_t)((acc[i] + (1 << (midShift - 1))) >> midShift);
+    }
+}
+
+void average4_scalar(const uint16_t* mid, const Spans& spans, uchar* out)
+{
+    for (size_t x = 0; x < spans.first.size(); x++)
+    {
+        uint32_t sum[4] = {0, 0, 0, 0};
+        const uint16_t* src = mid + spans.first[x] * 4;
+        for (int k = spans.offset[x]; k < spans.offset[x + 1]; k++, src += 4)
+        {
+            for (int c = 0; c < 4; c++)
+            {
+                sum[c] += src[c] * (uint32_t)spans.weight[k];
+            }
+        }
+
+        for (int c = 0; c < 4; c++)
+        {
+            out[x * 4 + c] = (uchar)((sum[c] + (1 << (outShift - 1))) >>
+                                     outShift);
+        }
+    }
+}
+
+// Grayscale has no lanes to fill within a pixel, shared by all paths
+void average1(const uint16_t* mid, const Spans& spans, uchar* out)
+{
+    for (size_t x = 0; x < spans.first.size(); x++)
+    {
+        uint32_t sum = 0;
+        const uint16_t* src = mid + spans.first[x];
+        for (int k = spans.offset[x]; k < spans.offset[x + 1]; k++)
+        {
+            sum += *src++ * (uint32_t)spans.weight[k];
+        }
+
+        out[x] = (uchar)((sum + (1 << (outShift - 1))) >> outShift);
+    }
+}
+
+#ifdef SCALER_X86
+__attribute__((target("sse4.1"))) void accumulate_sse41(const uchar* row,
+                                                        int32_t weight,
+                                                        uint32_t* acc,
+                                                        int count)
+{
+    __m128i w = _mm_set1_epi32(weight);
+    int i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(row + i));
+        for (int part = 0; part < 4; part++)
+        {
+            __m128i* dst = (__m128i*)(acc + i + part * 4);
+            __m128i prod = _mm_mullo_epi32(_mm_cvtepu8_epi32(v), w);
+            _mm_storeu_si128(dst, _mm_add_epi32(_mm_loadu_si128(dst), prod));
+            v = _mm_srli_si128(v, 4);
+        }
+    }
+
+    accumulate_scalar(row + i, weight, acc + i, count - i);
+}
+
+__attribute__((target("sse4.1"))) void narrow_sse41(const uint32_t* acc,
+                                                    uint16_t* mid, int count)
+{
+    __m128i round = _mm_set1_epi32(1 << (midShift - 1));
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i lo = _mm_loadu_si128((const __m128i*)(acc + i));
+        __m128i hi = _mm_loadu_si128((const __m128i*)(acc + i + 4));
+        lo = _mm_srli_epi32(_mm_add_epi32(lo, round), midShift);
+        hi = _mm_srli_epi32(_mm_add_epi32(hi, round), midShift);
+        _mm_storeu_si128((__m128i*)(mid + i), _mm_packus_epi32(lo, hi));
+    }
+
+    narrow_scalar(acc + i, mid + i, count - i);
+}
+
+__attribute__((target("sse4.1"))) void average4_sse41(const uint16_t* mid,
+                                                      const Spans& spans,
+                                                      uchar* out)
+{
+    // Channels of a pixel are the four lanes
+    __m128i round = _mm_set1_epi32(1 << (outShift - 1));
+    for (size_t x = 0; x < spans.first.size(); x++)
+    {
+        __m128i sum = _mm_setzero_si128();
+        const uint16_t* src = mid + spans.first[x] * 4;
+        for (int k = spans.offset[x]; k < spans.offset[x + 1]; k++, src += 4)
+        {
+            __m128i v =
+                _mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i*)src));
+            sum = _mm_add_epi32(
+                sum, _mm_mullo_epi32(v, _mm_set1_epi32(spans.weight[k])));
+        }
+
+        sum = _mm_srli_epi32(_mm_add_epi32(sum, round), outShift);
+        sum = _mm_packus_epi16(_mm_packus_epi32(sum, sum), sum);
+        int32_t pixel = _mm_cvtsi128_si32(sum);
+        memcpy(out + x * 4, &pixel, 4);
+    }
+}
+
+__attribute__((target("avx2"))) void accumulate_avx2(const uchar* row,
+                                                     int32_t weight,
+                                                     uint32_t* acc, int count)
+{
+    __m256i w = _mm256_set1_epi32(weight);
+    int i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(row + i));
+        __m256i lo = _mm256_mullo_epi32(_mm256_cvtepu8_epi32(v), w);
+        __m256i hi = _mm256_mullo_epi32(
+            _mm256_cvtepu8_epi32(_mm_srli_si128(v, 8)), w);
+
+        __m256i* dst = (__m256i*)(acc + i);
+        _mm256_storeu_si256(dst, _mm256_add_epi32(_mm256_loadu_si256(dst), lo));
+        _mm256_storeu_si256(dst + 1,
+                            _mm256_add_epi32(_mm256_loadu_si256(dst + 1), hi));
+    }
+
+    accumulate_scalar(row + i, weight, acc + i, count - i);
+}
+
+__attribute__((target("avx2"))) void narrow_avx2(const uint32_t* acc,
+                                                 uint16_t* mid, int count)
+{
+    __m256i round = _mm256_set1_epi32(1 << (midShift - 1));
+    int i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        __m256i lo = _mm256_loadu_si256((const __m256i*)(acc + i));
+        __m256i hi = _mm256_loadu_si256((const __m256i*)(acc + i + 8));
+        lo = _mm256_srli_epi32(_mm256_add_epi32(lo, round), midShift);
+        hi = _mm256_srli_epi32(_mm256_add_epi32(hi, round), midShift);
+
+        // Packing works within 128-bit lanes, restore order of quarters
+        __m256i packed = _mm256_permute4x64_epi64(
+            _mm256_packus_epi32(lo, hi), 0xD8);
+        _mm256_storeu_si256((__m256i*)(mid + i), packed);
+    }
+
+    narrow_scalar(acc + i, mid + i, count - i);
+}
+#endif
+
+Kernels kernels_of(ImageScaler::Isa isa)
+{
+    switch (isa)
+    {
+#ifdef SCALER_X86
+        case ImageScaler::AVX2:
+            return {accumulate_avx2, narrow_avx2, average4_sse41};
+        case ImageScaler::SSE41:
+            return {accumulate_sse41, narrow_sse41, average4_sse41};
+#endif
+        default:
+            return {accumulate_scalar, narrow_scalar, average4_scalar};
+    }
+}
+
+// Average target rows [rowBeg, rowEnd), vertically then horizontally
+void scale_band(const QImage& src, uchar* dstBits, int dstStride,
+                const Spans& xSpans, const Spans& ySpans, int channels,
+                const Kernels& kernels, int rowBeg, int rowEnd)
+{
+    int count = src.width() * channels;
+    vector<uint32_t> acc(count);
+    vector<uint16_t> mid(count);
+    for (int y = rowBeg; y < rowEnd; y++)
+    {
+        fill(acc.begin(), acc.end(), 0);
+        int srcRow = ySpans.first[y];
+        for (int k = ySpans.offset[y]; k < ySpans.offset[y + 1]; k++)
+        {
+            kernels.accumulate(src.constScanLine(srcRow++), ySpans.weight[k],
+                               acc.data(), count);
+        }
+
+        uchar* out = dstBits + (qint64)dstStride * y;
+        kernels.narrow(acc.data(), mid.data(), count);
+        if (channels == 4)
+        {
+            kernels.average4(mid.data(), xSpans, out);
+        }
+        else
+        {
+            average1(mid.data(), xSpans, out);
+        }
+    }
+}
+
+}  // namespace
+
+QImage ImageScaler::scaled(const QImage& image, const QSize& size,
+                           int threads, Isa isa)
+{
+    if (image.isNull() || size.isEmpty())
+    {
+        return QImage();
+    }
+
+    if (size == image.size())
+    {
+        return image;
+    }
+
+    if (size.width() > image.width() || size.height() > image.height())
+    {
+        return image.scaled(size, Qt::IgnoreAspectRatio,
+                            Qt::SmoothTransformation);
+    }
+
+    // Pixels are averaged premultiplied, so that transparent ones do not
+    // bleed their colors
+    QImage src = image;
+    int channels = 4;
+    switch (image.format())
+    {
+        case QImage::Format_Grayscale8:
+            channels = 1;
+            break;
+        case QImage::Format_RGB32:
+        case QImage::Format_ARGB32_Premultiplied:
+        case QImage::Format_RGBX8888:
+        case QImage::Format_RGBA8888_Premultiplied:
+            break;
+        default:
+            src = image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+    }
+
+    QImage dst(size, src.format());
+    if (dst.isNull())
+    {
+        return dst;
+    }
+
+    Spans xSpans(src.width(), size.width());
+    Spans ySpans(src.height(), size.height());
+    Kernels kernels = kernels_of(
+        (isa == Auto) ? ImageScaler::best_isa() : min(isa, best_isa()));
+
+    // Bands of at least a few megabytes of source keep threads worthwhile
+    if (threads <= 0)
+    {
+        threads = max(1, (int)thread::hardware_concurrency());
+    }
+
+    qint64 srcBytes = (qint64)src.bytesPerLine() * src.height();
+    threads = (int)min<qint64>(
+        {(qint64)threads, (qint64)size.height(), srcBytes / (4 << 20) + 1});
+
+    // Target is detached once here, rows are written by bands in place
+    uchar* dstBits = dst.bits();
+    int dstStride = dst.bytesPerLine();
+
+    vector<thread> workers;
+    int rowBeg = 0;
+    for (int i = 0; i < threads; i++)
+    {
+        int rowEnd = (int)((qint64)size.height() * (i + 1) / threads);
+        if (i + 1 < threads)
+        {
+            workers.emplace_back(scale_band, cref(src), dstBits, dstStride,
+                                 cref(xSpans), cref(ySpans), channels,
+                                 cref(kernels), rowBeg, rowEnd);
+        }
+        else
+        {
+            scale_band(src, dstBits, dstStride, xSpans, ySpans, channels,
+                       kernels, rowBeg, rowEnd);
+        }
+
+        rowBeg = rowEnd;
+    }
+
+    for (thread& worker : workers)
+    {
+        worker.join();
+    }
+
+    return dst;
+}
+
+ImageScaler::Isa ImageScaler::best_isa()
+{
+#ifdef SCALER_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return AVX2;
+    }
+
+    if (__builtin_cpu_supports("sse4.1"))
+    {
+        return SSE41;
+    }
+#endif
+
+    return Scalar;
+}
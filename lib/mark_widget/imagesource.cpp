@@ -0,0 +1,633 @@
+#include "mark_widget.h"
+
+#include <algorithm>
+#include <cstdint>
+
+#include <QFile>
+#include <QImageIOHandler>
+#include <QImageReader>
+#include <QMetaObject>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QThread>
+
+#ifdef WITH_TIFF
+#include <tiffio.h>
+#endif
+
+using namespace std;
+
+namespace
+{
+const int overviewSize = 4096;  // Longest side of overview of reader source
+
+QRect map_rect(const QRect& rect, const QSize& from, const QSize& to)
+{
+    double sx = (double)to.width() / from.width();
+    double sy = (double)to.height() / from.height();
+    return QRectF(rect.x() * sx, rect.y() * sy, rect.width() * sx,
+                  rect.height() * sy)
+               .toAlignedRect() &
+           QRect(QPoint(0, 0), to);
+}
+
+// Decode region through image plugins supporting clip rect, like JPEG.
+// Sequential formats are decoded from start for every region, so coarse
+// levels, whose tiles clip most of the image, are cut from an overview
+// decoded once instead.
+class ReaderImageSource : public ImageSource
+{
+   public:
+    static shared_ptr<ImageSource> open(const QString& path)
+    {
+        QImageReader reader(path);
+        QSize size = reader.size();
+        if (!size.isValid() ||
+            !reader.supportsOption(QImageIOHandler::ClipRect) ||
+            !reader.supportsOption(QImageIOHandler::ScaledSize))
+        {
+            return nullptr;
+        }
+
+        return shared_ptr<ImageSource>(new ReaderImageSource(path, size));
+    }
+
+    QSize size() const override { return this->srcSize; }
+
+    QImage read(int level, const QRect& rect) const override
+    {
+        QSize lvSize = ImageSource::level_size(this->srcSize, level);
+        if (level >= this->ovLevel)
+        {
+            QImage overview = this->overview();
+            if (overview.isNull() || level == this->ovLevel)
+            {
+                return overview.copy(rect);
+            }
+
+            QRect src = map_rect(rect, lvSize, overview.size());
+            return ImageScaler::scaled(overview.copy(src), rect.size(), 1);
+        }
+
+        // Clip rect is on source space, and scaled to rect size after that
+        QImageReader reader(this->path);
+        reader.setClipRect(map_rect(rect, lvSize, this->srcSize));
+        reader.setScaledSize(rect.size());
+        return reader.read();
+    }
+
+   private:
+    QString path;
+    QSize srcSize;
+    int ovLevel = 0;  // Levels from it are served by overview
+
+    mutable QMutex ovMutex;
+    mutable QImage ovImage;  // Guarded by ovMutex
+
+    ReaderImageSource(const QString& path, const QSize& size)
+        : path(path), srcSize(size)
+    {
+        QSize lvSize = size;
+        while (max(lvSize.width(), lvSize.height()) > overviewSize)
+        {
+            lvSize = QSize((lvSize.width() + 1) / 2, (lvSize.height() + 1) / 2);
+            this->ovLevel++;
+        }
+    }
+
+    QImage overview() const
+    {
+        // Tiles of other threads wait for the single decoding
+        QMutexLocker locker(&this->ovMutex);
+        if (this->ovImage.isNull())
+        {
+            QImageReader reader(this->path);
+            reader.setScaledSize(
+                ImageSource::level_size(this->srcSize, this->ovLevel));
+            this->ovImage = reader.read();
+        }
+
+        return this->ovImage;
+    }
+};
+
+#ifdef WITH_TIFF
+// Decode tiles or strips of TIFF and BigTIFF, with reduced resolution
+// directories used for coarse levels
+class TiffImageSource : public ImageSource
+{
+   public:
+    ~TiffImageSource()
+    {
+        for (const Handle& handle : this->handles)
+        {
+            TIFFClose(handle.tif);
+        }
+    }
+
+    static shared_ptr<ImageSource> open(const QString& path)
+    {
+        // Unknown tags of GeoTIFF are common
+        TIFFSetWarningHandler(nullptr);
+
+        QByteArray name = QFile::encodeName(path);
+        TIFF* tif = TIFFOpen(name.constData(), "r");
+        if (!tif)
+        {
+            return nullptr;
+        }
+
+        shared_ptr<TiffImageSource> src(new TiffImageSource(name));
+        do
+        {
+            uint32_t fileType = 0;
+            TIFFGetField(tif, TIFFTAG_SUBFILETYPE, &fileType);
+
+            Directory dir;
+            dir.index = TIFFCurrentDirectory(tif);
+            if (src->dirList.empty() ||
+                ((fileType & FILETYPE_REDUCEDIMAGE) &&
+                 !(fileType & FILETYPE_MASK)))
+            {
+                if (read_directory(tif, dir))
+                {
+                    src->dirList.push_back(dir);
+                }
+                else if (src->dirList.empty())
+                {
+                    break;
+                }
+            }
+        } while (TIFFReadDirectory(tif));
+
+        if (src->dirList.empty())
+        {
+            TIFFClose(tif);
+            return nullptr;
+        }
+
+        // Larger directories first
+        sort(src->dirList.begin() + 1, src->dirList.end(),
+             [](const Directory& lhs, const Directory& rhs)
+             { return lhs.size.width() > rhs.size.width(); });
+
+        src->release(tif, TIFFCurrentDirectory(tif));
+        return src;
+    }
+
+    QSize size() const override { return this->dirList[0].size; }
+
+    QImage read(int level, const QRect& rect) const override
+    {
+        // Pick the smallest directory not coarser than level
+        QSize lvSize = ImageSource::level_size(this->size(), level);
+        const Directory* dir = &this->dirList[0];
+        for (const Directory& cand : this->dirList)
+        {
+            if (cand.size.width() >= lvSize.width() &&
+                cand.size.height() >= lvSize.height())
+            {
+                dir = &cand;
+            }
+        }
+
+        // Region on directory space
+        double sx = (double)dir->size.width() / lvSize.width();
+        double sy = (double)dir->size.height() / lvSize.height();
+        QRect region = QRectF(rect.x() * sx, rect.y() * sy, rect.width() * sx,
+                              rect.height() * sy)
+                           .toAlignedRect() &
+                       QRect(QPoint(0, 0), dir->size);
+
+        QImage out(rect.size(), QImage::Format_ARGB32_Premultiplied);
+        out.fill(Qt::transparent);
+
+        TIFF* tif = this->acquire(dir->index);
+        if (!tif)
+        {
+            return QImage();
+        }
+
+        // Blocks are decoded one by one and scaled into output
+        QPainter painter(&out);
+        painter.setRenderHint(QPainter::SmoothPixmapTransform);
+
+        int bw = dir->block.width();
+        int bh = dir->block.height();
+        vector<uint32_t> raster((size_t)bw * bh);
+        for (int y = region.top() / bh * bh; y <= region.bottom(); y += bh)
+        {
+            for (int x = region.left() / bw * bw; x <= region.right();
+                 x += bw)
+            {
+                QRect block = QRect(x, y, bw, bh) & QRect(QPoint(0, 0),
+                                                          dir->size);
+                QImage img = this->read_block(tif, *dir, block, raster);
+                if (img.isNull())
+                {
+                    continue;
+                }
+
+                QRectF target((block.x() / sx) - rect.x(),
+                              (block.y() / sy) - rect.y(),
+                              block.width() / sx, block.height() / sy);
+                if (sx > 1 || sy > 1)
+                {
+                    // Area averaging avoids aliasing, on the decoding
+                    // thread only since tiles are decoded in parallel
+                    img = ImageScaler::scaled(
+                        img, target.size().toSize().expandedTo(QSize(1, 1)),
+                        1);
+                }
+
+                painter.drawImage(target, img);
+            }
+        }
+
+        painter.end();
+        this->release(tif, dir->index);
+        return out;
+    }
+
+   private:
+    struct Directory
+    {
+        uint32_t index;
+        QSize size;
+        QSize block;  // Tile size, or image width and rows of strips
+        bool tiled;
+    };
+
+    QByteArray name;
+    vector<Directory> dirList;  // Full resolution one first
+
+    struct Handle
+    {
+        TIFF* tif;
+        uint32_t index;  // Current directory
+    };
+
+    mutable QMutex mutex;
+    mutable vector<Handle> handles;  // Idle handles, one for each thread
+
+    explicit TiffImageSource(const QByteArray& name) : name(name) {}
+
+    static bool read_directory(TIFF* tif, Directory& dir)
+    {
+        uint32_t width = 0, height = 0;
+        TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &width);
+        TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &height);
+
+        uint32_t bw = width, bh = height;
+        dir.tiled = TIFFIsTiled(tif);
+        if (dir.tiled)
+        {
+            TIFFGetField(tif, TIFFTAG_TILEWIDTH, &bw);
+            TIFFGetField(tif, TIFFTAG_TILELENGTH, &bh);
+        }
+        else
+        {
+            TIFFGetFieldDefaulted(tif, TIFFTAG_ROWSPERSTRIP, &bh);
+            bh = min(bh, height);
+        }
+
+        // Huge blocks, like single strip images, are not worth it
+        const uint64_t maxBlockBytes = 64 << 20;
+        dir.size = QSize(width, height);
+        dir.block = QSize(bw, bh);
+        return width > 0 && height > 0 && bw > 0 && bh > 0 &&
+               (uint64_t)bw * bh * 4 <= maxBlockBytes;
+    }
+
+    QImage read_block(TIFF* tif, const Directory& dir, const QRect& block,
+                      vector<uint32_t>& raster) const
+    {
+        // Rasters are bottom-up, with partial tiles padded to full ones
+        QSize size = dir.block;
+        int ret = 0;
+        if (dir.tiled)
+        {
+            ret = TIFFReadRGBATile(tif, block.x(), block.y(), raster.data());
+        }
+        else
+        {
+            size.setHeight(block.height());
+            ret = TIFFReadRGBAStrip(tif, block.y(), raster.data());
+        }
+
+        if (!ret)
+        {
+            return QImage();
+        }
+
+        QImage img((const uchar*)raster.data(), size.width(), size.height(),
+                   size.width() * 4, QImage::Format_RGBA8888_Premultiplied);
+        return img.mirrored(false, true).copy(QRect(QPoint(0, 0),
+                                                    block.size()));
+    }
+
+    TIFF* acquire(uint32_t index) const
+    {
+        // Prefer handle on the same directory, which saves reloading of
+        // block offsets
+        QMutexLocker locker(&this->mutex);
+        auto it = find_if(this->handles.begin(), this->handles.end(),
+                          [&](const Handle& handle)
+                          { return handle.index == index; });
+        if (it == this->handles.end() && !this->handles.empty())
+        {
+            it = this->handles.end() - 1;
+        }
+
+        TIFF* tif = nullptr;
+        if (it != this->handles.end())
+        {
+            tif = it->tif;
+            this->handles.erase(it);
+        }
+
+        locker.unlock();
+
+        if (!tif)
+        {
+            tif = TIFFOpen(this->name.constData(), "r");
+        }
+
+        if (tif && TIFFCurrentDirectory(tif) != index &&
+            !TIFFSetDirectory(tif, (tdir_t)index))
+        {
+            TIFFClose(tif);
+            return nullptr;
+        }
+
+        return tif;
+    }
+
+    void release(TIFF* tif, uint32_t index) const
+    {
+        QMutexLocker locker(&this->mutex);
+        this->handles.push_back({tif, index});
+    }
+};
+
+bool is_tiff(const QString& path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        return false;
+    }
+
+    // Classic TIFF and BigTIFF in both byte orders
+    QByteArray magic = file.read(4);
+    return magic == QByteArray("II*\0", 4) || magic == QByteArray("MM\0*", 4) ||
+           magic == QByteArray("II+\0", 4) || magic == QByteArray("MM\0+", 4);
+}
+#endif
+
+}  // namespace
+
+shared_ptr<ImageSource> ImageSource::open(const QString& path)
+{
+#ifdef WITH_TIFF
+    if (is_tiff(path))
+    {
+        return TiffImageSource::open(path);
+    }
+#endif
+
+    return ReaderImageSource::open(path);
+}
+
+QSize ImageSource::level_size(const QSize& size, int level)
+{
+    QSize ret = size;
+    for (int i = 0; i < level; i++)
+    {
+        ret = QSize((ret.width() + 1) / 2, (ret.height() + 1) / 2);
+    }
+
+    return ret;
+}
+
+class ImageTileCache::Job : public QRunnable
+{
+   public:
+    Job(ImageTileCache* owner, int generation, quint64 key, int level,
+        const QRect& rect)
+        : owner(owner),
+          src(owner->src),
+          generation(generation),
+          key(key),
+          level(level),
+          rect(rect)
+    {
+    }
+
+    void run() override
+    {
+        // Skip requests dropped after queued, or queued again and started
+        QMutexLocker locker(&this->owner->mutex);
+        auto it = this->owner->pending.find(this->key);
+        if (this->generation != this->owner->generation ||
+            it == this->owner->pending.end() || it.value().started)
+        {
+            return;
+        }
+
+        it.value().started = true;
+        locker.unlock();
+
+        QImage tile = this->src->read(this->level, this->rect);
+
+        // Hand over result to owner thread
+        locker.relock();
+        this->owner->finList.push_back({this->key, this->generation, tile});
+        locker.unlock();
+
+        QMetaObject::invokeMethod(this->owner, "collect_finished",
+                                  Qt::QueuedConnection);
+    }
+
+   private:
+    ImageTileCache* owner;
+    shared_ptr<ImageSource> src;
+    int generation;
+    quint64 key;
+    int level;
+    QRect rect;
+};
+
+ImageTileCache::ImageTileCache(int tileSize, qint64 maxBytes, QObject* parent)
+    : QObject(parent),
+      MemoryBudget::Client(MemoryBudget::TilePriority),
+      tileSize(tileSize)
+{
+    this->pool.setMaxThreadCount(max(2, QThread::idealThreadCount()));
+    this->cache.setMaxCost((int)(maxBytes >> 10));
+}
+
+ImageTileCache::~ImageTileCache()
+{
+    this->clear();
+    this->pool.waitForDone();
+}
+
+void ImageTileCache::reset(const shared_ptr<ImageSource>& source)
+{
+    this->pool.clear();
+
+    QMutexLocker locker(&this->mutex);
+    this->generation++;
+    this->pending.clear();
+    this->finList.clear();
+    locker.unlock();
+
+    this->src = source;
+    this->cache.clear();
+    this->failed.clear();
+    this->account(MemoryBudget::ScaledPixels, 0);
+}
+
+void ImageTileCache::clear() { this->reset(nullptr); }
+
+const shared_ptr<ImageSource>& ImageTileCache::source() const
+{
+    return this->src;
+}
+
+int ImageTileCache::tile_size() const { return this->tileSize; }
+
+qint64 ImageTileCache::memory_usage() const
+{
+    return (qint64)this->cache.totalCost() << 10;
+}
+
+void ImageTileCache::begin_round(const void* viewer)
+{
+    // Requests started or still wanted by other viewers are kept, jobs of
+    // dropped ones return once dequeued
+    QMutexLocker locker(&this->mutex);
+    for (auto it = this->pending.begin(); it != this->pending.end();)
+    {
+        Request& req = it.value();
+        if (!req.started)
+        {
+            req.viewers.removeAll(viewer);
+        }
+
+        if (req.started || !req.viewers.isEmpty())
+        {
+            it++;
+        }
+        else
+        {
+            it = this->pending.erase(it);
+        }
+    }
+}
+
+QImage ImageTileCache::tile(int level, int col, int row, const void* viewer)
+{
+    quint64 key = tile_key(level, col, row);
+    QImage* tile = this->cache.object(key);
+    if (tile)
+    {
+        return *tile;
+    }
+
+    if (!viewer || !this->src || this->failed.contains(key))
+    {
+        return QImage();
+    }
+
+    QSize lvSize = ImageSource::level_size(this->src->size(), level);
+    QRect rect = QRect(col * this->tileSize, row * this->tileSize,
+                       this->tileSize, this->tileSize) &
+                 QRect(QPoint(0, 0), lvSize);
+    if (rect.isEmpty())
+    {
+        return QImage();
+    }
+
+    QMutexLocker locker(&this->mutex);
+    auto it = this->pending.find(key);
+    if (it == this->pending.end())
+    {
+        this->pending.insert(key, {false, {viewer}});
+        this->pool.start(new Job(this, this->generation, key, level, rect));
+    }
+    else if (!it.value().viewers.contains(viewer))
+    {
+        it.value().viewers.push_back(viewer);
+    }
+
+    return QImage();
+}
+
+qint64 ImageTileCache::release_memory(qint64 bytes)
+{
+    // Lowering capacity evicts tiles until the rest fits
+    qint64 used = this->memory_usage();
+    int maxCost = this->cache.maxCost();
+    this->cache.setMaxCost((int)(max<qint64>(used - bytes, 0) >> 10));
+    this->cache.setMaxCost(maxCost);
+
+    this->account(MemoryBudget::ScaledPixels, this->memory_usage());
+    return used - this->memory_usage();
+}
+
+qint64 ImageTileCache::releasable_memory() const
+{
+    return this->memory_usage();
+}
+
+void ImageTileCache::collect_finished()
+{
+    vector<Finished> finished;
+    QMutexLocker locker(&this->mutex);
+    finished.swap(this->finList);
+    for (auto it = finished.begin(); it != finished.end();)
+    {
+        // Results of previous source are dropped
+        if (it->generation == this->generation)
+        {
+            this->pending.remove(it->key);
+            it++;
+        }
+        else
+        {
+            it = finished.erase(it);
+        }
+    }
+
+    locker.unlock();
+
+    bool ready = false;
+    for (const Finished& fin : finished)
+    {
+        if (fin.tile.isNull())
+        {
+            // Corrupted regions would be decoded again on every repaint
+            this->failed.insert(fin.key);
+        }
+        else
+        {
+            int cost = fin.tile.bytesPerLine() * fin.tile.height() >> 10;
+            this->cache.insert(fin.key, new QImage(fin.tile), max(cost, 1));
+            ready = true;
+        }
+    }
+
+    if (ready)
+    {
+        this->account(MemoryBudget::ScaledPixels, this->memory_usage());
+        emit tileReady();
+    }
+}
+
+quint64 ImageTileCache::tile_key(int level, int col, int row)
+{
+    return ((quint64)level << 56) | ((quint64)(quint32)row << 28) |
+           (quint64)(quint32)col;
+}
@@ -1,17 +1,62 @@
 #include "mark_widget.h"
 
+#include <algorithm>
+
+#include <QCoreApplication>
+#include <QGuiApplication>
+#include <QScreen>
+
 using namespace std;
 using namespace ican_mark;
 
-ImageView::ImageView(QWidget* parent) : QWidget(parent) {}
+ImageView::ImageView(QWidget* parent) : QWidget(parent)
+{
+    this->frameTimer.setSingleShot(true);
+    connect(&this->frameTimer, &QTimer::timeout, this, &ImageView::frame_tick);
+}
 
 void ImageView::reset(const QImage& image)
 {
-    this->bgImage = image;
-    this->currentScale = -1;
+    ImageView::reset(image.isNull() ? shared_ptr<ImageResource>()
+                                    : make_shared<ImageResource>(image));
+}
+
+void ImageView::reset(const shared_ptr<ImageSource>& source)
+{
+    ImageView::reset(source ? make_shared<ImageResource>(source)
+                            : shared_ptr<ImageResource>());
+}
+
+void ImageView::reset(const shared_ptr<ImageResource>& resource)
+{
+    // Pending tiles of this view are dropped from previous image
+    ImageTileCache* tileCache =
+        this->resource ? this->resource->tile_cache() : nullptr;
+    if (tileCache)
+    {
+        tileCache->begin_round(this);
+        disconnect(tileCache, nullptr, this, nullptr);
+    }
+
+    this->resource = resource;
+    this->imgSize = resource ? resource->size() : QSize();
+
+    tileCache = resource ? resource->tile_cache() : nullptr;
+    if (tileCache)
+    {
+        connect(tileCache, &ImageTileCache::tileReady, this,
+                &ImageView::tiles_ready);
+    }
+
+    this->bgRevision++;
     this->zoom_to_fit();
 }
 
+const shared_ptr<ImageResource>& ImageView::image_resource() const
+{
+    return this->resource;
+}
+
 void ImageView::zoom_to_fit()
 {
     this->viewScale = this->find_fit_scale_ratio();
@@ -20,9 +65,14 @@ void ImageView::zoom_to_fit()
 
 double ImageView::find_fit_scale_ratio() const
 {
+    if (this->imgSize.isEmpty())
+    {
+        return 1.0;
+    }
+
     QSizeF viewSize =
-        QSizeF(this->bgImage.size()).scaled(this->size(), Qt::KeepAspectRatio);
-    return (double)viewSize.width() / (double)this->bgImage.width();
+        QSizeF(this->imgSize).scaled(this->size(), Qt::KeepAspectRatio);
+    return (double)viewSize.width() / (double)this->imgSize.width();
 }
 
 QPointF ImageView::find_centered_point() const
@@ -82,32 +132,129 @@ QRectF ImageView::mapping_to_image(const QRectF& rect)
 
 void ImageView::draw_background(const QColor& bgColor)
 {
-    int width = this->width();
-    int height = this->height();
-
     // Setup painter
     QPainter painter(this);
+    this->draw_background(painter, bgColor);
+}
+
+void ImageView::draw_background(QPainter& painter, const QColor& bgColor)
+{
+    int width = this->width();
+    int height = this->height();
 
     // Paint solid background
     painter.setBrush(QBrush(bgColor, Qt::SolidPattern));
     painter.drawRect(0, 0, width, height);
 
     // Paint image
-    if (!this->bgImage.isNull())
+    if (this->resource)
+    {
+        this->resource->pyramid().draw(painter, QRectF(0, 0, width, height),
+                                       this->viewCenter, this->viewScale,
+                                       this);
+    }
+}
+
+const ImageView::RenderStats& ImageView::render_stats() const
+{
+    return this->renderStats;
+}
+
+void ImageView::reset_render_stats() { this->renderStats = RenderStats(); }
+
+void ImageView::start_trace(InputTrace* trace)
+{
+    trace->clear();
+    trace->target = this->metaObject()->className();
+    trace->viewSize = this->size();
+    trace->viewCenter = this->viewCenter;
+    trace->viewScale = this->viewScale;
+    trace->start();
+
+    this->inputTrace = trace;
+}
+
+void ImageView::stop_trace()
+{
+    if (this->inputTrace)
+    {
+        this->inputTrace->stop();
+        this->inputTrace = nullptr;
+    }
+}
+
+void ImageView::replay_input(const InputTrace::Event& event)
+{
+    unique_ptr<QEvent> replayEvent = InputTrace::make_event(event);
+    if (replayEvent)
+    {
+        QCoreApplication::sendEvent(this, replayEvent.get());
+    }
+}
+
+void ImageView::request_frame()
+{
+    if (this->inFrame || this->frameTimer.isActive())
     {
-        if (this->viewScale != this->currentScale)
-        {
-            this->currentScale = this->viewScale;
-            this->scaledImg =
-                this->bgImage.scaled(this->bgImage.size() * this->viewScale);
-        }
-
-        QPointF drawPoint =
-            this->viewCenter - QPointF(this->scaledImg.width() / 2.0,
-                                       this->scaledImg.height() / 2.0);
-
-        // Paint image
-        painter.drawImage(drawPoint, this->scaledImg,
-                          QRect(QPoint(0, 0), this->scaledImg.size()));
+        return;
+    }
+
+    // Find frame interval with display refresh rate
+    qreal refreshRate = 60;
+    QScreen* screen = QGuiApplication::primaryScreen();
+    if (screen && screen->refreshRate() > 0)
+    {
+        refreshRate = screen->refreshRate();
+    }
+
+    // Serve immediately if last frame is old enough
+    qint64 interval = (qint64)(1000.0 / refreshRate);
+    qint64 elapsed =
+        this->frameClock.isValid() ? this->frameClock.elapsed() : interval;
+    this->frameTimer.start((int)max<qint64>(0, interval - elapsed));
+}
+
+void ImageView::frame_tick()
+{
+    // Input flushed by frame_update() is painted by the same frame
+    this->frameClock.start();
+    this->inFrame = true;
+    this->frame_update();
+    this->inFrame = false;
+}
+
+void ImageView::frame_update() { this->update(); }
+
+void ImageView::tiles_ready()
+{
+    // Redraw with newly decoded tiles
+    this->bgRevision++;
+    this->request_frame();
+}
+
+void ImageView::count_render_stats(QEvent* event)
+{
+    switch (event->type())
+    {
+        case QEvent::MouseMove:
+        case QEvent::MouseButtonPress:
+        case QEvent::MouseButtonRelease:
+        case QEvent::MouseButtonDblClick:
+        case QEvent::Wheel:
+        case QEvent::KeyPress:
+        case QEvent::KeyRelease:
+            this->renderStats.inputEvents++;
+            if (this->inputTrace)
+            {
+                this->inputTrace->record(event);
+            }
+            break;
+
+        case QEvent::Paint:
+            this->renderStats.paints++;
+            break;
+
+        default:
+            break;
     }
 }
@@ -0,0 +1,258 @@
+#include "mark_widget.h"
+
+#include <QDataStream>
+#include <QFile>
+#include <QKeyEvent>
+#include <QSaveFile>
+#include <QWheelEvent>
+#include <QtGlobal>
+
+using namespace std;
+
+namespace
+{
+const quint32 traceMagic = 0x52544349;  // "ICTR" in little endian
+const quint16 traceVersion = 1;
+
+bool is_mouse_event(quint16 type)
+{
+    return type == QEvent::MouseMove || type == QEvent::MouseButtonPress ||
+           type == QEvent::MouseButtonRelease ||
+           type == QEvent::MouseButtonDblClick;
+}
+
+bool is_key_event(quint16 type)
+{
+    return type == QEvent::KeyPress || type == QEvent::KeyRelease;
+}
+
+void setup_stream(QDataStream& stream)
+{
+    stream.setVersion(QDataStream::Qt_5_6);
+    stream.setByteOrder(QDataStream::LittleEndian);
+}
+
+}  // namespace
+
+void InputTrace::start() { this->clock.start(); }
+
+void InputTrace::stop() { this->clock.invalidate(); }
+
+bool InputTrace::is_recording() const { return this->clock.isValid(); }
+
+qint64 InputTrace::elapsed() const
+{
+    return this->clock.isValid() ? this->clock.nsecsElapsed() / 1000 : 0;
+}
+
+void InputTrace::record(const QEvent* event)
+{
+    Event ev;
+    ev.time = this->elapsed();
+    ev.type = event->type();
+
+    if (is_mouse_event(ev.type))
+    {
+        const QMouseEvent* me = static_cast<const QMouseEvent*>(event);
+        ev.button = me->button();
+        ev.buttons = me->buttons();
+        ev.modifiers = me->modifiers();
+        ev.pos = me->localPos();
+    }
+    else if (ev.type == QEvent::Wheel)
+    {
+        const QWheelEvent* we = static_cast<const QWheelEvent*>(event);
+        ev.buttons = we->buttons();
+        ev.modifiers = we->modifiers();
+#if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0)
+        ev.pos = we->position();
+#else
+        ev.pos = we->posF();
+#endif
+        ev.angleDelta = we->angleDelta();
+    }
+    else if (is_key_event(ev.type))
+    {
+        const QKeyEvent* ke = static_cast<const QKeyEvent*>(event);
+        ev.button = ke->key();
+        ev.modifiers = ke->modifiers();
+        ev.text = ke->text();
+        ev.autoRepeat = ke->isAutoRepeat();
+    }
+    else
+    {
+        return;
+    }
+
+    this->eventList.push_back(ev);
+}
+
+void InputTrace::record(const Event& event)
+{
+    this->eventList.push_back(event);
+    this->eventList.back().time = this->elapsed();
+}
+
+void InputTrace::clear() { *this = InputTrace(); }
+
+const vector<InputTrace::Event>& InputTrace::events() const
+{
+    return this->eventList;
+}
+
+unique_ptr<QEvent> InputTrace::make_event(const Event& event)
+{
+    QEvent::Type type = (QEvent::Type)event.type;
+    Qt::MouseButtons buttons(event.buttons);
+    Qt::KeyboardModifiers modifiers(event.modifiers);
+
+    if (is_mouse_event(event.type))
+    {
+        return unique_ptr<QEvent>(
+            new QMouseEvent(type, event.pos, event.pos, event.pos,
+                            (Qt::MouseButton)event.button, buttons, modifiers));
+    }
+    else if (event.type == QEvent::Wheel)
+    {
+        return unique_ptr<QEvent>(new QWheelEvent(
+            event.pos, event.pos, QPoint(), event.angleDelta, buttons,
+            modifiers, Qt::NoScrollPhase, false));
+    }
+    else if (is_key_event(event.type))
+    {
+        return unique_ptr<QEvent>(new QKeyEvent(type, (int)event.button,
+                                                modifiers, event.text,
+                                                event.autoRepeat));
+    }
+
+    return nullptr;
+}
+
+bool InputTrace::save(const QString& path)
+{
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly))
+    {
+        this->errMsg = file.errorString();
+        return false;
+    }
+
+    QDataStream out(&file);
+    setup_stream(out);
+
+    out << traceMagic << traceVersion;
+    out << this->target << this->viewSize << this->viewCenter
+        << this->viewScale << (qint32)this->label;
+    out << this->initMarks << this->finalMarks;
+
+    // Events with fields used by their types only
+    out << (quint32)this->eventList.size();
+    for (const Event& ev : this->eventList)
+    {
+        out << ev.time << ev.type;
+        if (is_mouse_event(ev.type))
+        {
+            out << ev.button << ev.buttons << ev.modifiers << ev.pos;
+        }
+        else if (ev.type == QEvent::Wheel)
+        {
+            out << ev.buttons << ev.modifiers << ev.pos << ev.angleDelta;
+        }
+        else if (is_key_event(ev.type))
+        {
+            out << ev.button << ev.modifiers << ev.text << ev.autoRepeat;
+        }
+        else if (ev.type == ViewChange)
+        {
+            out << ev.pos << ev.scale;
+        }
+        else if (ev.type == LabelChange)
+        {
+            out << ev.button;
+        }
+    }
+
+    if (out.status() != QDataStream::Ok || !file.commit())
+    {
+        this->errMsg = file.errorString();
+        return false;
+    }
+
+    return true;
+}
+
+bool InputTrace::load(const QString& path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        this->errMsg = file.errorString();
+        return false;
+    }
+
+    QDataStream in(&file);
+    setup_stream(in);
+
+    quint32 magic = 0;
+    quint16 version = 0;
+    in >> magic >> version;
+    if (magic != traceMagic || version != traceVersion)
+    {
+        this->errMsg = "Not an input trace file of version " +
+                       QString::number(traceVersion);
+        return false;
+    }
+
+    InputTrace trace;
+    qint32 label;
+    in >> trace.target >> trace.viewSize >> trace.viewCenter >>
+        trace.viewScale >> label;
+    in >> trace.initMarks >> trace.finalMarks;
+    trace.label = label;
+
+    quint32 count = 0;
+    in >> count;
+    for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; i++)
+    {
+        Event ev;
+        in >> ev.time >> ev.type;
+        if (is_mouse_event(ev.type))
+        {
+            in >> ev.button >> ev.buttons >> ev.modifiers >> ev.pos;
+        }
+        else if (ev.type == QEvent::Wheel)
+        {
+            in >> ev.buttons >> ev.modifiers >> ev.pos >> ev.angleDelta;
+        }
+        else if (is_key_event(ev.type))
+        {
+            in >> ev.button >> ev.modifiers >> ev.text >> ev.autoRepeat;
+        }
+        else if (ev.type == ViewChange)
+        {
+            in >> ev.pos >> ev.scale;
+        }
+        else if (ev.type == LabelChange)
+        {
+            in >> ev.button;
+        }
+        else
+        {
+            in.setStatus(QDataStream::ReadCorruptData);
+            break;
+        }
+
+        trace.eventList.push_back(ev);
+    }
+
+    if (in.status() != QDataStream::Ok)
+    {
+        this->errMsg = "Truncated or corrupted input trace";
+        return false;
+    }
+
+    *this = std::move(trace);
+    return true;
+}
+
+const QString& InputTrace::error_string() const { return this->errMsg; }
@@ -0,0 +1,315 @@
+#include "mark_widget.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <QtMath>
+
+using namespace std;
+using namespace ican_mark;
+
+InstanceIndex::InstanceIndex(double cellSize) : cellSize(cellSize) {}
+
+void InstanceIndex::reset(const InstanceStore& instList)
+{
+    this->clear();
+
+    // Adapt cell size to the average instance size
+    double sizeSum = 0;
+    int sizeCount = 0;
+    for (const Instance inst : instList)
+    {
+        QRectF rect = bounding_rect(inst);
+        if (!rect.isNull())
+        {
+            sizeSum += max(rect.width(), rect.height());
+            sizeCount++;
+        }
+    }
+
+    if (sizeCount > 0)
+    {
+        this->cellSize = min(max(2.0 * sizeSum / sizeCount, 32.0), 4096.0);
+    }
+
+    // Insert instances
+    this->bounds.reserve(instList.size());
+    this->stamps.reserve(instList.size());
+    for (const Instance inst : instList)
+    {
+        this->append(inst);
+    }
+}
+
+void InstanceIndex::append(const Instance& inst)
+{
+    this->bounds.push_back(bounding_rect(inst));
+    this->stamps.push_back(0);
+    this->insert_cells((int)this->bounds.size() - 1);
+}
+
+void InstanceIndex::pop_back()
+{
+    if (this->bounds.empty())
+    {
+        return;
+    }
+
+    this->erase_cells((int)this->bounds.size() - 1);
+    this->bounds.pop_back();
+    this->stamps.pop_back();
+}
+
+void InstanceIndex::update(int index, const Instance& inst)
+{
+    // Only cells of the old and new bounding box are touched
+    QRectF rect = bounding_rect(inst);
+    if (rect == this->bounds[index])
+    {
+        return;
+    }
+
+    this->erase_cells(index);
+    this->bounds[index] = rect;
+    this->insert_cells(index);
+}
+
+void InstanceIndex::clear()
+{
+    this->bounds.clear();
+    this->cells.clear();
+    this->largeList.clear();
+    this->stamps.clear();
+    this->curStamp = 0;
+}
+
+vector<int> InstanceIndex::query(const QRectF& rect) const
+{
+    vector<int> ret;
+
+    // Setup stamp for deduplicating
+    if (++this->curStamp == 0)
+    {
+        fill(this->stamps.begin(), this->stamps.end(), 0);
+        this->curStamp = 1;
+    }
+
+    auto check = [&](int index)
+    {
+        if (this->stamps[index] != this->curStamp &&
+            this->bounds[index].intersects(rect))
+        {
+            this->stamps[index] = this->curStamp;
+            ret.push_back(index);
+        }
+    };
+
+    // Collect candidates from intersected cells, or from all occupied cells
+    // if the query region covers more cells than those being occupied
+    int colBeg = (int)floor(rect.left() / this->cellSize);
+    int colEnd = (int)floor(rect.right() / this->cellSize);
+    int rowBeg = (int)floor(rect.top() / this->cellSize);
+    int rowEnd = (int)floor(rect.bottom() / this->cellSize);
+
+    double cellCount =
+        (double)(colEnd - colBeg + 1) * (double)(rowEnd - rowBeg + 1);
+    if (cellCount > (double)this->cells.size())
+    {
+        for (auto it = this->cells.begin(); it != this->cells.end(); it++)
+        {
+            for (int index : it->second)
+            {
+                check(index);
+            }
+        }
+    }
+    else
+    {
+        for (int row = rowBeg; row <= rowEnd; row++)
+        {
+            for (int col = colBeg; col <= colEnd; col++)
+            {
+                auto it = this->cells.find(this->cell_key(col, row));
+                if (it != this->cells.end())
+                {
+                    for (int index : it->second)
+                    {
+                        check(index);
+                    }
+                }
+            }
+        }
+    }
+
+    for (int index : this->largeList)
+    {
+        check(index);
+    }
+
+    sort(ret.begin(), ret.end());
+    return ret;
+}
+
+int InstanceIndex::hit_test(const QPointF& pos,
+                            const InstanceStore& instList) const
+{
+    int ret = -1;
+    auto check = [&](int index)
+    {
+        if (index > ret && this->bounds[index].contains(pos) &&
+            contains(instList[index], pos))
+        {
+            ret = index;
+        }
+    };
+
+    auto it = this->cells.find(
+        this->cell_key((int)floor(pos.x() / this->cellSize),
+                       (int)floor(pos.y() / this->cellSize)));
+    if (it != this->cells.end())
+    {
+        for (int index : it->second)
+        {
+            check(index);
+        }
+    }
+
+    for (int index : this->largeList)
+    {
+        check(index);
+    }
+
+    return ret;
+}
+
+QRectF InstanceIndex::bounding_rect(const Instance& inst)
+{
+    if (!(inst.has_x() && inst.has_y() && inst.has_w() && inst.has_h()))
+    {
+        return QRectF();
+    }
+
+    double rad = qDegreesToRadians(inst.has_degree() ? inst.get_degree() : 0);
+    double absCos = fabs(cos(rad));
+    double absSin = fabs(sin(rad));
+    double halfWidth = inst.get_w() / 2;
+    double halfHeight = inst.get_h() / 2;
+
+    QSizeF halfSize(halfWidth * absCos + halfHeight * absSin,
+                    halfWidth * absSin + halfHeight * absCos);
+    QPointF center(inst.get_x(), inst.get_y());
+    return QRectF(center - QPointF(halfSize.width(), halfSize.height()),
+                  halfSize * 2);
+}
+
+bool InstanceIndex::contains(const Instance& inst, const QPointF& pos)
+{
+    if (!(inst.has_x() && inst.has_y() && inst.has_w() && inst.has_h()))
+    {
+        return false;
+    }
+
+    // Rotate position into the frame of bounding box
+    double rad = qDegreesToRadians(inst.has_degree() ? inst.get_degree() : 0);
+    double dx = pos.x() - inst.get_x();
+    double dy = pos.y() - inst.get_y();
+    double localX = dx * cos(rad) - dy * sin(rad);
+    double localY = dx * sin(rad) + dy * cos(rad);
+
+    return (fabs(localX) <= inst.get_w() / 2) &&
+           (fabs(localY) <= inst.get_h() / 2);
+}
+
+void InstanceIndex::insert_cells(int index)
+{
+    // Lists are kept in index order, appending costs no search
+    auto insert = [index](vector<int>& list)
+    {
+        if (list.empty() || list.back() < index)
+        {
+            list.push_back(index);
+        }
+        else
+        {
+            list.insert(lower_bound(list.begin(), list.end(), index), index);
+        }
+    };
+
+    const QRectF& rect = this->bounds[index];
+    if (rect.isNull())
+    {
+        return;
+    }
+
+    int colBeg, colEnd, rowBeg, rowEnd;
+    if (!this->cell_range(rect, colBeg, colEnd, rowBeg, rowEnd))
+    {
+        insert(this->largeList);
+        return;
+    }
+
+    for (int row = rowBeg; row <= rowEnd; row++)
+    {
+        for (int col = colBeg; col <= colEnd; col++)
+        {
+            insert(this->cells[this->cell_key(col, row)]);
+        }
+    }
+}
+
+void InstanceIndex::erase_cells(int index)
+{
+    auto erase = [index](vector<int>& list)
+    {
+        auto it = lower_bound(list.begin(), list.end(), index);
+        if (it != list.end() && *it == index)
+        {
+            list.erase(it);
+        }
+    };
+
+    const QRectF& rect = this->bounds[index];
+    if (rect.isNull())
+    {
+        return;
+    }
+
+    int colBeg, colEnd, rowBeg, rowEnd;
+    if (!this->cell_range(rect, colBeg, colEnd, rowBeg, rowEnd))
+    {
+        erase(this->largeList);
+        return;
+    }
+
+    for (int row = rowBeg; row <= rowEnd; row++)
+    {
+        for (int col = colBeg; col <= colEnd; col++)
+        {
+            auto it = this->cells.find(this->cell_key(col, row));
+            if (it != this->cells.end())
+            {
+                erase(it->second);
+                if (it->second.empty())
+                {
+                    this->cells.erase(it);
+                }
+            }
+        }
+    }
+}
+
+bool InstanceIndex::cell_range(const QRectF& rect, int& colBeg, int& colEnd,
+                               int& rowBeg, int& rowEnd) const
+{
+    colBeg = (int)floor(rect.left() / this->cellSize);
+    colEnd = (int)floor(rect.right() / this->cellSize);
+    rowBeg = (int)floor(rect.top() / this->cellSize);
+    rowEnd = (int)floor(rect.bottom() / this->cellSize);
+    return (colEnd - colBeg < this->maxCellSpan &&
+            rowEnd - rowBeg < this->maxCellSpan);
+}
+
+qint64 InstanceIndex::cell_key(int col, int row) const
+{
+    return (qint64)(((quint64)(quint32)col << 32) | (quint32)row);
+}
@@ -0,0 +1,224 @@
+#include "mark_widget.h"
+
+using namespace std;
+using namespace ican_mark;
+
+InstanceListModel::InstanceListModel(const InstanceStore& annoList,
+                                     const vector<string>& classNames,
+                                     QObject* parent)
+    : QAbstractListModel(parent), annoList(annoList), classNames(classNames)
+{
+}
+
+int InstanceListModel::rowCount(const QModelIndex& parent) const
+{
+    return parent.isValid() ? 0 : this->rows;
+}
+
+QVariant InstanceListModel::data(const QModelIndex& index, int role) const
+{
+    // Instance list may be edited already while views handle notifications
+    int row = index.row();
+    if (!index.isValid() || row >= this->rows ||
+        row >= (int)this->annoList.size())
+    {
+        return QVariant();
+    }
+
+    switch (role)
+    {
+        case Qt::DisplayRole:
+            return this->format_row(row);
+
+        case Qt::CheckStateRole:
+            return this->checkList[row] ? Qt::Checked : Qt::Unchecked;
+
+        default:
+            return QVariant();
+    }
+}
+
+bool InstanceListModel::setData(const QModelIndex& index,
+                                const QVariant& value, int role)
+{
+    if (!index.isValid() || role != Qt::CheckStateRole)
+    {
+        return false;
+    }
+
+    this->checkList[index.row()] =
+        (static_cast<Qt::CheckState>(value.toInt()) == Qt::Checked);
+    emit dataChanged(index, index, {Qt::CheckStateRole});
+
+    return true;
+}
+
+Qt::ItemFlags InstanceListModel::flags(const QModelIndex& index) const
+{
+    if (!index.isValid())
+    {
+        return Qt::NoItemFlags;
+    }
+
+    return Qt::ItemIsEnabled | Qt::ItemIsSelectable | Qt::ItemIsUserCheckable;
+}
+
+vector<size_t> InstanceListModel::checked_rows() const
+{
+    vector<size_t> ret;
+    for (size_t i = 0; i < this->checkList.size(); i++)
+    {
+        if (this->checkList[i])
+        {
+            ret.push_back(i);
+        }
+    }
+
+    return ret;
+}
+
+QString InstanceListModel::format_instance(const Instance& inst)
+{
+    QString ret("{");
+
+#define __attr_format(name)                                         \
+    if (inst.has_##name())                                          \
+    {                                                               \
+        if (ret.size() > 1) ret += QLatin1String(", ");             \
+        ret += QLatin1String(#name ": ") +                          \
+               QString::number(inst.get_##name(), 'g', 10);         \
+    }
+
+    __attr_format(label);
+    __attr_format(degree);
+    __attr_format(x);
+    __attr_format(y);
+    __attr_format(w);
+    __attr_format(h);
+
+    ret += QLatin1Char('}');
+    return ret;
+}
+
+QString InstanceListModel::format_row(int row) const
+{
+    Instance inst = this->annoList[row];
+
+    QString ret = QString::number(row + 1) + QLatin1String(". ");
+    if (inst.has_label())
+    {
+        int label = inst.get_label();
+        if (label >= 0 && label < (int)this->classNames.size())
+        {
+            ret += QString::fromStdString(this->classNames[label]) +
+                   QLatin1Char(' ');
+        }
+    }
+
+    return ret + format_instance(inst);
+}
+
+void InstanceListModel::begin_reset() { this->beginResetModel(); }
+
+void InstanceListModel::end_reset()
+{
+    this->rows = (int)this->annoList.size();
+    this->checkList.assign(this->rows, false);
+    this->endResetModel();
+}
+
+void InstanceListModel::begin_insert(const vector<size_t>& indList)
+{
+    // Single range is inserted as rows, others reset the model
+    this->editList = indList;
+    this->editReset = (indList.back() - indList.front() + 1 != indList.size());
+    if (this->editReset)
+    {
+        this->beginResetModel();
+    }
+    else
+    {
+        this->beginInsertRows(QModelIndex(), (int)indList.front(),
+                              (int)indList.back());
+    }
+}
+
+void InstanceListModel::end_insert()
+{
+    // Ascending insertion places each row at its final index
+    for (size_t index : this->editList)
+    {
+        this->checkList.insert(this->checkList.begin() + index, false);
+    }
+
+    this->rows = (int)this->checkList.size();
+    if (this->editReset)
+    {
+        this->endResetModel();
+        return;
+    }
+
+    this->endInsertRows();
+
+    // Row numbers after inserted rows are shifted
+    if ((int)this->editList.back() + 1 < this->rows)
+    {
+        emit dataChanged(this->index((int)this->editList.back() + 1),
+                         this->index(this->rows - 1), {Qt::DisplayRole});
+    }
+}
+
+void InstanceListModel::begin_remove(const vector<size_t>& indList)
+{
+    this->editList = indList;
+    this->editReset = (indList.back() - indList.front() + 1 != indList.size());
+    if (this->editReset)
+    {
+        this->beginResetModel();
+    }
+    else
+    {
+        this->beginRemoveRows(QModelIndex(), (int)indList.front(),
+                              (int)indList.back());
+    }
+}
+
+void InstanceListModel::end_remove()
+{
+    for (auto it = this->editList.rbegin(); it != this->editList.rend(); it++)
+    {
+        this->checkList.erase(this->checkList.begin() + *it);
+    }
+
+    this->rows = (int)this->checkList.size();
+    if (this->editReset)
+    {
+        this->endResetModel();
+        return;
+    }
+
+    this->endRemoveRows();
+
+    // Row numbers after removed rows are shifted
+    int first = (int)this->editList.front();
+    if (first < this->rows)
+    {
+        emit dataChanged(this->index(first), this->index(this->rows - 1),
+                         {Qt::DisplayRole});
+    }
+}
+
+void InstanceListModel::rows_changed(int first, int last)
+{
+    emit dataChanged(this->index(first), this->index(last), {Qt::DisplayRole});
+}
+
+void InstanceListModel::class_names_changed()
+{
+    int rows = this->rowCount();
+    if (rows > 0)
+    {
+        emit dataChanged(this->index(0), this->index(rows - 1),
+                         {Qt::DisplayRole});
+    }
+}
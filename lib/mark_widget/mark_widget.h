@@ -1,24 +1,503 @@
 #ifndef MARK_WIDGET_H
 #define MARK_WIDGET_H
 
+#include <atomic>
 #include <map>
+#include <memory>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
+#include <QAbstractListModel>
+#include <QByteArray>
+#include <QCache>
+#include <QElapsedTimer>
 #include <QEvent>
+#include <QHash>
 #include <QImage>
+#include <QMouseEvent>
+#include <QMutex>
 #include <QObject>
 #include <QPainter>
+#include <QPoint>
 #include <QPointF>
 #include <QRectF>
+#include <QSet>
 #include <QSize>
 #include <QSizeF>
+#include <QStaticText>
+#include <QString>
+#include <QThreadPool>
+#include <QTimer>
+#include <QTransform>
+#include <QVector>
 #include <QWidget>
 
 #include <mark_action.hpp>
+#include <mark_history.hpp>
 #include <mark_instance.hpp>
 
+/**
+ * Memory used by images and caches of the application, accounted by
+ * category against one limit.
+ *
+ * Clients report their usage, and when total usage exceeds the limit, they
+ * are asked to release memory from lowest priority up, each no more than it
+ * can release. Nothing is released if the limit cannot be met by that, as
+ * memory of images in use would be reloaded right away. Used on GUI thread
+ * only.
+ */
+class MemoryBudget : public QObject
+{
+    Q_OBJECT
+
+   public:
+    enum Category
+    {
+        SourcePixels,  // Decoded images
+        ScaledPixels,  // Pyramid levels, tiles and view layers
+        Thumbnails,
+        Annotations,  // Edit history and annotation layers
+        CategoryCount
+    };
+
+    /** Eviction priorities, lower ones are released first */
+    enum Priority
+    {
+        ThumbnailPriority = 0,
+        PrefetchPriority = 10,
+        TilePriority = 20,
+        HistoryPriority = 30,
+        PinnedPriority = 100  // Images in use, nothing to release
+    };
+
+    class Client
+    {
+       public:
+        explicit Client(int priority);
+        Client(const Client&) = delete;
+        Client& operator=(const Client&) = delete;
+        virtual ~Client();
+
+        int priority() const { return this->prio; }
+
+        /** Release at least given bytes if possible, return released ones */
+        virtual qint64 release_memory(qint64 bytes);
+        virtual qint64 releasable_memory() const;
+
+       protected:
+        /** Report usage of category, total is checked afterward */
+        void account(Category category, qint64 bytes);
+
+       private:
+        friend class MemoryBudget;
+
+        int prio;
+        qint64 usage[CategoryCount] = {};
+    };
+
+    static MemoryBudget& instance();
+
+    void set_limit(qint64 bytes);
+    qint64 limit() const;
+    qint64 usage() const;
+    qint64 usage(Category category) const;
+
+    static QString category_name(Category category);
+
+   signals:
+    void usageChanged();
+
+   private slots:
+    void enforce();
+
+   private:
+    MemoryBudget();
+
+    qint64 maxBytes = qint64(4096) << 20;
+    qint64 total[CategoryCount] = {};
+    std::vector<Client*> clientList;
+    QTimer checkTimer;  // Merges checks of usage reported together
+
+    void schedule();
+};
+
+/**
+ * Image decoded by regions, for images too large to be kept in memory.
+ *
+ * Level n is the image downscaled by 2^n. Reading is thread-safe.
+ */
+class ImageSource
+{
+   public:
+    virtual ~ImageSource() = default;
+
+    /** Open file decodable by regions, nullptr if format does not allow */
+    static std::shared_ptr<ImageSource> open(const QString& path);
+
+    virtual QSize size() const = 0;
+
+    /** Decode rect on space of given level */
+    virtual QImage read(int level, const QRect& rect) const = 0;
+
+    static QSize level_size(const QSize& size, int level);
+};
+
+/**
+ * Area-averaging downscaler for ARGB32 and Grayscale8 images, keeping thin
+ * details which nearest sampling drops. Rows are averaged with SSE4.1 or AVX2
+ * when the CPU supports them, and target rows are split into bands across
+ * threads.
+ */
+class ImageScaler
+{
+   public:
+    enum Isa
+    {
+        Auto,
+        Scalar,
+        SSE41,
+        AVX2
+    };
+
+    /**
+     * Downscale image to size, threads <= 0 for all cores. Images not smaller
+     * on both axes are scaled smoothly by Qt instead.
+     */
+    static QImage scaled(const QImage& image, const QSize& size,
+                         int threads = 0, Isa isa = Auto);
+
+    static Isa best_isa();
+};
+
+/**
+ * Tiles of an image source decoded by a thread pool, and kept in LRU under a
+ * memory cap. Requests no longer wanted by any viewer drawing from the cache
+ * are dropped before being decoded.
+ */
+class ImageTileCache : public QObject, public MemoryBudget::Client
+{
+    Q_OBJECT
+
+   public:
+    explicit ImageTileCache(int tileSize = 256, qint64 maxBytes = 512 << 20,
+                            QObject* parent = nullptr);
+    ~ImageTileCache();
+
+    void reset(const std::shared_ptr<ImageSource>& source);
+    void clear();
+
+    const std::shared_ptr<ImageSource>& source() const;
+    int tile_size() const;
+    qint64 memory_usage() const;
+
+    /** Start a drawing round of viewer, its previous requests are dropped */
+    void begin_round(const void* viewer);
+
+    /**
+     * Decoded tile, or null one if not found, with tile requested for viewer
+     * unless it is nullptr. Tiles failed to decode are not requested again
+     * until reset.
+     */
+    QImage tile(int level, int col, int row, const void* viewer = nullptr);
+
+    /** Least recently used tiles are dropped first */
+    qint64 release_memory(qint64 bytes) override;
+    qint64 releasable_memory() const override;
+
+   signals:
+    void tileReady();
+
+   private slots:
+    void collect_finished();
+
+   private:
+    class Job;
+
+    struct Finished
+    {
+        quint64 key;
+        int generation;
+        QImage tile;
+    };
+
+    int tileSize;
+    std::shared_ptr<ImageSource> src;
+    int generation = 0;  // Increased on source changed
+
+    QThreadPool pool;
+    QCache<quint64, QImage> cache;  // Cost in KiB
+    QSet<quint64> failed;           // Tiles of source failed to decode
+
+    struct Request
+    {
+        bool started;
+        QVector<const void*> viewers;  // Viewers wanting it before started
+    };
+
+    QMutex mutex;
+    QHash<quint64, Request> pending;  // Requested tiles
+    std::vector<Finished> finList;    // Guarded by mutex
+
+    static quint64 tile_key(int level, int col, int row);
+};
+
+class ImagePyramid
+{
+   public:
+    explicit ImagePyramid(int tileSize = 256);
+
+    /** Initialization and setup, tiles of sources are read from cache */
+    void reset(const QImage& image);
+    void reset(ImageTileCache* tileCache);
+    void clear();
+
+    /** Pyramid information */
+    bool is_null() const;
+    qint64 cache_key() const;
+    QSize size() const;
+    int tile_size() const;
+    int level_count() const;
+    int find_level(double scale) const;
+    const QImage& level_image(int level) const;  // Images in memory only
+
+    /**
+     * Draw tiles intersecting viewRect with given view center and scale,
+     * tiles of sources are requested for viewer
+     */
+    void draw(QPainter& painter, const QRectF& viewRect,
+              const QPointF& viewCenter, double viewScale,
+              const void* viewer) const;
+
+    /** Part of a level image placed on view space */
+    struct Patch
+    {
+        QImage image;
+        QRectF source;  // On level image
+        QRectF target;  // On view space
+    };
+
+    /**
+     * Patches drawn for viewRect, images are shared so they can be drawn on
+     * other threads
+     */
+    std::vector<Patch> patches(const QRectF& viewRect,
+                               const QPointF& viewCenter, double viewScale,
+                               const void* viewer) const;
+
+    qint64 memory_usage() const;  // Images in memory only
+
+   protected:
+    int tileSize;                // Size of square tiles
+    qint64 srcKey = 0;           // Cache key of source image
+    QSize srcSize;               // Size of level 0
+    std::vector<QImage> levels;  // Level 0 is the source image
+
+    ImageTileCache* tileCache = nullptr;  // Tiles of image source
+    int tileLevels = 0;
+
+    void tile_patches(const QRectF& lvRect, int level,
+                      const QTransform& lvToView, const void* viewer,
+                      std::vector<Patch>& patchList) const;
+};
+
+/**
+ * Background image shared by reference between views, so that its pyramid
+ * and decoded tiles are built once for all of them
+ */
+class ImageResource : public MemoryBudget::Client
+{
+   public:
+    explicit ImageResource(const QImage& image);
+    explicit ImageResource(const std::shared_ptr<ImageSource>& source);
+    ImageResource(const ImageResource&) = delete;
+    ImageResource& operator=(const ImageResource&) = delete;
+
+    const QImage& image() const;  // Null if read from source
+    QSize size() const;
+    const ImagePyramid& pyramid() const;
+    ImageTileCache* tile_cache() const;  // nullptr if image is in memory
+    qint64 memory_usage() const;
+
+   protected:
+    QImage srcImage;
+    std::unique_ptr<ImageTileCache> tileCache;
+    ImagePyramid imgPyramid;
+};
+
+class InstanceIndex
+{
+   public:
+    explicit InstanceIndex(double cellSize = 128);
+
+    /** Index maintaining */
+    void reset(const ican_mark::InstanceStore& instList);
+    void append(const ican_mark::Instance& inst);
+    void pop_back();
+    void update(int index, const ican_mark::Instance& inst);
+    void clear();
+
+    /** Query instances with bounding box intersecting rect, in index order */
+    std::vector<int> query(const QRectF& rect) const;
+
+    /** Find the topmost instance containing pos, -1 if none */
+    int hit_test(const QPointF& pos,
+                 const ican_mark::InstanceStore& instList) const;
+
+    /** Geometry functions */
+    static QRectF bounding_rect(const ican_mark::Instance& inst);
+    static bool contains(const ican_mark::Instance& inst, const QPointF& pos);
+
+   protected:
+    double cellSize;
+    int maxCellSpan = 16;  // Instances spanning more cells are kept apart
+
+    std::vector<QRectF> bounds;  // Bounding box of each instance
+    std::unordered_map<qint64, std::vector<int>> cells;
+    std::vector<int> largeList;  // Instances spanning too many cells
+
+    mutable std::vector<unsigned int> stamps;  // For deduplicating queries
+    mutable unsigned int curStamp = 0;
+
+    void insert_cells(int index);  // Cell lists are sorted by index
+    void erase_cells(int index);
+    bool cell_range(const QRectF& rect, int& colBeg, int& colEnd, int& rowBeg,
+                    int& rowEnd) const;  // False if spanning too many cells
+    qint64 cell_key(int col, int row) const;
+};
+
+/**
+ * Change of instance list, made of removal, insertion and modification
+ * applied in this order.
+ */
+struct InstanceChangeSet
+{
+    quint64 generation = 0;  // Generation of instance list after change
+    bool reset = false;      // Whole list replaced, no other fields are set
+
+    // Sorted indices, or index ranges of [first, last]
+    std::vector<size_t> removed;                      // In list before change
+    std::vector<std::pair<size_t, size_t>> inserted;  // In list after change
+    std::vector<size_t> modified;                     // In list after change
+
+    ican_mark::InstanceStore oldValues;  // Modified instances before and
+    ican_mark::InstanceStore newValues;  // after change
+
+    bool empty() const;
+    void insert_indices(const std::vector<size_t>& indList);
+};
+
+Q_DECLARE_METATYPE(InstanceChangeSet)
+
+class InstanceListModel : public QAbstractListModel
+{
+    Q_OBJECT
+
+   public:
+    InstanceListModel(const ican_mark::InstanceStore& annoList,
+                      const std::vector<std::string>& classNames,
+                      QObject* parent = nullptr);
+
+    /** Model interface, row text is formatted on demand */
+    int rowCount(const QModelIndex& parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex& index,
+                  int role = Qt::DisplayRole) const override;
+    bool setData(const QModelIndex& index, const QVariant& value,
+                 int role = Qt::EditRole) override;
+    Qt::ItemFlags flags(const QModelIndex& index) const override;
+
+    std::vector<size_t> checked_rows() const;
+
+    static QString format_instance(const ican_mark::Instance& inst);
+
+    /** Change notifications around resetting the instance list */
+    void begin_reset();
+    void end_reset();
+
+    /**
+     * Change notifications around the instance list being edited in one
+     * pass, with sorted indices after insertion or before removal. Edits of
+     * more than one range reset the model.
+     */
+    void begin_insert(const std::vector<size_t>& indList);
+    void end_insert();
+    void begin_remove(const std::vector<size_t>& indList);
+    void end_remove();
+    void rows_changed(int first, int last);
+    void class_names_changed();
+
+   protected:
+    const ican_mark::InstanceStore& annoList;
+    const std::vector<std::string>& classNames;
+
+    std::vector<bool> checkList;  // Check states of rows
+    int rows = 0;  // Row count seen by views, follows notifications
+
+    std::vector<size_t> editList;  // Indices of edit being notified
+    bool editReset = false;
+
+    QString format_row(int row) const;
+};
+
+class InputTrace
+{
+   public:
+    /** Trace event types other than QEvent ones */
+    enum Type : quint16
+    {
+        ViewChange = QEvent::User + 1,  // View center or scale set from slots
+        LabelChange                     // Marking label set from slots
+    };
+
+    struct Event
+    {
+        qint64 time = 0;  // Microseconds since recording started
+        quint16 type = 0;
+        quint32 button = 0;  // Mouse button, key code or label
+        quint32 buttons = 0;
+        quint32 modifiers = 0;
+        QPointF pos;        // Local position or view center
+        QPoint angleDelta;  // Wheel rotation
+        double scale = 0;   // View scale
+        QString text;       // Key text
+        bool autoRepeat = false;
+    };
+
+    /** View state and annotations of traced widget */
+    QString target;  // Class name
+    QSize viewSize;
+    QPointF viewCenter;
+    double viewScale = 1.0;
+    int label = 0;
+    QByteArray initMarks;   // .mark content when recording started
+    QByteArray finalMarks;  // .mark content when recording stopped
+
+    /** Recording */
+    void start();
+    void stop();
+    bool is_recording() const;
+    void record(const QEvent* event);
+    void record(const Event& event);
+    qint64 elapsed() const;
+    void clear();
+
+    const std::vector<Event>& events() const;
+
+    /** Rebuild recorded QEvent, nullptr for other types */
+    static std::unique_ptr<QEvent> make_event(const Event& event);
+
+    /** Compact binary trace file */
+    bool save(const QString& path);
+    bool load(const QString& path);
+    const QString& error_string() const;
+
+   protected:
+    QElapsedTimer clock;
+    std::vector<Event> eventList;
+    QString errMsg;
+};
+
 class ImageView : public QWidget
 {
     Q_OBJECT
@@ -26,18 +505,43 @@ class ImageView : public QWidget
    public:
     explicit ImageView(QWidget* parent = nullptr);
     virtual void reset(const QImage& image);
+    virtual void reset(const std::shared_ptr<ImageSource>& source);
+    virtual void reset(const std::shared_ptr<ImageResource>& resource);
+
+    /** Background image, shareable with other views */
+    const std::shared_ptr<ImageResource>& image_resource() const;
 
     /** View handling functions */
     virtual void zoom_to_fit();
 
+    /** Rendering statistics */
+    struct RenderStats
+    {
+        quint64 inputEvents = 0;  // Received mouse, wheel and key events
+        quint64 inputFolded = 0;  // Input events folded into later ones
+        quint64 paints = 0;       // Served paint events
+    };
+
+    const RenderStats& render_stats() const;
+    void reset_render_stats();
+
+    /** Input recording into trace, which should outlive recording */
+    virtual void start_trace(InputTrace* trace);
+    virtual void stop_trace();
+    virtual void replay_input(const InputTrace::Event& event);
+
+   protected slots:
+    void frame_tick();
+    void tiles_ready();
+
    protected:
     /** Member variables */
-    QImage bgImage;      // Background image
+    std::shared_ptr<ImageResource> resource;  // Background image
+    QSize imgSize;  // Size of background image
     QPointF viewCenter;  // The center point of background image on view space
     double viewScale = 1.0;  // Scaling ratio of view
 
-    QImage scaledImg;          // Scaled background image
-    double currentScale = -1;  // Scale ratio corresponding to scaledImg
+    quint64 bgRevision = 0;  // Increased on background content changed
 
     /** View handling functions */
     double find_fit_scale_ratio() const;
@@ -58,7 +562,7 @@ class ImageView : public QWidget
     T mapping_to_view(const T& data)
     {
         QPointF imgCtr =
-            QPointF(this->bgImage.width(), this->bgImage.height()) / 2;
+            QPointF(this->imgSize.width(), this->imgSize.height()) / 2;
         return this->scaling_to_view<T>(data - imgCtr) + this->viewCenter;
     }
 
@@ -76,12 +580,25 @@ class ImageView : public QWidget
     T mapping_to_image(const T& point)
     {
         QPointF imgCtr =
-            QPointF(this->bgImage.width(), this->bgImage.height()) / 2;
+            QPointF(this->imgSize.width(), this->imgSize.height()) / 2;
         return this->scaling_to_image<T>(point - this->viewCenter) + imgCtr;
     }
 
     /** Default drawing functions */
     void draw_background(const QColor& bgColor = QColor(0, 0, 0));
+    void draw_background(QPainter& painter,
+                         const QColor& bgColor = QColor(0, 0, 0));
+
+    /** Frame scheduling, paints at most once per display frame */
+    QTimer frameTimer;
+    QElapsedTimer frameClock;  // Time since last frame
+    bool inFrame = false;      // Requests are served by frame being updated
+    RenderStats renderStats;
+    InputTrace* inputTrace = nullptr;  // Recording trace
+
+    void request_frame();
+    virtual void frame_update();
+    void count_render_stats(QEvent* event);
 };
 
 class ImageMap : public ImageView
@@ -91,6 +608,8 @@ class ImageMap : public ImageView
    public:
     explicit ImageMap(QWidget* parent = nullptr);
     void reset(const QImage& image);
+    void reset(const std::shared_ptr<ImageSource>& source);
+    void reset(const std::shared_ptr<ImageResource>& resource);
 
    public slots:
     void set_select_region(const QRectF& selectRegion);
@@ -112,29 +631,69 @@ class ImageMap : public ImageView
     void draw_select_region();
 };
 
-class RBoxMarkWidget : public ImageView
+class RBoxMarkWidget : public ImageView, public MemoryBudget::Client
 {
     Q_OBJECT
 
    public:
     explicit RBoxMarkWidget(QWidget* parent = nullptr);
+    ~RBoxMarkWidget();
 
     /** Initialization and setup */
     void reset(const QImage& image);
-    void reset(const QImage& image,
-               const std::vector<ican_mark::Instance>& instList);
+    void reset(const QImage& image, const ican_mark::InstanceStore& instList);
+    void reset(const QImage& image, ican_mark::InstanceStore&& instList);
+    void reset(const std::shared_ptr<ImageSource>& source);
+    void reset(const std::shared_ptr<ImageSource>& source,
+               ican_mark::InstanceStore&& instList);
+    void reset(const std::shared_ptr<ImageResource>& resource);
+    void reset(const std::shared_ptr<ImageResource>& resource,
+               ican_mark::InstanceStore&& instList);
 
     /** View handling functions */
     void zoom_to_fit();
 
+    /** Input recording with marking state and annotations */
+    void start_trace(InputTrace* trace);
+    void stop_trace();
+    void replay_input(const InputTrace::Event& event);
+
     /** Data handling */
     int get_mark_label();
     int get_hl_instance_index();
 
     qreal get_scale_ratio();
 
-    const std::vector<ican_mark::Instance>& annotation_list();
+    const ican_mark::InstanceStore& annotation_list();
+    quint64 list_generation() const;  // Increased on every change
+
+    /**
+     * Batch editing of instances, each runs in one pass over the list with
+     * one history step and one change notification. Rotation and scaling
+     * centers are on image space.
+     */
     void delete_instances(const std::vector<size_t>& indList);
+    void relabel_instances(const std::vector<size_t>& indList, int label);
+    void translate_instances(const std::vector<size_t>& indList, double dx,
+                             double dy);
+    void rotate_instances(const std::vector<size_t>& indList, double degree,
+                          const QPointF& center);
+    void scale_instances(const std::vector<size_t>& indList, double factor,
+                         const QPointF& center);
+
+    /** Edit history of current image */
+    bool can_undo() const;
+    bool can_redo() const;
+    const ican_mark::EditHistory& edit_history() const;
+    void set_history_limit(size_t maxSteps, size_t maxBytes);
+
+    /** Oldest undo steps are dropped first, newest ones are always kept */
+    qint64 release_memory(qint64 bytes) override;
+    qint64 releasable_memory() const override;
+
+    InstanceListModel* instance_model();
+
+    int find_instance(const QPointF& pos);  // Find instance under view point
 
    public slots:
     void set_class_names(const std::vector<std::string>& classNames);
@@ -149,14 +708,21 @@ class RBoxMarkWidget : public ImageView
     void marking_revert();
     void marking_reset();
 
+    void undo();
+    void redo();
+
    signals:
     void markLabelChanged(int label);
     void hlInstanceIndexChanged(int index);
-    void instanceListChanged(const std::vector<ican_mark::Instance>& annoList);
+    void instanceListChanged(const ican_mark::InstanceStore& annoList);
+    void instancesChanged(const InstanceChangeSet& change);
     void scaleRatioChanged(qreal ratio);
     void selectRegionChanged(const QRectF& selRegion);
     void viewCenterChanged(const QPointF& viewCenter);
 
+   protected slots:
+    void collect_refined();
+
    protected:
     /** Style datatypes */
     struct StyleCrosshair
@@ -203,6 +769,9 @@ class RBoxMarkWidget : public ImageView
 
     QPointF mousePos;
     QPointF viewCtrCache;
+
+    std::unique_ptr<QMouseEvent> pendingMove;  // Latest folded mouse move
+    bool movePending = false;
     QRectF selRegion;  // Select region on image space
 
     qreal scaleStep = 0.1;
@@ -210,20 +779,75 @@ class RBoxMarkWidget : public ImageView
 
     int label = 0;                              // Current marking label
     int highlightInst = -1;                     // Index for highlighting
-    ican_mark::Instance curInst;                // Current marking instance
-    std::vector<ican_mark::Instance> annoList;  // Marked instances
-    std::vector<std::string> classNames;        // Class names
+    ican_mark::Instance curInst;          // Current marking instance
+    ican_mark::InstanceStore annoList;    // Marked instances
+    InstanceIndex annoIndex;              // Spatial index of annoList
+    InstanceListModel* annoModel;         // List model of annoList
+    ican_mark::EditHistory history;       // Undo and redo of annoList
+    quint64 generation = 0;               // Generation of annoList
+    std::vector<std::string> classNames;  // Class names
 
     Style style;  // Painting style
 
+    /** View states corresponding to a cached layer */
+    struct LayerView
+    {
+        QSize size;  // On device pixels
+        QPointF center;
+        double scale = -1;
+        quint64 revision = 0;  // Background revision, unused by annotations
+
+        bool operator==(const LayerView& other) const;
+        bool operator!=(const LayerView& other) const;
+    };
+
+    /** Cached layers */
+    QImage bgLayer;    // Rendered background image
+    QImage annoLayer;  // Rendered marked instances
+
+    LayerView bgView;        // View of background layer
+    bool bgRefined = false;  // Background layer rendered in high quality
+    LayerView annoView;      // View of annotation layer
+
+    bool annoLayerDirty = true;  // Set when marked instances need redrawing
+
+    /**
+     * High quality background rendered in background once view settles,
+     * while the layer of an earlier view is transformed as preview
+     */
+    class RefineJob;
+
+    struct Refined
+    {
+        int generation;
+        LayerView view;
+        QImage image;
+    };
+
+    QThreadPool refinePool;
+    std::atomic<int> refineGeneration;  // Increased on refinement cancelled
+    LayerView refineView;               // View of latest started refinement
+    QMutex refineMutex;
+    std::vector<Refined> refineList;  // Guarded by refineMutex
+    QTimer gestureTimer;              // Running while wheel zooming goes on
+
+    QHash<qint64, QStaticText> labelTextCache;  // Keyed by label, font size
+    const QStaticText& label_text(int label, int fontSize);
+
     /** Event handler */
     bool event(QEvent* event);
     void wheelEvent(QWheelEvent* event);
     void paintEvent(QPaintEvent* paintEvent);
     void resizeEvent(QResizeEvent* event);
+    void frame_update();
+
+    bool process_input(QEvent* event);
+    void flush_pending_move();
+    void trace_view_change();
 
     bool instance_marking(QEvent* event, bool& instListChanged);
     bool image_region_moving(QEvent* event, bool& viewCtrChanged);
+    bool instance_selecting(QEvent* event, bool& hlInstChanged);
 
     /** View handling functions */
     bool update_select_region();
@@ -238,13 +862,43 @@ class RBoxMarkWidget : public ImageView
                    const QPointF& pos2);
 
     /** Drawing functions */
-    void draw_aim_crosshair(const QPointF& center, double degree,
-                            const StyleCrosshair& style);
-    void draw_rotated_bbox(const ican_mark::Instance& inst,
-                           const StyleRBox& style);
-    void draw_anchor(const QPointF& pos, const StyleAnchor& style);
-
-    /** Instance handling */
+    void update_layers();
+    void account_memory();
+    void draw_bg_layer(QPainter& painter);
+    void draw_annotations(QPainter& painter);
+
+    bool in_gesture();
+    void start_refine(const LayerView& view);
+    void cancel_refine();
+
+    void draw_aim_crosshair(QPainter& painter, const QPointF& center,
+                            double degree, const StyleCrosshair& style);
+    void draw_rotated_bboxes(QPainter& painter,
+                             const std::vector<ican_mark::Instance>& instList,
+                             const StyleRBox& style);
+    void draw_anchor(QPainter& painter, const QPointF& pos,
+                     const StyleAnchor& style);
+
+    /** Reset instances and marking states after background changed */
+    void reset_marking(ican_mark::InstanceStore&& instList);
+
+    /** Instance handling, editing helpers take sorted and unique indices */
+    void apply_step(const ican_mark::EditHistory::Step& step, bool revert);
+    void edit_instances(const std::vector<size_t>& indList,
+                        const ican_mark::InstanceStore& instList);
+    void erase_instances(const std::vector<size_t>& indList,
+                         InstanceChangeSet& change);
+    void insert_instances(const std::vector<size_t>& indList,
+                          const ican_mark::InstanceStore& instList,
+                          InstanceChangeSet& change);
+    void modify_instances(const std::vector<size_t>& indList,
+                          const ican_mark::InstanceStore& instList,
+                          InstanceChangeSet& change);
+    void finish_edit(InstanceChangeSet& change, int oldHighlight);
+    void notify_change(InstanceChangeSet& change);
+    std::vector<size_t> sorted_indices(
+        const std::vector<size_t>& indList) const;
+    void invalidate_instance(const ican_mark::Instance& inst);
     bool inst_valid(const ican_mark::Instance& inst);
     void inst_reset_bbox(ican_mark::Instance& inst);
     void inst_reset(ican_mark::Instance& inst);
@@ -0,0 +1,142 @@
+#include "mark_widget.h"
+
+#include <algorithm>
+
+using namespace std;
+
+MemoryBudget::Client::Client(int priority) : prio(priority)
+{
+    MemoryBudget::instance().clientList.push_back(this);
+}
+
+MemoryBudget::Client::~Client()
+{
+    MemoryBudget& budget = MemoryBudget::instance();
+    for (int i = 0; i < CategoryCount; i++)
+    {
+        budget.total[i] -= this->usage[i];
+    }
+
+    budget.clientList.erase(
+        remove(budget.clientList.begin(), budget.clientList.end(), this),
+        budget.clientList.end());
+    budget.schedule();
+}
+
+qint64 MemoryBudget::Client::release_memory(qint64) { return 0; }
+qint64 MemoryBudget::Client::releasable_memory() const { return 0; }
+
+void MemoryBudget::Client::account(Category category, qint64 bytes)
+{
+    if (this->usage[category] == bytes)
+    {
+        return;
+    }
+
+    MemoryBudget& budget = MemoryBudget::instance();
+    budget.total[category] += bytes - this->usage[category];
+    this->usage[category] = bytes;
+    budget.schedule();
+}
+
+MemoryBudget::MemoryBudget()
+{
+    this->checkTimer.setSingleShot(true);
+    this->checkTimer.setInterval(0);
+    connect(&this->checkTimer, &QTimer::timeout, this, &MemoryBudget::enforce);
+}
+
+MemoryBudget& MemoryBudget::instance()
+{
+    static MemoryBudget budget;
+    return budget;
+}
+
+void MemoryBudget::set_limit(qint64 bytes)
+{
+    this->maxBytes = bytes;
+    this->schedule();
+}
+
+qint64 MemoryBudget::limit() const { return this->maxBytes; }
+
+qint64 MemoryBudget::usage() const
+{
+    qint64 bytes = 0;
+    for (int i = 0; i < CategoryCount; i++)
+    {
+        bytes += this->total[i];
+    }
+
+    return bytes;
+}
+
+qint64 MemoryBudget::usage(Category category) const
+{
+    return this->total[category];
+}
+
+QString MemoryBudget::category_name(Category category)
+{
+    switch (category)
+    {
+        case SourcePixels:
+            return "Source";
+        case ScaledPixels:
+            return "Scaled";
+        case Thumbnails:
+            return "Thumbnails";
+        case Annotations:
+            return "Annotations";
+        default:
+            return QString();
+    }
+}
+
+void MemoryBudget::schedule()
+{
+    if (!this->checkTimer.isActive())
+    {
+        this->checkTimer.start();
+    }
+}
+
+void MemoryBudget::enforce()
+{
+    qint64 releasable = 0;
+    for (const Client* client : this->clientList)
+    {
+        releasable += client->releasable_memory();
+    }
+
+    qint64 excess = this->usage() - this->maxBytes;
+    if (excess > 0 && excess <= releasable)
+    {
+        // Clients may unregister or report usage while releasing
+        vector<Client*> order = this->clientList;
+        stable_sort(order.begin(), order.end(),
+                    [](const Client* a, const Client* b)
+                    { return a->prio < b->prio; });
+
+        for (Client* client : order)
+        {
+            excess = this->usage() - this->maxBytes;
+            if (excess <= 0)
+            {
+                break;
+            }
+
+            if (find(this->clientList.begin(), this->clientList.end(),
+                     client) != this->clientList.end())
+            {
+                qint64 bytes = min(excess, client->releasable_memory());
+                if (bytes > 0)
+                {
+                    client->release_memory(bytes);
+                }
+            }
+        }
+    }
+
+    emit usageChanged();
+}
@@ -9,47 +9,146 @@
 #include <QFont>
 #include <QKeyEvent>
 #include <QMarginsF>
+#include <QMetaObject>
 #include <QMouseEvent>
+#include <QMutexLocker>
 #include <QPaintEvent>
+#include <QRunnable>
+#include <QTransform>
 #include <Qt>
 #include <QtMath>
 
+#include <mark_codec.hpp>
+
 using namespace std;
 using namespace ican_mark;
 
-RBoxMarkWidget::RBoxMarkWidget(QWidget* parent) : ImageView(parent)
+namespace
+{
+const size_t minUndoSteps = 16;     // Kept on releasing memory
+const size_t indexUpdateRatio = 8;  // Index is rebuilt if more are modified
+
+}  // namespace
+
+bool InstanceChangeSet::empty() const
+{
+    return !this->reset && this->removed.empty() && this->inserted.empty() &&
+           this->modified.empty();
+}
+
+void InstanceChangeSet::insert_indices(const vector<size_t>& indList)
+{
+    // Merge consecutive indices into ranges
+    for (size_t index : indList)
+    {
+        if (!this->inserted.empty() &&
+            this->inserted.back().second + 1 == index)
+        {
+            this->inserted.back().second = index;
+        }
+        else
+        {
+            this->inserted.push_back({index, index});
+        }
+    }
+}
+
+RBoxMarkWidget::RBoxMarkWidget(QWidget* parent)
+    : ImageView(parent), MemoryBudget::Client(MemoryBudget::HistoryPriority)
 {
     this->setMouseTracking(true);
     this->setCursor(Qt::BlankCursor);
+    qRegisterMetaType<InstanceChangeSet>();
+
+    this->annoModel =
+        new InstanceListModel(this->annoList, this->classNames, this);
 
     // Set default painting style
     this->style.rboxHL.lineWidth = 2;
     this->style.rboxHL.centerRad = 3;
+
+    // Background is refined in one thread, after wheel zooming pauses
+    this->refineGeneration = 0;
+    this->refinePool.setMaxThreadCount(1);
+    this->gestureTimer.setSingleShot(true);
+    this->gestureTimer.setInterval(150);
+    connect(&this->gestureTimer, &QTimer::timeout, this,
+            &RBoxMarkWidget::request_frame);
+}
+
+RBoxMarkWidget::~RBoxMarkWidget()
+{
+    this->cancel_refine();
+    this->refinePool.waitForDone();
 }
 
 void RBoxMarkWidget::reset(const QImage& image)
 {
-    this->reset(image, vector<Instance>());
+    this->reset(image, InstanceStore());
+}
+
+void RBoxMarkWidget::reset(const QImage& image, const InstanceStore& instList)
+{
+    this->reset(image, InstanceStore(instList));
 }
 
-void RBoxMarkWidget::reset(const QImage& image,
-                           const vector<Instance>& instList)
+void RBoxMarkWidget::reset(const QImage& image, InstanceStore&& instList)
 {
     // Call parent reset function
     ImageView::reset(image);
+    this->reset_marking(std::move(instList));
+}
 
+void RBoxMarkWidget::reset(const shared_ptr<ImageSource>& source)
+{
+    this->reset(source, InstanceStore());
+}
+
+void RBoxMarkWidget::reset(const shared_ptr<ImageSource>& source,
+                           InstanceStore&& instList)
+{
+    ImageView::reset(source);
+    this->reset_marking(std::move(instList));
+}
+
+void RBoxMarkWidget::reset(const shared_ptr<ImageResource>& resource)
+{
+    this->reset(resource, InstanceStore());
+}
+
+void RBoxMarkWidget::reset(const shared_ptr<ImageResource>& resource,
+                           InstanceStore&& instList)
+{
+    ImageView::reset(resource);
+    this->reset_marking(std::move(instList));
+}
+
+void RBoxMarkWidget::reset_marking(InstanceStore&& instList)
+{
     // Update view region
     this->update_select_region();
 
     // Reset marking state
-    this->annoList = instList;
+    this->annoModel->begin_reset();
+    this->annoList = std::move(instList);
+    this->annoModel->end_reset();
+    this->annoIndex.reset(this->annoList);
+    this->annoLayerDirty = true;
+    this->history.reset(this->annoList);
     this->markAction.reset();
     this->moveAction.reset();
 
+    // Layer of previous image is not for preview
+    this->bgLayer = QImage();
+    this->cancel_refine();
+
     // Repaint and raise signal
-    this->repaint();
+    this->request_frame();
+
+    InstanceChangeSet change;
+    change.reset = true;
+    this->notify_change(change);
 
-    emit instanceListChanged(this->annoList);
     emit scaleRatioChanged(this->viewScale);
     emit viewCenterChanged(this->viewCenter);
     emit selectRegionChanged(this->selRegion);
@@ -58,16 +157,69 @@ void RBoxMarkWidget::reset(const QImage& image,
 void RBoxMarkWidget::zoom_to_fit()
 {
     ImageView::zoom_to_fit();
-    this->repaint();
+    this->request_frame();
+    this->trace_view_change();
 
     emit scaleRatioChanged(this->viewScale);
     emit viewCenterChanged(this->viewCenter);
     emit selectRegionChanged(this->selRegion);
 }
 
+void RBoxMarkWidget::start_trace(InputTrace* trace)
+{
+    // Start from idle marking state for the trace to be replayable
+    this->flush_pending_move();
+    this->markAction.reset();
+    this->moveAction.reset();
+    this->request_frame();
+
+    ImageView::start_trace(trace);
+
+    string buf;
+    MarkCodec::encode(buf, this->annoList);
+    trace->label = this->label;
+    trace->initMarks = QByteArray(buf.data(), (int)buf.size());
+}
+
+void RBoxMarkWidget::stop_trace()
+{
+    if (this->inputTrace)
+    {
+        this->flush_pending_move();
+
+        string buf;
+        MarkCodec::encode(buf, this->annoList);
+        this->inputTrace->finalMarks = QByteArray(buf.data(), (int)buf.size());
+    }
+
+    ImageView::stop_trace();
+}
+
+void RBoxMarkWidget::replay_input(const InputTrace::Event& event)
+{
+    switch (event.type)
+    {
+        case InputTrace::ViewChange:
+            this->set_scale_ratio(event.scale);
+            this->set_view_center(event.pos);
+            break;
+
+        case InputTrace::LabelChange:
+            this->set_mark_label((int)event.button);
+            break;
+
+        default:
+            ImageView::replay_input(event);
+            break;
+    }
+}
+
 void RBoxMarkWidget::set_class_names(const std::vector<std::string>& classNames)
 {
     this->classNames = classNames;
+    this->annoModel->class_names_changed();
+    this->labelTextCache.clear();
+    this->annoLayerDirty = true;
 }
 
 int RBoxMarkWidget::get_mark_label() { return this->label; }
@@ -76,7 +228,16 @@ void RBoxMarkWidget::set_mark_label(int label)
     if (this->label != label)
     {
         this->label = label;
-        this->repaint();
+        this->request_frame();
+
+        if (this->inputTrace)
+        {
+            InputTrace::Event event;
+            event.type = InputTrace::LabelChange;
+            event.button = label;
+            this->inputTrace->record(event);
+        }
+
         emit markLabelChanged(this->label);
     }
 }
@@ -87,7 +248,8 @@ void RBoxMarkWidget::set_hl_instance_index(int index)
     if (this->highlightInst != index)
     {
         this->highlightInst = index;
-        this->repaint();
+        this->annoLayerDirty = true;
+        this->request_frame();
         emit hlInstanceIndexChanged(this->highlightInst);
     }
 }
@@ -107,8 +269,11 @@ void RBoxMarkWidget::set_scale_ratio(qreal ratio)
         selRegionChanged = this->update_select_region();
     }
 
-    // Repaint and raise signals
-    this->repaint();
+    // Repaint and raise signals, repeated changes from slots are gestures
+    // too, like keyboard moving or dragging on image map
+    if (scaleChanged) this->gestureTimer.start();
+    this->request_frame();
+    if (scaleChanged) this->trace_view_change();
 
     if (scaleChanged) emit scaleRatioChanged(this->viewScale);
     if (viewCtrChanged) emit viewCenterChanged(this->viewCenter);
@@ -120,7 +285,10 @@ void RBoxMarkWidget::set_view_center(const QPointF& viewCenter)
     bool viewCtrChanged = this->update_view_center(viewCenter);
     bool selRegionChanged = this->update_select_region();
 
-    this->repaint();
+    if (viewCtrChanged) this->gestureTimer.start();
+    this->request_frame();
+    if (viewCtrChanged) this->trace_view_change();
+
     if (viewCtrChanged) emit viewCenterChanged(this->viewCenter);
     if (selRegionChanged) emit selectRegionChanged(this->selRegion);
 }
@@ -128,7 +296,7 @@ void RBoxMarkWidget::set_view_center(const QPointF& viewCenter)
 void RBoxMarkWidget::set_select_center(const QPointF& selCenter)
 {
     this->set_view_center(this->mapping_to_view(
-        (QPointF(this->bgImage.width(), this->bgImage.height()) / 2) -
+        (QPointF(this->imgSize.width(), this->imgSize.height()) / 2) -
         selCenter +
         this->mapping_to_image(QPointF(this->width(), this->height()) / 2)));
 }
@@ -141,68 +309,232 @@ void RBoxMarkWidget::move_view_region(int dx, int dy)
 void RBoxMarkWidget::marking_revert()
 {
     this->markAction.revert();
-    this->repaint();
+    this->request_frame();
 }
 
 void RBoxMarkWidget::marking_reset()
 {
     this->markAction.reset();
-    this->repaint();
+    this->request_frame();
 }
 
-const vector<Instance>& RBoxMarkWidget::annotation_list()
+const InstanceStore& RBoxMarkWidget::annotation_list()
 {
     return this->annoList;
 }
 
+InstanceListModel* RBoxMarkWidget::instance_model() { return this->annoModel; }
+
 void RBoxMarkWidget::delete_instances(const vector<size_t>& indList)
 {
-    if (indList.size())
+    vector<size_t> indSort = this->sorted_indices(indList);
+    if (indSort.empty())
+    {
+        return;
+    }
+
+    int oldHighlight = this->highlightInst;
+    InstanceChangeSet change;
+    this->history.remove(indSort);
+    this->erase_instances(indSort, change);
+    this->finish_edit(change, oldHighlight);
+}
+
+void RBoxMarkWidget::relabel_instances(const vector<size_t>& indList,
+                                       int label)
+{
+    vector<size_t> indSort = this->sorted_indices(indList);
+    InstanceStore instList = this->annoList.subset(indSort);
+    for (size_t i = 0; i < instList.size(); i++)
+    {
+        Instance inst = instList[i];
+        inst.set_label(label);
+        instList.set(i, inst);
+    }
+
+    this->edit_instances(indSort, instList);
+}
+
+void RBoxMarkWidget::translate_instances(const vector<size_t>& indList,
+                                         double dx, double dy)
+{
+    vector<size_t> indSort = this->sorted_indices(indList);
+    InstanceStore instList = this->annoList.subset(indSort);
+    instList.translate(dx, dy);
+    this->edit_instances(indSort, instList);
+}
+
+void RBoxMarkWidget::rotate_instances(const vector<size_t>& indList,
+                                      double degree, const QPointF& center)
+{
+    vector<size_t> indSort = this->sorted_indices(indList);
+    InstanceStore instList = this->annoList.subset(indSort);
+    instList.rotate(degree, center.x(), center.y());
+    this->edit_instances(indSort, instList);
+}
+
+void RBoxMarkWidget::scale_instances(const vector<size_t>& indList,
+                                     double factor, const QPointF& center)
+{
+    vector<size_t> indSort = this->sorted_indices(indList);
+    InstanceStore instList = this->annoList.subset(indSort);
+    instList.scale(factor, center.x(), center.y());
+    this->edit_instances(indSort, instList);
+}
+
+quint64 RBoxMarkWidget::list_generation() const { return this->generation; }
+
+bool RBoxMarkWidget::can_undo() const { return this->history.can_undo(); }
+
+bool RBoxMarkWidget::can_redo() const { return this->history.can_redo(); }
+
+const EditHistory& RBoxMarkWidget::edit_history() const
+{
+    return this->history;
+}
+
+void RBoxMarkWidget::set_history_limit(size_t maxSteps, size_t maxBytes)
+{
+    this->history.set_limit(maxSteps, maxBytes);
+}
+
+qint64 RBoxMarkWidget::release_memory(qint64 bytes)
+{
+    qint64 released = this->history.release(bytes, minUndoSteps);
+    this->account_memory();
+    return released;
+}
+
+qint64 RBoxMarkWidget::releasable_memory() const
+{
+    return this->history.releasable_memory(minUndoSteps);
+}
+
+void RBoxMarkWidget::undo()
+{
+    const EditHistory::Step* step = this->history.undo();
+    if (step)
+    {
+        this->apply_step(*step, true);
+    }
+}
+
+void RBoxMarkWidget::redo()
+{
+    const EditHistory::Step* step = this->history.redo();
+    if (step)
+    {
+        this->apply_step(*step, false);
+    }
+}
+
+int RBoxMarkWidget::find_instance(const QPointF& pos)
+{
+    return this->annoIndex.hit_test(this->mapping_to_image(pos),
+                                    this->annoList);
+}
+
+bool RBoxMarkWidget::event(QEvent* event)
+{
+    this->count_render_stats(event);
+
+    // Fold consecutive mouse moves into the latest one, which is processed
+    // right before next frame or next non-move event
+    if (event->type() == QEvent::MouseMove)
     {
-        vector<size_t> indSort = indList;
-        sort(indSort.begin(), indSort.end());
-        for (auto i = indSort.rbegin(); i != indSort.rend(); i++)
+        QMouseEvent* me = static_cast<QMouseEvent*>(event);
+        if (this->pendingMove)
         {
-            if ((int)*i == this->highlightInst)
-            {
-                this->highlightInst = -1;
-            }
+            *this->pendingMove = *me;
+        }
+        else
+        {
+            this->pendingMove.reset(new QMouseEvent(*me));
+        }
 
-            this->annoList.erase(this->annoList.begin() + *i);
+        if (this->movePending)
+        {
+            this->renderStats.inputFolded++;
         }
 
-        this->repaint();
-        emit instanceListChanged(this->annoList);
+        this->movePending = true;
+        this->request_frame();
+        return true;
+    }
+
+    this->flush_pending_move();
+    if (this->process_input(event))
+    {
+        return true;
+    }
+    else
+    {
+        return QWidget::event(event);
     }
 }
 
-bool RBoxMarkWidget::event(QEvent* event)
+void RBoxMarkWidget::frame_update()
+{
+    this->flush_pending_move();
+    ImageView::frame_update();
+}
+
+void RBoxMarkWidget::flush_pending_move()
+{
+    if (this->movePending)
+    {
+        this->movePending = false;
+        this->process_input(this->pendingMove.get());
+    }
+}
+
+void RBoxMarkWidget::trace_view_change()
+{
+    // View changes from slots, e.g. image map or keyboard moving
+    if (this->inputTrace)
+    {
+        InputTrace::Event event;
+        event.type = InputTrace::ViewChange;
+        event.pos = this->viewCenter;
+        event.scale = this->viewScale;
+        this->inputTrace->record(event);
+    }
+}
+
+bool RBoxMarkWidget::process_input(QEvent* event)
 {
     bool ret = false;
     bool viewCtrChanged = false;
     bool selRegionChanged = false;
     bool instListChanged = false;
+    bool hlInstChanged = false;
 
     ret |= this->instance_marking(event, instListChanged);
     ret |= this->image_region_moving(event, viewCtrChanged);
+    ret |= this->instance_selecting(event, hlInstChanged);
 
     selRegionChanged = this->update_select_region();
 
     if (ret)
     {
-        this->repaint();
+        this->request_frame();
 
         // Raise signals
         if (viewCtrChanged) emit viewCenterChanged(this->viewCenter);
         if (selRegionChanged) emit selectRegionChanged(this->selRegion);
-        if (instListChanged) emit instanceListChanged(this->annoList);
+        if (instListChanged)
+        {
+            // Marking appends one instance
+            InstanceChangeSet change;
+            size_t last = this->annoList.size() - 1;
+            change.inserted.push_back({last, last});
+            this->notify_change(change);
+        }
 
-        return ret;
-    }
-    else
-    {
-        return QWidget::event(event);
+        if (hlInstChanged) emit hlInstanceIndexChanged(this->highlightInst);
     }
+
+    return ret;
 }
 
 void RBoxMarkWidget::wheelEvent(QWheelEvent* event)
@@ -238,7 +570,10 @@ void RBoxMarkWidget::wheelEvent(QWheelEvent* event)
         selRegionChanged = this->update_select_region();
     }
 
-    // Raise signal
+    // Repaint with preview until zooming pauses
+    this->gestureTimer.start();
+    this->request_frame();
+
     if (scaleChanged) emit scaleRatioChanged(this->viewScale);
     if (viewCtrChanged) emit viewCenterChanged(this->viewCenter);
     if (selRegionChanged) emit selectRegionChanged(this->selRegion);
@@ -248,38 +583,30 @@ void RBoxMarkWidget::paintEvent(QPaintEvent* paintEvent)
 {
     (void)paintEvent;
 
-    // Paint background
-    this->draw_background();
+    // Compose cached background and marked instances
+    this->update_layers();
+
+    QPainter painter(this);
+    this->draw_bg_layer(painter);
+    painter.drawImage(QPointF(0, 0), this->annoLayer);
 
     // Draw aim crosshair
     double instDegree =
         this->curInst.has_degree() ? this->curInst.get_degree() : 0;
-    this->draw_aim_crosshair(this->mousePos, instDegree, this->style.crosshair);
+    this->draw_aim_crosshair(painter, this->mousePos, instDegree,
+                             this->style.crosshair);
     if (static_cast<RBoxMark::State>(this->markAction.state()) ==
         RBoxMark::State::INIT)
     {
         if (static_cast<TwiceClick::State>(
-                this->markAction["degree"].state()) ==
+                this->markAction[RBoxMarkKey::DEGREE].state()) ==
             TwiceClick::State::POS1_FIN)
         {
-            this->draw_anchor(
-                this->mapping_to_view(
-                    this->markAction["degree"]["pos1"]["release"]),
-                this->style.anchor);
-        }
-    }
-
-    // Draw marked instances
-    for (int i = 0; i < (int)this->annoList.size(); i++)
-    {
-        const Instance& anno = this->annoList[i];
-        if (i == this->highlightInst)
-        {
-            this->draw_rotated_bbox(anno, this->style.rboxHL);
-        }
-        else
-        {
-            this->draw_rotated_bbox(anno, this->style.rbox);
+            const QPointF& anchor =
+                this->markAction[RBoxMarkKey::DEGREE][TwiceClickKey::POS1]
+                                [ClickKey::RELEASE];
+            this->draw_anchor(painter, this->mapping_to_view(anchor),
+                              this->style.anchor);
         }
     }
 
@@ -289,7 +616,8 @@ void RBoxMarkWidget::paintEvent(QPaintEvent* paintEvent)
     {
         if (this->inst_valid(this->curInst))
         {
-            this->draw_rotated_bbox(this->curInst, this->style.rbox);
+            this->draw_rotated_bboxes(painter, {this->curInst},
+                                      this->style.rbox);
         }
     }
 }
@@ -338,13 +666,15 @@ bool RBoxMarkWidget::instance_marking(QEvent* event, bool& instListChanged)
         case RBoxMark::State::INIT:
 
             if (static_cast<TwiceClick::State>(
-                    this->markAction["degree"].state()) ==
+                    this->markAction[RBoxMarkKey::DEGREE].state()) ==
                 TwiceClick::State::POS1_FIN)
             {
                 // Calculate and set degree
+                const QPointF& anchor =
+                    this->markAction[RBoxMarkKey::DEGREE][TwiceClickKey::POS1]
+                                    [ClickKey::RELEASE];
                 this->curInst.set_degree(this->find_degree(
-                    this->markAction["degree"]["pos1"]["release"],
-                    this->mapping_to_image(this->mousePos)));
+                    anchor, this->mapping_to_image(this->mousePos)));
             }
             else
             {
@@ -357,12 +687,14 @@ bool RBoxMarkWidget::instance_marking(QEvent* event, bool& instListChanged)
         case RBoxMark::State::DEGREE_FIN:
 
             if (static_cast<TwiceClick::State>(
-                    this->markAction["bbox"].state()) ==
+                    this->markAction[RBoxMarkKey::BBOX].state()) ==
                 TwiceClick::State::POS1_FIN)
             {
                 // Fill bounding box
-                this->fill_bbox(this->curInst,
-                                this->markAction["bbox"]["pos1"]["release"],
+                const QPointF& anchor =
+                    this->markAction[RBoxMarkKey::BBOX][TwiceClickKey::POS1]
+                                    [ClickKey::RELEASE];
+                this->fill_bbox(this->curInst, anchor,
                                 this->mapping_to_image(this->mousePos));
             }
             else
@@ -376,7 +708,12 @@ bool RBoxMarkWidget::instance_marking(QEvent* event, bool& instListChanged)
         case RBoxMark::State::BBOX_FIN:
 
             // Append instance to annotation list
+            this->annoModel->begin_insert({this->annoList.size()});
             this->annoList.push_back(this->curInst);
+            this->annoModel->end_insert();
+            this->annoIndex.append(this->curInst);
+            this->history.insert({this->annoList.size() - 1}, {this->curInst});
+            this->annoLayerDirty = true;
             instListChanged = true;
 
             this->inst_reset(this->curInst);
@@ -422,7 +759,8 @@ bool RBoxMarkWidget::image_region_moving(QEvent* event, bool& viewCtrChanged)
         case ClickAction::State::PRESS:
             viewCtrChanged = this->update_view_center(
                 this->viewCtrCache -
-                (this->moveAction["press"] - this->moveAction["move"]));
+                (this->moveAction[ClickKey::PRESS] -
+                 this->moveAction[ClickKey::MOVE]));
             break;
 
         case ClickAction::State::RELEASE:
@@ -433,6 +771,31 @@ bool RBoxMarkWidget::image_region_moving(QEvent* event, bool& viewCtrChanged)
     return ret;
 }
 
+bool RBoxMarkWidget::instance_selecting(QEvent* event, bool& hlInstChanged)
+{
+    bool ret = false;
+
+    // Select instance under cursor with right click
+    if (event->type() == QEvent::MouseButtonPress)
+    {
+        QMouseEvent* me = static_cast<QMouseEvent*>(event);
+        if (me->button() == Qt::MouseButton::RightButton)
+        {
+            int index = this->find_instance(me->localPos());
+            if (this->highlightInst != index)
+            {
+                this->highlightInst = index;
+                this->annoLayerDirty = true;
+                hlInstChanged = true;
+            }
+
+            ret = true;
+        }
+    }
+
+    return ret;
+}
+
 bool RBoxMarkWidget::update_select_region()
 {
     QRectF newSelRegion =
@@ -462,7 +825,7 @@ bool RBoxMarkWidget::update_view_center(const QPointF& newCenter)
     int height = this->height();
 
     QPointF halfImSize = this->scaling_to_view(QPointF(
-                             this->bgImage.width(), this->bgImage.height())) /
+                             this->imgSize.width(), this->imgSize.height())) /
                          2.0;
     int halfImWidth = halfImSize.x();
     int halfImHeight = halfImSize.y();
@@ -590,15 +953,295 @@ void RBoxMarkWidget::fill_bbox(Instance& inst, const QPointF& pos1,
     inst.set_h(h);
 }
 
-void RBoxMarkWidget::draw_aim_crosshair(const QPointF& center, double degree,
+bool RBoxMarkWidget::LayerView::operator==(const LayerView& other) const
+{
+    return this->size == other.size && this->center == other.center &&
+           this->scale == other.scale && this->revision == other.revision;
+}
+
+bool RBoxMarkWidget::LayerView::operator!=(const LayerView& other) const
+{
+    return !(*this == other);
+}
+
+class RBoxMarkWidget::RefineJob : public QRunnable
+{
+   public:
+    RefineJob(RBoxMarkWidget* widget, int generation, const LayerView& view,
+              qreal dpr, vector<ImagePyramid::Patch>&& patchList)
+        : widget(widget),
+          generation(generation),
+          view(view),
+          dpr(dpr),
+          patchList(std::move(patchList))
+    {
+    }
+
+    void run() override
+    {
+        QImage image(this->view.size, QImage::Format_RGB32);
+        image.fill(Qt::black);
+
+        QPainter painter(&image);
+        painter.setRenderHint(QPainter::SmoothPixmapTransform);
+        for (const ImagePyramid::Patch& patch : this->patchList)
+        {
+            if (this->widget->refineGeneration != this->generation)
+            {
+                return;
+            }
+
+            this->draw_patch(painter, patch);
+        }
+
+        painter.end();
+        image.setDevicePixelRatio(this->dpr);
+
+        QMutexLocker locker(&this->widget->refineMutex);
+        this->widget->refineList.push_back(
+            {this->generation, this->view, image});
+        QMetaObject::invokeMethod(this->widget, "collect_refined",
+                                  Qt::QueuedConnection);
+    }
+
+   private:
+    RBoxMarkWidget* widget;
+    int generation;
+    LayerView view;
+    qreal dpr;
+    vector<ImagePyramid::Patch> patchList;
+
+    void draw_patch(QPainter& painter, const ImagePyramid::Patch& patch)
+    {
+        // Target on device pixels, rounded edges keep neighbors seamless
+        QRectF target(patch.target.topLeft() * this->dpr,
+                      patch.target.size() * this->dpr);
+        int left = qRound(target.left());
+        int top = qRound(target.top());
+        QRect dst(left, top, qRound(target.right()) - left,
+                  qRound(target.bottom()) - top);
+
+        QRect src = patch.source.toAlignedRect() & patch.image.rect();
+        if (dst.isEmpty() || src.isEmpty() || dst.width() > src.width() ||
+            dst.height() > src.height())
+        {
+            painter.drawImage(target, patch.image, patch.source);
+            return;
+        }
+
+        // Area averaging, reading source region in place if possible
+        const QImage& img = patch.image;
+        QImage region =
+            (img.depth() == 32 || img.format() == QImage::Format_Grayscale8)
+                ? QImage(img.constScanLine(src.top()) +
+                             src.left() * (img.depth() / 8),
+                         src.width(), src.height(), img.bytesPerLine(),
+                         img.format())
+                : img.copy(src);
+        painter.drawImage(dst.topLeft(),
+                          ImageScaler::scaled(region, dst.size(), 1));
+    }
+};
+
+void RBoxMarkWidget::update_layers()
+{
+    qreal dpr = this->devicePixelRatioF();
+    LayerView view;
+    view.size = this->size() * dpr;
+    view.center = this->viewCenter;
+    view.scale = this->viewScale;
+    view.revision = this->bgRevision;
+
+    // Render background in place if no earlier layer can be transformed
+    if (this->bgLayer.size() != view.size)
+    {
+        this->bgLayer = QImage(view.size, QImage::Format_RGB32);
+        this->bgLayer.setDevicePixelRatio(dpr);
+
+        QPainter painter(&this->bgLayer);
+        this->draw_background(painter);
+
+        this->bgView = view;
+        this->bgRefined = false;
+    }
+
+    // Refine background once view settles, and drop refinements of views
+    // passed by during gestures
+    if (this->in_gesture())
+    {
+        if (this->refineView != LayerView() && this->refineView != view)
+        {
+            this->cancel_refine();
+        }
+    }
+    else if ((this->bgView != view || !this->bgRefined) &&
+             this->refineView != view)
+    {
+        this->start_refine(view);
+    }
+
+    // Redraw marked instances on current view
+    view.revision = 0;
+    if (this->annoView != view)
+    {
+        if (this->annoLayer.size() != view.size)
+        {
+            this->annoLayer =
+                QImage(view.size, QImage::Format_ARGB32_Premultiplied);
+            this->annoLayer.setDevicePixelRatio(dpr);
+        }
+
+        this->annoView = view;
+        this->annoLayerDirty = true;
+    }
+
+    if (this->annoLayerDirty)
+    {
+        this->annoLayer.fill(Qt::transparent);
+
+        QPainter painter(&this->annoLayer);
+        this->draw_annotations(painter);
+
+        this->annoLayerDirty = false;
+    }
+
+    this->account_memory();
+}
+
+void RBoxMarkWidget::account_memory()
+{
+    // History changes with edits, which are always followed by repainting
+    this->account(MemoryBudget::ScaledPixels,
+                  (qint64)this->bgLayer.bytesPerLine() *
+                      this->bgLayer.height());
+    this->account(MemoryBudget::Annotations,
+                  (qint64)this->history.memory_usage() +
+                      (qint64)this->annoLayer.bytesPerLine() *
+                          this->annoLayer.height());
+}
+
+void RBoxMarkWidget::draw_bg_layer(QPainter& painter)
+{
+    if (this->bgView.center == this->viewCenter &&
+        this->bgView.scale == this->viewScale)
+    {
+        painter.drawImage(QPointF(0, 0), this->bgLayer);
+        return;
+    }
+
+    // Preview with layer of earlier view mapped onto current view, and area
+    // not covered by it sampled fast from pyramid
+    double factor = this->viewScale / this->bgView.scale;
+    QTransform transform =
+        QTransform::fromTranslate(-this->bgView.center.x(),
+                                  -this->bgView.center.y()) *
+        QTransform::fromScale(factor, factor) *
+        QTransform::fromTranslate(this->viewCenter.x(), this->viewCenter.y());
+
+    QRectF viewRect(QPointF(0, 0), QSizeF(this->size()));
+    if (!transform.mapRect(viewRect).contains(viewRect))
+    {
+        this->draw_background(painter);
+    }
+
+    painter.save();
+    painter.setTransform(transform, true);
+    painter.drawImage(QPointF(0, 0), this->bgLayer);
+    painter.restore();
+}
+
+bool RBoxMarkWidget::in_gesture()
+{
+    return this->gestureTimer.isActive() ||
+           static_cast<ClickAction::State>(this->moveAction.state()) ==
+               ClickAction::State::PRESS;
+}
+
+void RBoxMarkWidget::start_refine(const LayerView& view)
+{
+    this->cancel_refine();
+    this->refineView = view;
+
+    // Tiles are looked up here, the job draws from shared images only
+    vector<ImagePyramid::Patch> patchList;
+    if (this->resource)
+    {
+        patchList = this->resource->pyramid().patches(
+            QRectF(QPointF(0, 0), QSizeF(this->size())), this->viewCenter,
+            this->viewScale, this);
+    }
+
+    this->refinePool.start(new RefineJob(this, this->refineGeneration, view,
+                                         this->devicePixelRatioF(),
+                                         std::move(patchList)));
+}
+
+void RBoxMarkWidget::cancel_refine()
+{
+    this->refineGeneration++;
+    this->refinePool.clear();
+    this->refineView = LayerView();
+}
+
+void RBoxMarkWidget::collect_refined()
+{
+    vector<Refined> refList;
+    {
+        QMutexLocker locker(&this->refineMutex);
+        refList.swap(this->refineList);
+    }
+
+    // Results of cancelled refinements are dropped
+    for (Refined& refined : refList)
+    {
+        if (refined.generation != this->refineGeneration ||
+            refined.view.size != this->bgLayer.size())
+        {
+            continue;
+        }
+
+        this->bgLayer = refined.image;
+        this->bgView = refined.view;
+        this->bgRefined = true;
+        this->request_frame();
+    }
+}
+
+void RBoxMarkWidget::draw_annotations(QPainter& painter)
+{
+    // Find marked instances inside view region
+    vector<int> visibleList = this->annoIndex.query(
+        this->mapping_to_image(QRectF(0, 0, this->width(), this->height())));
+
+    // Group instances by style
+    vector<Instance> normalList;
+    vector<Instance> hlList;
+    normalList.reserve(visibleList.size());
+    for (int i : visibleList)
+    {
+        if (i == this->highlightInst)
+        {
+            hlList.push_back(this->annoList[i]);
+        }
+        else
+        {
+            normalList.push_back(this->annoList[i]);
+        }
+    }
+
+    this->draw_rotated_bboxes(painter, normalList, this->style.rbox);
+    this->draw_rotated_bboxes(painter, hlList, this->style.rboxHL);
+}
+
+void RBoxMarkWidget::draw_aim_crosshair(QPainter& painter,
+                                        const QPointF& center, double degree,
                                         const StyleCrosshair& style)
 {
     int width = this->width();
     int height = this->height();
 
-    // Setup painter and drawing style
-    QPainter painter(this);
-
+    // Setup drawing style
+    painter.save();
     painter.setRenderHint(style.rendHint);
     painter.setCompositionMode(style.compMode);
     painter.setPen(QPen(style.penColor, style.lineWidth));
@@ -617,73 +1260,384 @@ void RBoxMarkWidget::draw_aim_crosshair(const QPointF& center, double degree,
     // Draw aim crosshair
     painter.drawLine(line1);
     painter.drawLine(line2);
+    painter.restore();
 }
 
-void RBoxMarkWidget::draw_rotated_bbox(const Instance& inst,
-                                       const StyleRBox& style)
+void RBoxMarkWidget::draw_rotated_bboxes(QPainter& painter,
+                                         const vector<Instance>& instList,
+                                         const StyleRBox& style)
 {
-    // Setup painter and drawing style
-    QPainter painter(this);
+    struct Geometry
+    {
+        QPointF center;  // Center point on view space
+        double degree;
+        double halfWidth, halfHeight;  // Half size on view space
+        int label;
+    };
 
+    if (instList.empty())
+    {
+        return;
+    }
+
+    // Find geometries and edges of bounding boxes on view space in one pass
+    vector<Geometry> geoList(instList.size());
+    vector<QLineF> edgeList(instList.size() * 4);
+    for (size_t i = 0; i < instList.size(); i++)
+    {
+        const Instance& inst = instList[i];
+        Geometry& geo = geoList[i];
+
+        geo.center = this->mapping_to_view(QPointF(inst.get_x(), inst.get_y()));
+        geo.degree = inst.has_degree() ? inst.get_degree() : 0;
+        geo.halfWidth = this->scaling_to_view(inst.get_w() / 2);
+        geo.halfHeight = this->scaling_to_view(inst.get_h() / 2);
+        geo.label = inst.get_label();
+
+        double rad = qDegreesToRadians(-geo.degree);
+        QPointF axisX(geo.halfWidth * cos(rad), geo.halfWidth * sin(rad));
+        QPointF axisY(-geo.halfHeight * sin(rad), geo.halfHeight * cos(rad));
+
+        QPointF p0 = geo.center - axisX - axisY;
+        QPointF p1 = geo.center + axisX - axisY;
+        QPointF p2 = geo.center + axisX + axisY;
+        QPointF p3 = geo.center - axisX + axisY;
+
+        edgeList[i * 4 + 0] = QLineF(p0, p1);
+        edgeList[i * 4 + 1] = QLineF(p1, p2);
+        edgeList[i * 4 + 2] = QLineF(p2, p3);
+        edgeList[i * 4 + 3] = QLineF(p3, p0);
+    }
+
+    // Setup drawing style
+    painter.save();
     painter.setRenderHint(style.rendHint);
     painter.setCompositionMode(style.compMode);
     painter.setPen(QPen(style.penColor, style.lineWidth));
 
-    // Draw center point
-    QPointF center = this->mapping_to_view(QPointF(inst.get_x(), inst.get_y()));
+    // Draw rotated bounding boxes and center points
+    painter.drawLines(edgeList.data(), (int)edgeList.size());
     if (style.centerRad > 0)
     {
-        painter.drawEllipse(center, style.centerRad, style.centerRad);
+        for (const Geometry& geo : geoList)
+        {
+            painter.drawEllipse(geo.center, style.centerRad, style.centerRad);
+        }
     }
 
-    // Draw rotated bounding box
-    double degree = inst.has_degree() ? inst.get_degree() : 0;
-    double halfWidth = inst.get_w() / 2;
-    double halfHeight = inst.get_h() / 2;
+    // Draw labels grouped by class
+    QFont font = painter.font();
+    font.setPixelSize(style.fontSize);
+    font.setBold(true);
+    painter.setFont(font);
 
-    QTransform transform;
-    transform.translate(center.x(), center.y());
-    transform.rotate(-degree);
-    painter.setTransform(transform);
+    vector<int> order(geoList.size());
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        order[i] = (int)i;
+    }
 
-    QRectF boxRect(this->scaling_to_view(QPointF(-halfWidth, -halfHeight)),
-                   this->scaling_to_view(QPointF(halfWidth, halfHeight)));
-    painter.drawRect(boxRect);
+    stable_sort(order.begin(), order.end(), [&](int a, int b)
+                { return geoList[a].label < geoList[b].label; });
 
-    // Draw label
-    int instLabel = inst.get_label();
-    string labelStr = to_string(instLabel);
-    if (instLabel < (int)this->classNames.size())
+    QTransform baseTransform = painter.transform();
+    int halfLineWidth = style.lineWidth / 2;
+    for (int i : order)
     {
-        labelStr += string(": ") + this->classNames[instLabel];
-    }
+        const Geometry& geo = geoList[i];
 
-    QRectF labelRect(
-        boxRect.topLeft() + QPoint(style.lineWidth / 2, style.lineWidth / 2),
-        QSizeF(boxRect.width() - style.lineWidth, style.fontSize + 15));
+        QTransform transform;
+        transform.translate(geo.center.x(), geo.center.y());
+        transform.rotate(-geo.degree);
+        painter.setTransform(transform * baseTransform);
 
-    QFont font = painter.font();
-    font.setPixelSize(style.fontSize);
-    font.setBold(true);
-    painter.setFont(font);
+        QRectF labelRect(
+            QPointF(halfLineWidth - geo.halfWidth,
+                    halfLineWidth - geo.halfHeight),
+            QSizeF(geo.halfWidth * 2 - style.lineWidth, style.fontSize + 15));
+        painter.fillRect(labelRect, QColor(255, 255, 255, 64));
 
-    painter.fillRect(labelRect, QColor(255, 255, 255, 64));
-    painter.drawText(labelRect.marginsRemoved(QMarginsF(5, 5, 5, 5)),
-                     Qt::AlignVCenter | Qt::AlignLeft, labelStr.c_str(),
-                     &labelRect);
+        QRectF textRect = labelRect.marginsRemoved(QMarginsF(5, 5, 5, 5));
+        if (textRect.width() <= 0)
+        {
+            continue;
+        }
+
+        const QStaticText& text = this->label_text(geo.label, style.fontSize);
+        QSizeF textSize = text.size();
+        QPointF textPos(textRect.left(),
+                        textRect.top() +
+                            (textRect.height() - textSize.height()) / 2);
+        if (textSize.width() > textRect.width())
+        {
+            // Clip label to the box only if it overflows
+            painter.save();
+            painter.setClipRect(textRect);
+            painter.drawStaticText(textPos, text);
+            painter.restore();
+        }
+        else
+        {
+            painter.drawStaticText(textPos, text);
+        }
+    }
+
+    painter.restore();
 }
 
-void RBoxMarkWidget::draw_anchor(const QPointF& pos, const StyleAnchor& style)
+const QStaticText& RBoxMarkWidget::label_text(int label, int fontSize)
 {
-    // Setup painter and drawing style
-    QPainter painter(this);
+    qint64 key = ((qint64)label << 16) | (fontSize & 0xffff);
+    auto it = this->labelTextCache.find(key);
+    if (it == this->labelTextCache.end())
+    {
+        string labelStr = to_string(label);
+        if (label >= 0 && label < (int)this->classNames.size())
+        {
+            labelStr += string(": ") + this->classNames[label];
+        }
+
+        QStaticText text(QString::fromStdString(labelStr));
+        text.setTextFormat(Qt::PlainText);
+        text.setPerformanceHint(QStaticText::AggressiveCaching);
+        it = this->labelTextCache.insert(key, text);
+    }
+
+    return it.value();
+}
 
+void RBoxMarkWidget::draw_anchor(QPainter& painter, const QPointF& pos,
+                                 const StyleAnchor& style)
+{
+    // Setup drawing style
+    painter.save();
     painter.setRenderHint(style.rendHint);
     painter.setCompositionMode(style.compMode);
     painter.setPen(QPen(style.penColor, style.lineWidth));
 
     // Draw anchor point
     painter.drawEllipse(pos, style.radius, style.radius);
+    painter.restore();
+}
+
+void RBoxMarkWidget::notify_change(InstanceChangeSet& change)
+{
+    change.generation = ++this->generation;
+    emit instancesChanged(change);
+    emit instanceListChanged(this->annoList);
+}
+
+void RBoxMarkWidget::apply_step(const EditHistory::Step& step, bool revert)
+{
+    // Instances are restored from snapshot of the target state
+    const InstanceSeq& source = revert ? step.before : step.after;
+    const vector<size_t>& indList = step.indList;
+    if (indList.empty())
+    {
+        return;
+    }
+
+    int oldHighlight = this->highlightInst;
+    InstanceChangeSet change;
+    if ((step.type == EditHistory::Step::INSERT) == revert &&
+        step.type != EditHistory::Step::MODIFY)
+    {
+        this->erase_instances(indList, change);
+    }
+    else
+    {
+        InstanceStore instList;
+        instList.reserve(indList.size());
+        for (size_t index : indList)
+        {
+            instList.push_back(source.at(index));
+        }
+
+        if (step.type == EditHistory::Step::MODIFY)
+        {
+            this->modify_instances(indList, instList, change);
+        }
+        else
+        {
+            this->insert_instances(indList, instList, change);
+        }
+    }
+
+    this->finish_edit(change, oldHighlight);
+}
+
+void RBoxMarkWidget::edit_instances(const vector<size_t>& indList,
+                                    const InstanceStore& instList)
+{
+    if (indList.empty())
+    {
+        return;
+    }
+
+    int oldHighlight = this->highlightInst;
+    InstanceChangeSet change;
+    this->history.modify(indList, instList);
+    this->modify_instances(indList, instList, change);
+    this->finish_edit(change, oldHighlight);
+}
+
+void RBoxMarkWidget::erase_instances(const vector<size_t>& indList,
+                                     InstanceChangeSet& change)
+{
+    // Index entries are popped if erased from the tail
+    bool atTail = (indList.front() == this->annoList.size() - indList.size());
+    if (atTail)
+    {
+        for (size_t i = 0; i < indList.size(); i++)
+        {
+            this->annoIndex.pop_back();
+        }
+    }
+
+    for (size_t index : indList)
+    {
+        this->invalidate_instance(this->annoList[index]);
+    }
+
+    // Highlighted instance follows its shifted index. It is set after views
+    // are notified, as they may move their current rows meanwhile.
+    int highlight = this->highlightInst;
+    if (highlight >= 0)
+    {
+        auto it =
+            lower_bound(indList.begin(), indList.end(), (size_t)highlight);
+        if (it != indList.end() && *it == (size_t)highlight)
+        {
+            highlight = -1;
+        }
+        else
+        {
+            highlight -= (int)(it - indList.begin());
+        }
+    }
+
+    this->annoModel->begin_remove(indList);
+    this->annoList.erase(indList);
+    this->annoModel->end_remove();
+    this->highlightInst = highlight;
+    if (!atTail)
+    {
+        this->annoIndex.reset(this->annoList);
+    }
+
+    change.removed = indList;
+}
+
+void RBoxMarkWidget::insert_instances(const vector<size_t>& indList,
+                                      const InstanceStore& instList,
+                                      InstanceChangeSet& change)
+{
+    bool atTail = (indList.front() == this->annoList.size());
+    int highlight = this->highlightInst;
+    for (size_t index : indList)
+    {
+        if (highlight >= (int)index)
+        {
+            highlight++;
+        }
+    }
+
+    this->annoModel->begin_insert(indList);
+    this->annoList.insert(indList, instList);
+    this->annoModel->end_insert();
+    this->highlightInst = highlight;
+    for (size_t i = 0; i < instList.size(); i++)
+    {
+        if (atTail) this->annoIndex.append(instList[i]);
+        this->invalidate_instance(instList[i]);
+    }
+
+    if (!atTail)
+    {
+        this->annoIndex.reset(this->annoList);
+    }
+
+    change.insert_indices(indList);
+}
+
+void RBoxMarkWidget::modify_instances(const vector<size_t>& indList,
+                                      const InstanceStore& instList,
+                                      InstanceChangeSet& change)
+{
+    change.modified = indList;
+    change.oldValues = this->annoList.subset(indList);
+    change.newValues = instList;
+
+    for (size_t i = 0; i < indList.size(); i++)
+    {
+        this->invalidate_instance(this->annoList[indList[i]]);
+        this->annoList.set(indList[i], instList[i]);
+        this->invalidate_instance(instList[i]);
+    }
+
+    // Relabeling keeps bounding boxes, and few moved instances are updated
+    // in place
+    if (indList.size() * indexUpdateRatio < this->annoList.size())
+    {
+        for (size_t i = 0; i < indList.size(); i++)
+        {
+            this->annoIndex.update((int)indList[i], instList[i]);
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < indList.size(); i++)
+        {
+            if (InstanceIndex::bounding_rect(change.oldValues[i]) !=
+                InstanceIndex::bounding_rect(instList[i]))
+            {
+                this->annoIndex.reset(this->annoList);
+                break;
+            }
+        }
+    }
+
+    this->annoModel->rows_changed((int)indList.front(), (int)indList.back());
+}
+
+void RBoxMarkWidget::finish_edit(InstanceChangeSet& change, int oldHighlight)
+{
+    this->request_frame();
+
+    this->notify_change(change);
+    if (this->highlightInst != oldHighlight)
+    {
+        emit hlInstanceIndexChanged(this->highlightInst);
+    }
+}
+
+vector<size_t> RBoxMarkWidget::sorted_indices(
+    const vector<size_t>& indList) const
+{
+    vector<size_t> ret;
+    ret.reserve(indList.size());
+    for (size_t index : indList)
+    {
+        if (index < this->annoList.size())
+        {
+            ret.push_back(index);
+        }
+    }
+
+    sort(ret.begin(), ret.end());
+    ret.erase(unique(ret.begin(), ret.end()), ret.end());
+    return ret;
+}
+
+void RBoxMarkWidget::invalidate_instance(const Instance& inst)
+{
+    // Redraw annotation layer only if instance is inside view region
+    QRectF viewRect =
+        this->mapping_to_image(QRectF(0, 0, this->width(), this->height()));
+    if (InstanceIndex::bounding_rect(inst).intersects(viewRect))
+    {
+        this->annoLayerDirty = true;
+    }
 }
 
 bool RBoxMarkWidget::inst_valid(const Instance& inst)
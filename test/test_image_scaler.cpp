@@ -0,0 +1,142 @@
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <QImage>
+#include <QSize>
+
+#include <mark_widget.h>
+
+using namespace std;
+
+#define check(cond)                                                   \
+    if (!(cond))                                                      \
+    {                                                                 \
+        throw runtime_error(string("Check failed: ") + #cond + " (" + \
+                            to_string(__LINE__) + ")");               \
+    }
+
+QImage make_image(const QSize& size, QImage::Format format, uint32_t seed)
+{
+    // Noise with one-pixel lines, which catches misplaced weights
+    QImage image(size, format);
+    for (int y = 0; y < size.height(); y++)
+    {
+        uchar* line = image.scanLine(y);
+        for (int i = 0; i < image.bytesPerLine(); i++)
+        {
+            seed = seed * 1664525u + 1013904223u;
+            line[i] = (y % 13 == 0) ? 255 : (uchar)(seed >> 24);
+        }
+    }
+
+    return image;
+}
+
+bool same_pixels(const QImage& lhs, const QImage& rhs)
+{
+    if (lhs.size() != rhs.size() || lhs.format() != rhs.format())
+    {
+        return false;
+    }
+
+    int lineBytes = lhs.width() * (lhs.format() == QImage::Format_Grayscale8
+                                       ? 1
+                                       : 4);
+    for (int y = 0; y < lhs.height(); y++)
+    {
+        if (memcmp(lhs.constScanLine(y), rhs.constScanLine(y), lineBytes) != 0)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int main()
+try
+{
+    vector<ImageScaler::Isa> isaList;
+    if (ImageScaler::best_isa() >= ImageScaler::SSE41)
+    {
+        isaList.push_back(ImageScaler::SSE41);
+    }
+
+    if (ImageScaler::best_isa() >= ImageScaler::AVX2)
+    {
+        isaList.push_back(ImageScaler::AVX2);
+    }
+
+    vector<QImage::Format> formatList = {QImage::Format_ARGB32,
+                                         QImage::Format_ARGB32_Premultiplied,
+                                         QImage::Format_Grayscale8};
+
+    // Widths off multiples of 16 for vector tails, and ratios from near 1
+    // to large, mostly non-integer
+    struct Case
+    {
+        QSize src;
+        QSize dst;
+    };
+
+    vector<Case> caseList = {
+        {{517, 301}, {211, 97}},  {{517, 301}, {259, 151}},
+        {{517, 301}, {516, 300}}, {{517, 301}, {37, 301}},
+        {{333, 65}, {7, 3}},      {{64, 64}, {32, 32}},
+        {{1023, 17}, {341, 1}},   {{19, 250}, {1, 83}}};
+
+    int compared = 0;
+    for (QImage::Format format : formatList)
+    {
+        for (size_t i = 0; i < caseList.size(); i++)
+        {
+            const Case& test = caseList[i];
+            QImage image = make_image(test.src, format, (uint32_t)i);
+            QImage expect =
+                ImageScaler::scaled(image, test.dst, 1, ImageScaler::Scalar);
+            check(expect.size() == test.dst);
+
+            // Bands split by threads are independent
+            check(same_pixels(expect, ImageScaler::scaled(
+                                          image, test.dst, 3,
+                                          ImageScaler::Scalar)));
+
+            for (ImageScaler::Isa isa : isaList)
+            {
+                check(same_pixels(expect,
+                                  ImageScaler::scaled(image, test.dst, 1, isa)));
+                check(same_pixels(expect,
+                                  ImageScaler::scaled(image, test.dst, 4, isa)));
+                compared++;
+            }
+        }
+    }
+
+    // Averaging keeps flat images flat
+    QImage flat(QSize(301, 173), QImage::Format_Grayscale8);
+    flat.fill(77);
+    QImage small = ImageScaler::scaled(flat, QSize(43, 29), 1);
+    for (int y = 0; y < small.height(); y++)
+    {
+        for (int x = 0; x < small.width(); x++)
+        {
+            check(small.constScanLine(y)[x] == 77);
+        }
+    }
+
+    cout << "Compared " << compared << " SIMD results with scalar" << endl;
+    cout << "Image scaler test passed" << endl;
+    return 0;
+}
+catch (exception& ex)
+{
+    cout << endl;
+    cout << "Error!" << endl;
+    cout << ex.what() << endl;
+    cout << endl;
+    return -1;
+}
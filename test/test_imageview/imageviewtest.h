@@ -14,10 +14,10 @@ class ImageViewTest : public ImageView
    public:
     explicit ImageViewTest(QWidget* parent = nullptr) : ImageView(parent)
     {
-        this->bgImage = QImage("color_map.png");
+        this->reset(QImage("color_map.png"));
         this->viewScale = 1.0;
         this->viewCenter =
-            QPointF(this->bgImage.width() / 2, this->bgImage.height() / 2);
+            QPointF(this->imgSize.width() / 2, this->imgSize.height() / 2);
     }
 
    protected:
@@ -0,0 +1,106 @@
+#include <exception>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+
+#include <QPointF>
+#include <QRectF>
+
+#include <mark_instance.hpp>
+#include <mark_widget.h>
+
+using namespace std;
+using namespace ican_mark;
+
+#define check(cond)                                                   \
+    if (!(cond))                                                      \
+    {                                                                 \
+        throw runtime_error(string("Check failed: ") + #cond + " (" + \
+                            to_string(__LINE__) + ")");               \
+    }
+
+int main()
+try
+{
+    mt19937 rng(3);
+    uniform_real_distribution<double> unit(0, 1);
+    auto make_inst = [&]()
+    {
+        // Few instances are large enough to be kept apart from cells
+        double scale = (unit(rng) < 0.05) ? 3000 : 60;
+        Instance inst;
+        inst.set_label(1);
+        inst.set_degree(unit(rng) * 360);
+        inst.set_x(unit(rng) * 5000);
+        inst.set_y(unit(rng) * 5000);
+        inst.set_w(unit(rng) * scale + 1);
+        inst.set_h(unit(rng) * scale + 1);
+        return inst;
+    };
+
+    InstanceStore instList;
+    for (int i = 0; i < 2000; i++)
+    {
+        instList.push_back(make_inst());
+    }
+
+    InstanceIndex index;
+    index.reset(instList);
+
+    // Edited index answers as one rebuilt from scratch
+    for (int i = 0; i < 1000; i++)
+    {
+        int op = (int)(rng() % 10);
+        if (op < 6)
+        {
+            size_t pos = rng() % instList.size();
+            Instance inst = make_inst();
+            if (op == 0)
+            {
+                // Relabeling keeps geometry
+                inst = instList[pos];
+                inst.set_label(2);
+            }
+
+            instList.set(pos, inst);
+            index.update((int)pos, inst);
+        }
+        else if (op < 8)
+        {
+            Instance inst = make_inst();
+            instList.push_back(inst);
+            index.append(inst);
+        }
+        else
+        {
+            instList.erase(vector<size_t>{instList.size() - 1});
+            index.pop_back();
+        }
+
+        InstanceIndex expect;
+        expect.reset(instList);
+
+        for (int j = 0; j < 8; j++)
+        {
+            QRectF rect(unit(rng) * 5000, unit(rng) * 5000, unit(rng) * 800,
+                        unit(rng) * 800);
+            check(index.query(rect) == expect.query(rect));
+
+            QPointF pos(unit(rng) * 5000, unit(rng) * 5000);
+            check(index.hit_test(pos, instList) ==
+                  expect.hit_test(pos, instList));
+        }
+    }
+
+    cout << "Instance index test passed" << endl;
+    return 0;
+}
+catch (exception& ex)
+{
+    cout << endl;
+    cout << "Error!" << endl;
+    cout << ex.what() << endl;
+    cout << endl;
+    return -1;
+}
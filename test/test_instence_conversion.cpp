@@ -1,6 +1,8 @@
+#include <cmath>
 #include <exception>
 #include <fstream>
 #include <iostream>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
@@ -9,6 +11,15 @@
 using namespace std;
 using namespace ican_mark;
 
+#define check(cond)                                                   \
+    if (!(cond))                                                      \
+    {                                                                 \
+        throw runtime_error(string("Check failed: ") + #cond + " (" + \
+                            to_string(__LINE__) + ")");               \
+    }
+
+bool close_to(double a, double b) { return fabs(a - b) < 1e-9; }
+
 int main()
 try
 {
@@ -47,6 +58,55 @@ try
     node = YAML::LoadFile("test.mark");
     instList = node.as<vector<Instance>>();
 
+    InstanceStore instStore = node.as<InstanceStore>();
+    cout << "Instance store size: " << instStore.size() << endl;
+    cout << "Instance size: " << sizeof(Instance) << endl;
+    if (instStore.to_vector() != instList)
+    {
+        throw runtime_error("Instance store conversion mismatched");
+    }
+
+    // Bulk transforms on columns
+    Instance boxA, boxB;
+    boxA.set_degree(0);
+    boxA.set_x(10);
+    boxA.set_y(20);
+    boxA.set_w(4);
+    boxA.set_h(2);
+    boxB.set_x(100);
+    boxB.set_y(100);
+    boxB.set_w(2);
+    boxB.set_h(2);
+
+    InstanceStore boxes = {boxA, boxB};
+    boxes.translate(1, 1);
+    check(boxes[0].get_x() == 11 && boxes[0].get_y() == 21);
+
+    boxes.rotate(90);
+    check(close_to(boxes[0].get_x(), 21) && close_to(boxes[0].get_y(), -11));
+    check(close_to(boxes[1].get_x(), 101) && close_to(boxes[1].get_y(), -101));
+    check(boxes[1].has_degree() && boxes[1].get_degree() == 90);
+
+    boxes.scale(2, 1, -1);
+    check(close_to(boxes[0].get_x(), 41) && close_to(boxes[0].get_y(), -21));
+    check(boxes[0].get_w() == 8 && boxes[0].get_h() == 4);
+    check(close_to(boxes[1].get_x(), 201) && close_to(boxes[1].get_y(), -201));
+
+    // Rotated box A spans 4 by 8 around (41, -21)
+    check(boxes.cull(30, -30, 50, -10) == vector<size_t>({0}));
+    check(boxes.cull(43.5, -30, 50, -10).empty());
+    check(boxes.cull(0, -300, 300, 0).size() == 2);
+
+    // Iterating values
+    size_t count = 0;
+    for (Instance box : boxes)
+    {
+        check(box == boxes[count]);
+        count++;
+    }
+
+    check(count == boxes.size());
+
     return 0;
 }
 catch (exception& ex)
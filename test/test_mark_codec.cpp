@@ -0,0 +1,120 @@
+#include <cmath>
+#include <exception>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+
+#include <mark_codec.hpp>
+#include <mark_instance.hpp>
+
+using namespace std;
+using namespace ican_mark;
+
+#define check(cond)                                                   \
+    if (!(cond))                                                      \
+    {                                                                 \
+        throw runtime_error(string("Check failed: ") + #cond + " (" + \
+                            to_string(__LINE__) + ")");               \
+    }
+
+InstanceStore make_list(int count, bool partial)
+{
+    mt19937 rng(0);
+    uniform_real_distribution<double> pos(0, 4096);
+    uniform_real_distribution<double> size(16, 96);
+    uniform_real_distribution<double> degree(-180, 180);
+    uniform_int_distribution<int> label(0, 3);
+    uniform_int_distribution<int> mask(0, 63);
+
+    InstanceStore ret;
+    for (int i = 0; i < count; i++)
+    {
+        Instance inst;
+        inst.set_label(label(rng));
+        inst.set_degree(degree(rng));
+        inst.set_x(pos(rng));
+        inst.set_y(pos(rng));
+        inst.set_w(size(rng));
+        inst.set_h(size(rng));
+
+        if (partial)
+        {
+            int flag = mask(rng);
+            if (flag & 0x01) inst.clear_label();
+            if (flag & 0x02) inst.clear_degree();
+            if (flag & 0x04) inst.clear_x();
+            if (flag & 0x08) inst.clear_y();
+            if (flag & 0x10) inst.clear_w();
+            if (flag & 0x20) inst.clear_h();
+        }
+
+        ret.push_back(inst);
+    }
+
+    return ret;
+}
+
+string yaml_encode(const InstanceStore& instList)
+{
+    YAML::Node node;
+    node = instList;
+
+    YAML::Emitter out;
+    out << node;
+    return out.c_str();
+}
+
+int main()
+try
+{
+    // Byte compatibility with yaml-cpp emitter
+    InstanceStore special = make_list(4, false);
+    Instance inst = special[0];
+    inst.set_x(NAN);
+    inst.set_y(INFINITY);
+    inst.set_w(-INFINITY);
+    inst.set_h(-0.0);
+    inst.set_degree(1e20);
+    special.push_back(inst);
+    special.push_back(Instance());
+
+    for (const InstanceStore& instList :
+         {InstanceStore(), special, make_list(1000, true)})
+    {
+        string buf;
+        MarkCodec::encode(buf, instList);
+        check(buf == yaml_encode(instList));
+
+        // Compare with re-encoded content for NaN values
+        string reBuf;
+        MarkCodec::encode(reBuf, MarkCodec::decode(buf));
+        check(reBuf == buf);
+    }
+
+    // Content outside fast path
+    string content =
+        "# Comment\n"
+        "- label: 0\n"
+        "  degree: 90 # (degree)\n"
+        "  x: 0\n"
+        "  segment:\n"
+        "    - [x: 0, y: 0]\n"
+        "- {label: 1, x: 2.5}\n";
+    InstanceStore decoded = MarkCodec::decode(content);
+    check(decoded.size() == 2);
+    check(decoded[0].get_degree() == 90);
+    check(decoded[1].get_x() == 2.5);
+
+    cout << "Mark codec test passed" << endl;
+
+    return 0;
+}
+catch (exception& ex)
+{
+    cout << endl;
+    cout << "Error!" << endl;
+    cout << ex.what() << endl;
+    cout << endl;
+    return -1;
+}
@@ -0,0 +1,193 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <mark_dataset.hpp>
+#include <mark_instance.hpp>
+
+using namespace std;
+using namespace ican_mark;
+
+#define check(cond)                                                   \
+    if (!(cond))                                                      \
+    {                                                                 \
+        throw runtime_error(string("Check failed: ") + #cond + " (" + \
+                            to_string(__LINE__) + ")");               \
+    }
+
+InstanceStore make_list(int count, double base)
+{
+    InstanceStore ret;
+    for (int i = 0; i < count; i++)
+    {
+        Instance inst;
+        inst.set_label(i % 3);
+        inst.set_degree(base + i * 0.1);
+        inst.set_x(base * 3.3 + i);
+        inst.set_y(base / 7.0);
+        if (i % 2 == 0)
+        {
+            inst.set_w(5.5);
+            inst.set_h(1.0 / 3.0);
+        }
+
+        ret.push_back(inst);
+    }
+
+    return ret;
+}
+
+int main()
+try
+{
+    const string path = "test.dataset";
+    remove(path.c_str());
+
+    {
+        DatasetStore store(path);
+        store.put("a.png", make_list(3, 1.5));
+        store.put("b.png", make_list(5, 2.5));
+        store.put("c.png", InstanceStore());
+        store.put("a.png", make_list(2, 9.25));
+        store.remove("b.png");
+
+        check(store.size() == 2);
+        check(store.get("a.png") == make_list(2, 9.25));
+        check(store.get("c.png").empty());
+    }
+
+    // Reopen and check records being rebuilt from log
+    {
+        DatasetStore store(path);
+        check(store.size() == 2);
+        check(!store.contains("b.png"));
+        check(store.get("a.png") == make_list(2, 9.25));
+        cout << "Garbage ratio: " << store.garbage_ratio() << endl;
+
+        store.compact();
+        check(store.garbage_ratio() == 0);
+        check(store.get("a.png") == make_list(2, 9.25));
+    }
+
+    // Interrupted writing should be dropped
+    {
+        ofstream fWriter(path, ios::binary | ios::app);
+        fWriter << "\x20\x00\x00\x00garbage";
+    }
+
+    {
+        DatasetStore store(path);
+        check(store.size() == 2);
+        store.put("d.png", make_list(4, 0.5));
+
+        // Conversion with .mark files
+        store.export_mark("d.png", "test.mark");
+        store.import_mark("e.png", "test.mark");
+        check(store.get("e.png") == store.get("d.png"));
+    }
+
+    // Damaged record in middle of file is skipped without rewriting file
+    {
+        remove(path.c_str());
+        DatasetStore store(path);
+        for (int i = 0; i < 10; i++)
+        {
+            store.put("k" + to_string(i) + ".png", make_list(1, i));
+        }
+    }
+
+    size_t fileSize;
+    {
+        fstream fEditor(path, ios::binary | ios::in | ios::out);
+        fEditor.seekg(0, ios::end);
+        fileSize = (size_t)fEditor.tellg();
+        fEditor.seekg(100);
+        char byte = (char)(fEditor.get() ^ 0x01);
+        fEditor.seekp(100);
+        fEditor.put(byte);
+    }
+
+    bool thrown = false;
+    try
+    {
+        DatasetStore store(path);
+    }
+    catch (runtime_error&)
+    {
+        thrown = true;
+    }
+
+    check(thrown);
+
+    {
+        DatasetStore store(path, true);
+        check(store.size() == 9);
+        check(store.damaged_size() > 0);
+        check(store.get("k9.png") == make_list(1, 9));
+    }
+
+    {
+        ifstream fReader(path, ios::binary | ios::ate);
+        check((size_t)fReader.tellg() == fileSize);
+    }
+
+    // Garbage in middle of a large store is skipped, and resynchronizing
+    // should not checksum at every byte
+    const int largeCount = 4000;
+    {
+        remove(path.c_str());
+        DatasetStore store(path);
+        for (int i = 0; i < largeCount; i++)
+        {
+            store.put("k" + to_string(i) + ".png", make_list(100, i));
+        }
+    }
+
+    {
+        fstream fEditor(path, ios::binary | ios::in | ios::out);
+        fEditor.seekg(0, ios::end);
+        fileSize = (size_t)fEditor.tellg();
+        fEditor.seekp(fileSize / 2);
+
+        uint32_t seed = 1;
+        for (int i = 0; i < (64 << 10); i++)
+        {
+            seed = seed * 1664525u + 1013904223u;
+            fEditor.put((char)(seed >> 24));
+        }
+    }
+
+    {
+        auto start = chrono::steady_clock::now();
+        DatasetStore store(path, true);
+        chrono::duration<double> cost = chrono::steady_clock::now() - start;
+        cout << "Damaged store of " << fileSize << " bytes opened in "
+             << cost.count() << " s" << endl;
+
+        // Only records overlapped by garbage are lost
+        size_t lost = (64 << 10) / (fileSize / largeCount) + 2;
+        check(store.damaged_size() >= (64 << 10));
+        check(store.size() < largeCount);
+        check(store.size() >= largeCount - lost);
+        check(store.get("k0.png") == make_list(100, 0));
+        check(store.get("k" + to_string(largeCount - 1) + ".png") ==
+              make_list(100, largeCount - 1));
+    }
+
+    cout << "Dataset store test passed" << endl;
+    return 0;
+}
+catch (exception& ex)
+{
+    cout << endl;
+    cout << "Error!" << endl;
+    cout << ex.what() << endl;
+    cout << endl;
+    return -1;
+}
@@ -0,0 +1,180 @@
+#include <exception>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <mark_history.hpp>
+#include <mark_instance.hpp>
+
+using namespace std;
+using namespace ican_mark;
+
+#define check(cond)                                                   \
+    if (!(cond))                                                      \
+    {                                                                 \
+        throw runtime_error(string("Check failed: ") + #cond + " (" + \
+                            to_string(__LINE__) + ")");               \
+    }
+
+Instance make_instance(int id)
+{
+    Instance inst;
+    inst.set_label(id % 4);
+    inst.set_degree(id * 0.5);
+    inst.set_x(id);
+    inst.set_y(id * 2.0);
+    inst.set_w(10);
+    inst.set_h(20);
+    return inst;
+}
+
+int main()
+try
+{
+    // Persistent sequence against plain store
+    mt19937 rng(0);
+    InstanceStore ref;
+    for (int i = 0; i < 100; i++)
+    {
+        ref.push_back(make_instance(i));
+    }
+
+    InstanceSeq seq(ref);
+    InstanceSeq snapshot = seq;
+    check(seq.to_store() == ref);
+
+    for (int i = 0; i < 1000; i++)
+    {
+        int op = rng() % 3;
+        if (op == 0 || ref.empty())
+        {
+            size_t index = rng() % (ref.size() + 1);
+            ref.insert(index, make_instance(1000 + i));
+            seq.insert(index, make_instance(1000 + i));
+        }
+        else if (op == 1)
+        {
+            size_t index = rng() % ref.size();
+            ref.erase(index);
+            seq.erase(index);
+        }
+        else
+        {
+            size_t index = rng() % ref.size();
+            ref.set(index, make_instance(2000 + i));
+            seq.set(index, make_instance(2000 + i));
+        }
+    }
+
+    check(seq.size() == ref.size());
+    check(seq.to_store() == ref);
+    check(snapshot.size() == 100);
+    check(snapshot.at(42) == make_instance(42));
+
+    // Bulk insertion to sorted indices
+    InstanceStore merged = {make_instance(1), make_instance(3)};
+    merged.insert({0, 2, 4}, {make_instance(0), make_instance(2),
+                              make_instance(4)});
+    check(merged.size() == 5);
+    for (int i = 0; i < 5; i++)
+    {
+        check(merged[i] == make_instance(i));
+    }
+
+    // Gathering selection
+    InstanceStore picked = merged.subset({1, 3});
+    check(picked == InstanceStore({make_instance(1), make_instance(3)}));
+
+    // Undo and redo
+    EditHistory history(3);
+    InstanceStore base = {make_instance(0), make_instance(1)};
+    history.reset(base);
+
+    history.insert({2}, {make_instance(2)});
+    history.remove({0, 2});
+    history.modify({0}, {make_instance(9)});
+    check(history.current().to_store() == InstanceStore({make_instance(9)}));
+
+    const EditHistory::Step* step = history.undo();
+    check(step && step->type == EditHistory::Step::MODIFY);
+    check(step->before.at(0) == make_instance(1));
+
+    step = history.undo();
+    check(step && step->type == EditHistory::Step::REMOVE);
+    check(step->before.at(2) == make_instance(2));
+    check(history.current().size() == 3);
+
+    step = history.redo();
+    check(step && step->type == EditHistory::Step::REMOVE);
+    check(history.current().to_store() == InstanceStore({make_instance(1)}));
+
+    // New edit drops undone steps, and cap drops oldest ones
+    history.insert({0}, {make_instance(5)});
+    history.insert({0}, {make_instance(6)});
+    check(!history.can_redo());
+    check(history.step_count() == 3);
+    check(history.memory_usage() > 0);
+
+    while (history.undo())
+    {
+    }
+
+    InstanceStore first = {make_instance(0), make_instance(1),
+                           make_instance(2)};
+    check(history.current().to_store() == first);
+
+    // Releasing memory drops applied steps only
+    check(history.release(1) == 0);
+    history.redo();
+    size_t used = history.memory_usage();
+    size_t freed = history.release(1);
+    check(freed > 0 && history.memory_usage() == used - freed);
+    check(history.step_count() == 2 && !history.can_undo());
+
+    history.clear();
+    check(history.memory_usage() == 0);
+
+    // Dropping undone steps releases their nodes during next edit, which
+    // must not be priced into the new step
+    InstanceStore many;
+    vector<size_t> allInd;
+    for (int i = 0; i < 200; i++)
+    {
+        many.push_back(make_instance(i));
+        allInd.push_back(i);
+    }
+
+    EditHistory dropping;
+    dropping.reset(InstanceStore());
+    for (int i = 0; i < 5; i++)
+    {
+        dropping.insert({0}, {make_instance(i)});
+    }
+
+    dropping.insert(allInd, many);
+    dropping.remove(allInd);
+    dropping.undo();
+    dropping.undo();
+    dropping.insert({0}, {make_instance(7)});
+    check(dropping.step_count() == 6 && dropping.can_undo());
+    check(dropping.memory_usage() < (1 << 20));
+
+    // Newest steps can be kept on releasing
+    size_t releasable = dropping.releasable_memory(2);
+    check(releasable > 0 && releasable < dropping.memory_usage());
+    check(dropping.release(dropping.memory_usage(), 2) == releasable);
+    check(dropping.step_count() == 2 && dropping.releasable_memory(2) == 0);
+
+    cout << "Mark history test passed" << endl;
+    return 0;
+}
+catch (exception& ex)
+{
+    cout << endl;
+    cout << "Error!" << endl;
+    cout << ex.what() << endl;
+    cout << endl;
+    return -1;
+}
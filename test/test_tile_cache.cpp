@@ -0,0 +1,107 @@
+#include <atomic>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QImage>
+#include <QThread>
+
+#include <mark_widget.h>
+
+using namespace std;
+
+#define check(cond)                                                   \
+    if (!(cond))                                                      \
+    {                                                                 \
+        throw runtime_error(string("Check failed: ") + #cond + " (" + \
+                            to_string(__LINE__) + ")");               \
+    }
+
+// Source with unreadable left half, like a corrupted strip
+class BrokenSource : public ImageSource
+{
+   public:
+    mutable atomic<int> reads;
+
+    BrokenSource() : reads(0) {}
+
+    QSize size() const override { return QSize(512, 256); }
+
+    QImage read(int, const QRect& rect) const override
+    {
+        this->reads++;
+        if (rect.x() < 256)
+        {
+            return QImage();
+        }
+
+        QImage image(rect.size(), QImage::Format_RGB32);
+        image.fill(Qt::gray);
+        return image;
+    }
+};
+
+// Let jobs finish and queued results be collected
+void settle(const BrokenSource& source, int reads)
+{
+    QElapsedTimer clock;
+    clock.start();
+    while (source.reads.load() < reads && clock.elapsed() < 5000)
+    {
+        QThread::msleep(1);
+    }
+
+    for (int i = 0; i < 10; i++)
+    {
+        QCoreApplication::processEvents();
+        QThread::msleep(10);
+    }
+}
+
+int main(int argc, char* argv[])
+try
+{
+    QCoreApplication app(argc, argv);
+
+    shared_ptr<BrokenSource> source = make_shared<BrokenSource>();
+    ImageTileCache cache(256);
+    cache.reset(source);
+
+    int viewer = 0;
+    check(cache.tile(0, 0, 0, &viewer).isNull());
+    check(cache.tile(0, 1, 0, &viewer).isNull());
+    settle(*source, 2);
+    check(source->reads.load() == 2);
+
+    // Failed tile stays null without decoding again, good one is cached
+    for (int i = 0; i < 5; i++)
+    {
+        cache.begin_round(&viewer);
+        check(cache.tile(0, 0, 0, &viewer).isNull());
+        check(!cache.tile(0, 1, 0, &viewer).isNull());
+    }
+
+    settle(*source, 2);
+    check(source->reads.load() == 2);
+
+    // Reset tries failed tiles again
+    cache.reset(source);
+    check(cache.tile(0, 0, 0, &viewer).isNull());
+    settle(*source, 3);
+    check(source->reads.load() == 3);
+
+    cout << "Tile cache test passed" << endl;
+    return 0;
+}
+catch (exception& ex)
+{
+    cout << endl;
+    cout << "Error!" << endl;
+    cout << ex.what() << endl;
+    cout << endl;
+    return -1;
+}
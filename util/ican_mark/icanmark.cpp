@@ -1,25 +1,24 @@
 #include "icanmark.h"
 #include "./ui_icanmark.h"
 
-#include <fstream>
+#include <algorithm>
 #include <iostream>
 #include <string>
 
 #include <QButtonGroup>
 #include <QCheckBox>
+#include <QDateTime>
 #include <QDir>
 #include <QDoubleValidator>
 #include <QFileDialog>
-#include <QImageReader>
+#include <QItemSelectionModel>
 #include <QMessageBox>
-#include <QPixmap>
+#include <QSettings>
 #include <QStandardPaths>
 #include <QString>
 #include <QToolButton>
 #include <QtMath>
 
-#define MARK_EXT ".mark"
-
 using namespace std;
 using namespace ican_mark;
 
@@ -27,6 +26,24 @@ ICANMark::ICANMark(QWidget* parent) : QMainWindow(parent), ui(new Ui::ICANMark)
 {
     ui->setupUi(this);
 
+    // Setup sample prefetcher and mark writer
+    this->prefetcher = new ImagePrefetcher(this);
+    this->markWriter = new MarkWriter(this);
+    connect(this->markWriter, &MarkWriter::writeFailed, this,
+            &ICANMark::mark_write_failed);
+
+    // Setup slide view with samples model, which skips rescanning for mark
+    // files written by this application
+    this->samples = new SampleListModel(this->ui->slideView->iconSize(), this);
+    connect(this->markWriter, &MarkWriter::writeStarted, this->samples,
+            &SampleListModel::begin_own_write);
+    connect(this->markWriter, &MarkWriter::writeFinished, this->samples,
+            &SampleListModel::end_own_write);
+    this->ui->slideView->setModel(this->samples);
+    connect(this->ui->slideView->selectionModel(),
+            &QItemSelectionModel::currentRowChanged, this,
+            &ICANMark::slideview_current_changed);
+
     // Setup timer
     this->ctrlTimer = new QTimer();
     this->setup_move_timer(this->ui->fps->value());
@@ -43,8 +60,20 @@ ICANMark::ICANMark(QWidget* parent) : QMainWindow(parent), ui(new Ui::ICANMark)
     connect(this->ui->nameList,
             QOverload<int>::of(&QComboBox::currentIndexChanged),
             this->ui->markArea, &RBoxMarkWidget::set_mark_label);
-    connect(this->ui->instList, &QListWidget::currentRowChanged,
-            this->ui->markArea, &RBoxMarkWidget::set_hl_instance_index);
+    this->ui->instList->setModel(this->ui->markArea->instance_model());
+    connect(this->ui->instList->selectionModel(),
+            &QItemSelectionModel::currentRowChanged,
+            [=](const QModelIndex& current, const QModelIndex& previous)
+            {
+                (void)previous;
+                this->ui->markArea->set_hl_instance_index(current.row());
+            });
+    connect(this->ui->markArea, &RBoxMarkWidget::hlInstanceIndexChanged,
+            [=](int index)
+            {
+                QAbstractItemModel* model = this->ui->instList->model();
+                this->ui->instList->setCurrentIndex(model->index(index, 0));
+            });
 
     connect(this->ui->fps, QOverload<int>::of(&QSpinBox::valueChanged), this,
             &ICANMark::setup_move_timer);
@@ -53,9 +82,18 @@ ICANMark::ICANMark(QWidget* parent) : QMainWindow(parent), ui(new Ui::ICANMark)
 
     // Setup south tab widget controller
     this->setup_tab_controller();
+    this->setup_memory_budget();
+
+    // Record input of mark area for replaying
+    this->traceDir = QString::fromLocal8Bit(qgetenv("ICAN_MARK_TRACE_DIR"));
 }
 
-ICANMark::~ICANMark() { delete ui; }
+ICANMark::~ICANMark()
+{
+    this->trace_save();
+    this->markWriter->flush();
+    delete ui;
+}
 
 void ICANMark::setup_move_timer(int fps)
 {
@@ -63,6 +101,50 @@ void ICANMark::setup_move_timer(int fps)
     this->ctrlTimer->start(this->updateInterval);
 }
 
+void ICANMark::setup_memory_budget()
+{
+    // Limit in MiB from ICAN_MARK_MEMORY_LIMIT_MB, or from settings of
+    // workstation
+    QSettings settings(QSettings::IniFormat, QSettings::UserScope, "ican_mark",
+                       "ican_mark");
+    qint64 limitMiB = settings.value("memory/limit_mb", 4096).toLongLong();
+
+    bool ok = false;
+    qint64 envMiB = qgetenv("ICAN_MARK_MEMORY_LIMIT_MB").toLongLong(&ok);
+    if (ok && envMiB > 0)
+    {
+        limitMiB = envMiB;
+    }
+
+    MemoryBudget& budget = MemoryBudget::instance();
+    budget.set_limit(max<qint64>(limitMiB, 1) << 20);
+
+    this->memoryLabel = new QLabel(this);
+    this->ui->statusbar->addPermanentWidget(this->memoryLabel);
+    connect(&budget, &MemoryBudget::usageChanged, this,
+            &ICANMark::memory_usage_changed);
+    this->memory_usage_changed();
+}
+
+void ICANMark::memory_usage_changed()
+{
+    const MemoryBudget& budget = MemoryBudget::instance();
+    this->memoryLabel->setText(QString("Memory %1 / %2 MiB")
+                                   .arg(budget.usage() >> 20)
+                                   .arg(budget.limit() >> 20));
+
+    QStringList usageList;
+    for (int i = 0; i < MemoryBudget::CategoryCount; i++)
+    {
+        MemoryBudget::Category category = (MemoryBudget::Category)i;
+        usageList.append(QString("%1: %2 MiB")
+                             .arg(MemoryBudget::category_name(category))
+                             .arg(budget.usage(category) >> 20));
+    }
+
+    this->memoryLabel->setToolTip(usageList.join("\n"));
+}
+
 void ICANMark::setup_tab_controller()
 {
     // Setup tab controll buttons
@@ -120,74 +202,40 @@ void ICANMark::setup_tab_controller()
             });
 }
 
-void ICANMark::on_markArea_instanceListChanged(const vector<Instance>& annoList)
+void ICANMark::on_markArea_instancesChanged(const InstanceChangeSet& change)
 {
-    // Refresh marked instances list
-    this->ui->instList->clear();
-    for (size_t i = 0; i < annoList.size(); i++)
+    // Skip list replaced by sample loading and already handled changes
+    if (change.reset || change.generation == this->markGeneration)
     {
-        // Generate string representation of item
-        int instLabel = annoList[i].get_label();
-        string itemStr = to_string((int)i + 1) + string(". ");
-        if (instLabel < this->ui->nameList->count())
-        {
-            itemStr += this->ui->nameList->itemText(instLabel).toStdString() +
-                       string(" ");
-        }
-
-        itemStr += string(annoList[i]);
-
-        // Add item to list
-        QListWidgetItem* item = new QListWidgetItem(itemStr.c_str());
-
-        item->setFlags(item->flags() | Qt::ItemIsUserCheckable);
-        item->setCheckState(Qt::Unchecked);
-
-        this->ui->instList->addItem(item);
+        return;
     }
 
-    // Save data
-    QListWidgetItem* curItem = this->ui->slideView->currentItem();
-    if (curItem)
+    // Schedule saving of instances changed by user, with snapshot from
+    // edit history which is taken in constant time
+    int row = this->ui->slideView->currentIndex().row();
+    if (row >= 0)
     {
-        QString filePath =
-            QFileInfo(this->ui->dataDir->text(), curItem->text() + MARK_EXT)
-                .filePath();
-
-        YAML::Node node;
-        node = annoList;
-
-        YAML::Emitter out;
-        out << node;
-
-        std::ofstream fWriter(filePath.toStdString());
-        if (!fWriter.is_open())
-        {
-            QMessageBox::warning(this, QString(tr("Error")),
-                                 QString(tr("Failed to write file:")) +
-                                     QString("\n") + filePath);
-        }
-
-        fWriter << out.c_str();
-        fWriter.close();
+        this->markWriter->schedule(
+            this->samples->file_path(row) + MARK_EXT,
+            this->ui->markArea->edit_history().current());
+        this->markGeneration = change.generation;
 
         // Change sample marked state
-        curItem->setCheckState(Qt::CheckState::Checked);
+        this->samples->set_marked(row, true);
     }
 }
 
-void ICANMark::on_instDel_clicked()
+void ICANMark::mark_write_failed(const QString& markPath, const QString& errMsg)
 {
-    vector<size_t> indList;
-    for (int i = 0; i < this->ui->instList->count(); i++)
-    {
-        if (this->ui->instList->item(i)->checkState() == Qt::Checked)
-        {
-            indList.push_back(i);
-        }
-    }
+    QMessageBox::warning(this, QString(tr("Error")),
+                         QString(tr("Failed to write file:")) + QString("\n") +
+                             markPath + QString("\n") + errMsg);
+}
 
-    this->ui->markArea->delete_instances(indList);
+void ICANMark::on_instDel_clicked()
+{
+    this->ui->markArea->delete_instances(
+        this->ui->markArea->instance_model()->checked_rows());
 }
 
 void ICANMark::on_dataDir_clicked()
@@ -207,98 +255,75 @@ void ICANMark::on_dataDir_clicked()
 
 void ICANMark::on_dataRefresh_clicked()
 {
-    // Set name filter
-    QList<QByteArray> fmtList = QImageReader::supportedImageFormats();
-    QStringList filter;
-    for (const QByteArray& fmt : fmtList)
-    {
-        filter << QString("*.") + QString(fmt);
-    }
-
-    // Scan images
+    // Images are enumerated in background and streamed into slide view
     QDir dir = QDir(this->ui->dataDir->text());
-    QFileInfoList fileList = dir.entryInfoList(filter);
-    QList<QListWidgetItem*> unmarkedList;
-    QList<QListWidgetItem*> markedList;
+    this->markWriter->flush();
+    this->prefetcher->clear();
+    this->samples->set_directory(
+        this->ui->dataDir->text().isEmpty() ? QString() : dir.absolutePath());
 
-    this->ui->slideView->clear();
-    for (const QFileInfo& fileInfo : fileList)
-    {
-        QIcon icon = QIcon(QPixmap(fileInfo.absoluteFilePath())
-                               .scaled(this->ui->slideView->iconSize(),
-                                       Qt::AspectRatioMode::KeepAspectRatio));
-        QListWidgetItem* item = new QListWidgetItem(icon, fileInfo.fileName());
-        item->setFlags(item->flags() &= ~Qt::ItemIsUserCheckable);
-        if (QFileInfo::exists(fileInfo.absoluteFilePath() + MARK_EXT))
-        {
-            item->setCheckState(Qt::Checked);
-            markedList.append(item);
-        }
-        else
-        {
-            item->setCheckState(Qt::Unchecked);
-            unmarkedList.append(item);
-        }
-    }
-
-    for (QListWidgetItem* item : unmarkedList)
-    {
-        this->ui->slideView->addItem(item);
-    }
-
-    for (QListWidgetItem* item : markedList)
-    {
-        this->ui->slideView->addItem(item);
-    }
+    // Model reset leaves current sample without notification
+    this->slideview_current_changed(QModelIndex(), QModelIndex());
 
     // Auto looking for class names
-    filter.clear();
-    filter.push_back("*.names");
-    fileList = dir.entryInfoList(filter);
+    QFileInfoList fileList = dir.entryInfoList(QStringList("*.names"));
     if (fileList.count())
     {
         this->load_class_names(fileList[0].absoluteFilePath());
     }
 }
 
-void ICANMark::on_slideView_currentItemChanged(QListWidgetItem* current,
-                                               QListWidgetItem* previous)
+void ICANMark::slideview_current_changed(const QModelIndex& current,
+                                         const QModelIndex& previous)
 {
     (void)previous;
 
-    if (current)
-    {
-        vector<Instance> instList;
+    // Finish writing before any mark file being read again
+    this->markWriter->flush();
+    this->trace_save();
 
+    if (current.isValid())
+    {
         // Get image path
-        QString imgPath =
-            QFileInfo(this->ui->dataDir->text(), current->text()).filePath();
+        QString imgPath = this->samples->file_path(current.row());
 
-        // Load marked instances
-        if (current->checkState() == Qt::Checked)
+        // Load image and marked instances
+        ImagePrefetcher::Sample sample;
+        if (!this->prefetcher->take(imgPath, sample))
         {
-            try
-            {
-                YAML::Node node =
-                    YAML::LoadFile((imgPath + MARK_EXT).toStdString());
-                instList = node.as<vector<Instance>>();
-            }
-            catch (exception& ex)
-            {
-                QMessageBox::warning(
-                    this, QString(tr("Error")),
-                    QString(tr("Failed to load marked information")) +
-                        QString("\n") + QString(ex.what()));
-            }
+            sample = ImagePrefetcher::load(
+                imgPath, this->samples->is_marked(current.row()));
         }
 
-        // Load images and reset mark area
-        QImage image = QImage(imgPath);
-        this->ui->mapStack->setCurrentIndex(0);
-        this->ui->imageMap->reset(image);
+        if (!sample.error.isEmpty())
+        {
+            QMessageBox::warning(
+                this, QString(tr("Error")),
+                QString(tr("Failed to load marked information")) +
+                    QString("\n") + sample.error);
+        }
 
+        // Reset mark area and image map with one shared image, huge images
+        // are decoded by regions on demand
+        shared_ptr<ImageResource> resource;
+        if (sample.source)
+        {
+            resource = make_shared<ImageResource>(sample.source);
+        }
+        else if (!sample.image.isNull())
+        {
+            resource = make_shared<ImageResource>(sample.image);
+        }
+
+        this->ui->mapStack->setCurrentIndex(0);
         this->ui->markStack->setCurrentIndex(0);
-        this->ui->markArea->reset(image, instList);
+        this->ui->imageMap->reset(resource);
+        this->ui->markArea->reset(resource, std::move(sample.instList));
+
+        this->trace_start(imgPath);
+
+        // Prefetch neighboring samples
+        this->slideview_prefetch();
     }
     else
     {
@@ -307,8 +332,40 @@ void ICANMark::on_slideView_currentItemChanged(QListWidgetItem* current,
         this->ui->markStack->setCurrentIndex(1);
 
         // Clear instances list
-        this->ui->instList->clear();
+        this->ui->markArea->reset(QImage());
+    }
+}
+
+void ICANMark::trace_start(const QString& imgPath)
+{
+    if (this->traceDir.isEmpty())
+    {
+        return;
     }
+
+    this->tracePath =
+        QDir(this->traceDir)
+            .filePath(QFileInfo(imgPath).completeBaseName() + "-" +
+                      QDateTime::currentDateTime().toString("yyyyMMdd-hhmmss") +
+                      ".trace");
+    this->ui->markArea->start_trace(&this->inputTrace);
+}
+
+void ICANMark::trace_save()
+{
+    if (!this->inputTrace.is_recording())
+    {
+        return;
+    }
+
+    this->ui->markArea->stop_trace();
+    if (!this->inputTrace.save(this->tracePath))
+    {
+        cerr << "Failed to save input trace " << this->tracePath.toStdString()
+             << ": " << this->inputTrace.error_string().toStdString() << endl;
+    }
+
+    this->inputTrace.clear();
 }
 
 void ICANMark::ctrl_timer_event()
@@ -337,6 +394,30 @@ void ICANMark::slideview_sliding(int step)
     }
 }
 
+void ICANMark::slideview_prefetch()
+{
+    int row = this->ui->slideView->currentIndex().row();
+    int count = this->samples->rowCount();
+
+    // Interleave upcoming and previous samples, nearest first
+    QStringList pathList;
+    int range = max(this->prefetchNext, this->prefetchPrevious);
+    for (int i = 1; i <= range; i++)
+    {
+        if (i <= this->prefetchNext && row + i < count)
+        {
+            pathList.append(this->samples->file_path(row + i));
+        }
+
+        if (i <= this->prefetchPrevious && row - i >= 0)
+        {
+            pathList.append(this->samples->file_path(row - i));
+        }
+    }
+
+    this->prefetcher->prefetch(pathList);
+}
+
 void ICANMark::on_slideNext_clicked()
 {
     if (this->ui->slideView->currentIndex().isValid())
@@ -437,6 +518,39 @@ void ICANMark::keyPressEvent(QKeyEvent* event)
         this->ui->markArea->setFocus();
     }
 
+    // Key shortcuts for undo and redo
+    if (this->ui->markStack->currentIndex() == 0 &&
+        (event->modifiers() & Qt::ControlModifier))
+    {
+        if (event->key() == Qt::Key_Z)
+        {
+            if (event->modifiers() & Qt::ShiftModifier)
+            {
+                this->ui->markArea->redo();
+            }
+            else
+            {
+                this->ui->markArea->undo();
+            }
+
+            return;
+        }
+        else if (event->key() == Qt::Key_Y)
+        {
+            this->ui->markArea->redo();
+            return;
+        }
+        else if (event->key() == Qt::Key_L)
+        {
+            // Relabel selected instances to current label
+            RBoxMarkWidget* markArea = this->ui->markArea;
+            markArea->relabel_instances(
+                markArea->instance_model()->checked_rows(),
+                markArea->get_mark_label());
+            return;
+        }
+    }
+
     // Key shortcuts for marking action
     if (this->ui->markStack->currentIndex() == 0)
     {
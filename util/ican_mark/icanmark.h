@@ -3,14 +3,22 @@
 
 #include <mark_action.hpp>
 #include <mark_instance.hpp>
+#include <mark_widget.h>
 #include <vector>
 
-#include <QListWidgetItem>
+#include "markwriter.h"
+#include "prefetcher.h"
+#include "samplelistmodel.h"
+
+#include <QHash>
+#include <QLabel>
 #include <QMainWindow>
 #include <QModelIndex>
 #include <QPointer>
 #include <QTimer>
 
+#define MARK_EXT ".mark"
+
 QT_BEGIN_NAMESPACE
 namespace Ui
 {
@@ -29,9 +37,10 @@ class ICANMark : public QMainWindow
    private slots:
     void ctrl_timer_event();
     void setup_move_timer(int fps);
+    void mark_write_failed(const QString& markPath, const QString& errMsg);
+    void memory_usage_changed();
 
-    void on_markArea_instanceListChanged(
-        const std::vector<ican_mark::Instance>& annoList);
+    void on_markArea_instancesChanged(const InstanceChangeSet& change);
 
     void on_instDel_clicked();
 
@@ -39,8 +48,8 @@ class ICANMark : public QMainWindow
 
     void on_dataRefresh_clicked();
 
-    void on_slideView_currentItemChanged(QListWidgetItem* current,
-                                         QListWidgetItem* previous);
+    void slideview_current_changed(const QModelIndex& current,
+                                   const QModelIndex& previous);
 
     void on_slideNext_clicked();
 
@@ -57,6 +66,24 @@ class ICANMark : public QMainWindow
    private:
     Ui::ICANMark* ui;
     QPointer<QTimer> ctrlTimer;
+    ImagePrefetcher* prefetcher;
+    MarkWriter* markWriter;
+    quint64 markGeneration = 0;  // Generation of last scheduled saving
+
+    // Number of upcoming and previous samples to be prefetched
+    int prefetchNext = 3;
+    int prefetchPrevious = 1;
+
+    // Samples of data directory shown by slide view
+    SampleListModel* samples;
+
+    // Memory usage against limit, shown on status bar
+    QLabel* memoryLabel;
+
+    // Input trace recording of mark area, enabled by ICAN_MARK_TRACE_DIR
+    QString traceDir;
+    QString tracePath;
+    InputTrace inputTrace;
 
     // For moving image region
     int updateInterval;
@@ -64,10 +91,14 @@ class ICANMark : public QMainWindow
     int w = 0, a = 0, s = 0, d = 0;
 
     void setup_tab_controller();
+    void setup_memory_budget();
 
     void slideview_sliding(int step);
+    void slideview_prefetch();
     void load_class_names(const QString& filePath);
     void label_switching(int step);
+    void trace_start(const QString& imgPath);
+    void trace_save();
 
     void keyPressEvent(QKeyEvent* event) override;
     void keyReleaseEvent(QKeyEvent* event) override;
@@ -0,0 +1,113 @@
+#include "markwriter.h"
+
+#include <mark_codec.hpp>
+#include <string>
+#include <utility>
+
+#include <QMetaObject>
+#include <QRunnable>
+#include <QSaveFile>
+
+using namespace std;
+using namespace ican_mark;
+
+class MarkWriter::Job : public QRunnable
+{
+   public:
+    Job(MarkWriter* owner, const QString& markPath, InstanceSeq&& instSeq)
+        : owner(owner), markPath(markPath), instSeq(std::move(instSeq))
+    {
+    }
+
+    void run() override
+    {
+        QString errMsg;
+        if (!MarkWriter::write(this->markPath, this->instSeq.to_store(),
+                               &errMsg))
+        {
+            QMetaObject::invokeMethod(this->owner, "report_failure",
+                                      Qt::QueuedConnection,
+                                      Q_ARG(QString, this->markPath),
+                                      Q_ARG(QString, errMsg));
+        }
+
+        QMetaObject::invokeMethod(this->owner, "report_finished",
+                                  Qt::QueuedConnection,
+                                  Q_ARG(QString, this->markPath));
+    }
+
+   private:
+    MarkWriter* owner;
+    QString markPath;
+    InstanceSeq instSeq;
+};
+
+MarkWriter::MarkWriter(QObject* parent, int debounceMSec) : QObject(parent)
+{
+    this->pool.setMaxThreadCount(1);
+
+    this->debounce.setSingleShot(true);
+    this->debounce.setInterval(debounceMSec);
+    connect(&this->debounce, &QTimer::timeout, this, &MarkWriter::submit);
+}
+
+MarkWriter::~MarkWriter() { this->flush(); }
+
+bool MarkWriter::write(const QString& markPath,
+                       const InstanceStore& instList, QString* errMsg)
+{
+    // Reuse encoding buffer of writer thread
+    static thread_local string buf;
+    buf.clear();
+    MarkCodec::encode(buf, instList);
+
+    // Write to temporary file and rename it to target path on commit
+    QSaveFile file(markPath);
+    if (!file.open(QIODevice::WriteOnly) ||
+        file.write(buf.data(), buf.size()) != (qint64)buf.size() ||
+        !file.commit())
+    {
+        if (errMsg)
+        {
+            *errMsg = file.errorString();
+        }
+
+        return false;
+    }
+
+    return true;
+}
+
+void MarkWriter::schedule(const QString& markPath, const InstanceSeq& instSeq)
+{
+    this->pending[markPath] = instSeq;
+    this->debounce.start();
+}
+
+void MarkWriter::flush()
+{
+    this->debounce.stop();
+    this->submit();
+    this->pool.waitForDone();
+}
+
+void MarkWriter::submit()
+{
+    for (auto it = this->pending.begin(); it != this->pending.end(); it++)
+    {
+        emit writeStarted(it.key());
+        this->pool.start(new Job(this, it.key(), std::move(it.value())));
+    }
+
+    this->pending.clear();
+}
+
+void MarkWriter::report_finished(const QString& markPath)
+{
+    emit writeFinished(markPath);
+}
+
+void MarkWriter::report_failure(const QString& markPath, const QString& errMsg)
+{
+    emit writeFailed(markPath, errMsg);
+}
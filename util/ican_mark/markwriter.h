@@ -0,0 +1,55 @@
+#ifndef MARKWRITER_H
+#define MARKWRITER_H
+
+#include <mark_history.hpp>
+#include <mark_instance.hpp>
+
+#include <QHash>
+#include <QObject>
+#include <QString>
+#include <QThreadPool>
+#include <QTimer>
+
+class MarkWriter : public QObject
+{
+    Q_OBJECT
+
+   public:
+    explicit MarkWriter(QObject* parent = nullptr, int debounceMSec = 500);
+    ~MarkWriter();
+
+    /** Write marked instances atomically */
+    static bool write(const QString& markPath,
+                      const ican_mark::InstanceStore& instList,
+                      QString* errMsg = nullptr);
+
+    /**
+     * Schedule writing of sequence snapshot, bursts on the same file are
+     * merged, and encoding is left to the writer thread
+     */
+    void schedule(const QString& markPath,
+                  const ican_mark::InstanceSeq& instSeq);
+
+    /** Write all scheduled data and wait until finished */
+    void flush();
+
+   signals:
+    void writeStarted(const QString& markPath);
+    void writeFinished(const QString& markPath);
+    void writeFailed(const QString& markPath, const QString& errMsg);
+
+   private slots:
+    void submit();
+    void report_finished(const QString& markPath);
+    void report_failure(const QString& markPath, const QString& errMsg);
+
+   private:
+    class Job;
+
+    QTimer debounce;
+    QThreadPool pool;  // Single background writer
+
+    QHash<QString, ican_mark::InstanceSeq> pending;
+};
+
+#endif  // MARKWRITER_H
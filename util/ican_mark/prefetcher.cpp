@@ -0,0 +1,234 @@
+#include "prefetcher.h"
+#include "icanmark.h"
+
+#include <mark_codec.hpp>
+#include <algorithm>
+#include <exception>
+
+#include <QFileInfo>
+#include <QImageReader>
+#include <QMetaObject>
+#include <QMutexLocker>
+#include <QRunnable>
+
+using namespace std;
+using namespace ican_mark;
+
+namespace
+{
+// Images larger than this are decoded by regions if their formats allow
+const qint64 regionDecodePixels = (qint64)1 << 26;
+
+}  // namespace
+
+class ImagePrefetcher::Job : public QRunnable
+{
+   public:
+    Job(ImagePrefetcher* owner, const QString& imgPath,
+        const shared_ptr<atomic<bool>>& canceled)
+        : owner(owner), imgPath(imgPath), canceled(canceled)
+    {
+    }
+
+    void run() override
+    {
+        if (this->canceled->load())
+        {
+            return;
+        }
+
+        Sample sample = ImagePrefetcher::load(
+            this->imgPath, QFileInfo::exists(this->imgPath + MARK_EXT));
+        if (this->canceled->load())
+        {
+            return;
+        }
+
+        // Hand over result to owner thread
+        QMutexLocker locker(&this->owner->finMutex);
+        this->owner->finList.push_back(
+            {this->imgPath, this->canceled, std::move(sample)});
+        locker.unlock();
+
+        QMetaObject::invokeMethod(this->owner, "collect_finished",
+                                  Qt::QueuedConnection);
+    }
+
+   private:
+    ImagePrefetcher* owner;
+    QString imgPath;
+    shared_ptr<atomic<bool>> canceled;
+};
+
+ImagePrefetcher::ImagePrefetcher(QObject* parent, int maxCostMiB)
+    : QObject(parent),
+      MemoryBudget::Client(MemoryBudget::PrefetchPriority),
+      cache(maxCostMiB)
+{
+    this->pool.setMaxThreadCount(2);
+}
+
+ImagePrefetcher::~ImagePrefetcher()
+{
+    this->clear();
+    this->pool.waitForDone();
+}
+
+ImagePrefetcher::Sample ImagePrefetcher::load(const QString& imgPath,
+                                              bool loadMark)
+{
+    Sample sample;
+
+    // Load marked instances
+    if (loadMark)
+    {
+        try
+        {
+            sample.instList =
+                MarkCodec::load((imgPath + MARK_EXT).toStdString());
+        }
+        catch (exception& ex)
+        {
+            sample.error = QString(ex.what());
+        }
+    }
+
+    // Load image
+    QSize size = QImageReader(imgPath).size();
+    if ((qint64)size.width() * size.height() > regionDecodePixels)
+    {
+        sample.source = ImageSource::open(imgPath);
+    }
+
+    if (!sample.source)
+    {
+        sample.image = QImage(imgPath);
+    }
+
+    return sample;
+}
+
+void ImagePrefetcher::prefetch(const QStringList& pathList)
+{
+    // Cancel requests which are no longer wanted
+    for (auto it = this->pending.begin(); it != this->pending.end();)
+    {
+        if (!pathList.contains(it.key()))
+        {
+            it.value()->store(true);
+            it = this->pending.erase(it);
+        }
+        else
+        {
+            it++;
+        }
+    }
+
+    // Start new requests, the first path has the highest priority
+    for (int i = 0; i < pathList.size(); i++)
+    {
+        const QString& imgPath = pathList[i];
+        if (this->cache.contains(imgPath) || this->pending.contains(imgPath))
+        {
+            continue;
+        }
+
+        shared_ptr<atomic<bool>> canceled = make_shared<atomic<bool>>(false);
+        this->pending.insert(imgPath, canceled);
+        this->pool.start(new Job(this, imgPath, canceled), pathList.size() - i);
+    }
+}
+
+bool ImagePrefetcher::take(const QString& imgPath, Sample& sample)
+{
+    Sample* cached = this->cache.take(imgPath);
+    if (cached)
+    {
+        sample = std::move(*cached);
+        delete cached;
+        this->account_memory();
+        return true;
+    }
+
+    // Caller is going to load it synchronously
+    this->invalidate(imgPath);
+    return false;
+}
+
+void ImagePrefetcher::invalidate(const QString& imgPath)
+{
+    auto it = this->pending.find(imgPath);
+    if (it != this->pending.end())
+    {
+        it.value()->store(true);
+        this->pending.erase(it);
+    }
+
+    this->cache.remove(imgPath);
+    this->account_memory();
+}
+
+void ImagePrefetcher::clear()
+{
+    for (auto it = this->pending.begin(); it != this->pending.end(); it++)
+    {
+        it.value()->store(true);
+    }
+
+    this->pending.clear();
+    this->cache.clear();
+    this->account_memory();
+}
+
+qint64 ImagePrefetcher::release_memory(qint64 bytes)
+{
+    // Lowering capacity evicts samples until the rest fits
+    qint64 used = (qint64)this->cache.totalCost() << 20;
+    int maxCost = this->cache.maxCost();
+    this->cache.setMaxCost((int)(max<qint64>(used - bytes, 0) >> 20));
+    this->cache.setMaxCost(maxCost);
+
+    this->account_memory();
+    return used - ((qint64)this->cache.totalCost() << 20);
+}
+
+qint64 ImagePrefetcher::releasable_memory() const
+{
+    return (qint64)this->cache.totalCost() << 20;
+}
+
+void ImagePrefetcher::account_memory()
+{
+    this->account(MemoryBudget::SourcePixels,
+                  (qint64)this->cache.totalCost() << 20);
+}
+
+void ImagePrefetcher::collect_finished()
+{
+    vector<Finished> finished;
+    QMutexLocker locker(&this->finMutex);
+    finished.swap(this->finList);
+    locker.unlock();
+
+    for (Finished& fin : finished)
+    {
+        // Drop results of canceled or superseded requests
+        auto it = this->pending.find(fin.imgPath);
+        if (it == this->pending.end() || it.value() != fin.canceled)
+        {
+            continue;
+        }
+
+        this->pending.erase(it);
+
+        qint64 bytes =
+            (qint64)fin.sample.image.bytesPerLine() * fin.sample.image.height();
+        int cost = max(1, (int)(bytes >> 20));
+        this->cache.insert(fin.imgPath, new Sample(std::move(fin.sample)),
+                           cost);
+
+        emit sampleReady(fin.imgPath);
+    }
+
+    this->account_memory();
+}
@@ -0,0 +1,79 @@
+#ifndef PREFETCHER_H
+#define PREFETCHER_H
+
+#include <mark_instance.hpp>
+#include <mark_widget.h>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include <QCache>
+#include <QHash>
+#include <QImage>
+#include <QMutex>
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QThreadPool>
+
+class ImagePrefetcher : public QObject, public MemoryBudget::Client
+{
+    Q_OBJECT
+
+   public:
+    struct Sample
+    {
+        QImage image;
+        std::shared_ptr<ImageSource> source;  // Set instead of huge image
+        ican_mark::InstanceStore instList;
+        QString error;  // Error message of loading marked information
+    };
+
+    explicit ImagePrefetcher(QObject* parent = nullptr, int maxCostMiB = 1024);
+    ~ImagePrefetcher();
+
+    /** Load a sample synchronously */
+    static Sample load(const QString& imgPath, bool loadMark);
+
+    /** Request samples in priority order and cancel stale requests */
+    void prefetch(const QStringList& pathList);
+
+    /** Move a prefetched sample out of cache */
+    bool take(const QString& imgPath, Sample& sample);
+
+    void invalidate(const QString& imgPath);
+    void clear();
+
+    /** Least recently prefetched samples are dropped first */
+    qint64 release_memory(qint64 bytes) override;
+    qint64 releasable_memory() const override;
+
+   signals:
+    void sampleReady(const QString& imgPath);
+
+   private slots:
+    void collect_finished();
+
+   private:
+    class Job;
+
+    struct Finished
+    {
+        QString imgPath;
+        std::shared_ptr<std::atomic<bool>> canceled;
+        Sample sample;
+    };
+
+    QThreadPool pool;
+    QCache<QString, Sample> cache;  // LRU of decoded samples, cost in MiB
+
+    // Cancellation flags of requested samples
+    QHash<QString, std::shared_ptr<std::atomic<bool>>> pending;
+
+    QMutex finMutex;
+    std::vector<Finished> finList;  // Guarded by finMutex
+
+    void account_memory();
+};
+
+#endif  // PREFETCHER_H
@@ -0,0 +1,690 @@
+#include "samplelistmodel.h"
+#include "icanmark.h"
+
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+#include <utility>
+
+#include <QColor>
+#include <QDir>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QImageReader>
+#include <QMetaObject>
+#include <QMutexLocker>
+#include <QPixmap>
+#include <QRunnable>
+#include <QSet>
+
+using namespace std;
+
+namespace
+{
+const int batchInterval = 100;  // Milliseconds between streamed batches
+const int rescanDelay = 300;    // Milliseconds to merge directory changes
+const int ownWriteGrace = 500;  // Milliseconds for watcher to report writes
+const int thumbCapacity = 36 << 10;  // KiB, 4096 icons of 48x48
+
+QStringList image_filters()
+{
+    QStringList filter;
+    for (const QByteArray& fmt : QImageReader::supportedImageFormats())
+    {
+        filter << QString("*.") + QString(fmt);
+    }
+
+    return filter;
+}
+
+// Same order as sorting of QDir by name with case ignored
+bool name_less(const QString& lhs, const QString& rhs)
+{
+    int ret = QString::compare(lhs, rhs, Qt::CaseInsensitive);
+    return (ret != 0) ? (ret < 0) : (lhs < rhs);
+}
+
+}  // namespace
+
+class SampleListModel::Job : public QRunnable
+{
+   public:
+    Job(SampleListModel* owner, int generation, const QStringList& filter,
+        const QVector<Entry>& known)
+        : owner(owner),
+          generation(generation),
+          batchSize(owner->batchSize),
+          dirPath(owner->dirPath),
+          filter(filter),
+          known(known)
+    {
+    }
+
+    void run() override
+    {
+        if (this->known.isEmpty())
+        {
+            this->enumerate();
+        }
+        else
+        {
+            this->compare();
+        }
+    }
+
+   private:
+    SampleListModel* owner;
+    int generation;
+    int batchSize;
+    QString dirPath;
+    QStringList filter;
+    QVector<Entry> known;  // Entries to be compared with, empty for scanning
+
+    bool canceled() const
+    {
+        return this->generation != this->owner->generation.load();
+    }
+
+    void post(Scanned&& scanned)
+    {
+        QMutexLocker locker(&this->owner->scanMutex);
+        this->owner->scanList.push_back(std::move(scanned));
+        locker.unlock();
+
+        QMetaObject::invokeMethod(this->owner, "collect_scanned",
+                                  Qt::QueuedConnection);
+    }
+
+    void enumerate()
+    {
+        // Images are sent unmarked unless their mark files were enumerated
+        // before them, others are resolved on finishing without stat calls
+        QSet<QString> markSet;
+        QStringList nameList[2];  // Unmarked and marked names in sent order
+
+        Scanned batch = {this->generation, false};
+        QElapsedTimer clock;
+        clock.start();
+
+        QDirIterator it(this->dirPath, this->filter << "*" MARK_EXT,
+                        QDir::Files);
+        while (it.hasNext())
+        {
+            if (this->canceled())
+            {
+                return;
+            }
+
+            it.next();
+            QString name = it.fileName();
+            if (name.endsWith(MARK_EXT))
+            {
+                markSet.insert(name.left(name.size() - strlen(MARK_EXT)));
+                continue;
+            }
+
+            bool marked = markSet.contains(name);
+            batch.added.push_back({name, marked});
+            nameList[marked].append(name);
+
+            if (batch.added.size() >= this->batchSize ||
+                clock.elapsed() >= batchInterval)
+            {
+                this->post(std::move(batch));
+                batch = {this->generation, false};
+                clock.restart();
+            }
+        }
+
+        // Rows of each final partition, where images sent unmarked are
+        // moved to marked one if their mark files were enumerated later
+        int unmarkedCount = nameList[0].size();
+        vector<int> partList[2];
+        for (int row = 0; row < unmarkedCount; row++)
+        {
+            bool marked = markSet.contains(nameList[0][row]);
+            if (marked)
+            {
+                batch.changed.push_back({nameList[0][row], true});
+            }
+
+            partList[marked].push_back(row);
+        }
+
+        for (int i = 0; i < nameList[1].size(); i++)
+        {
+            partList[1].push_back(unmarkedCount + i);
+        }
+
+        // Sorting permutation of rows in each partition
+        auto row_name = [&](int row) -> const QString&
+        {
+            return (row < unmarkedCount) ? nameList[0][row]
+                                         : nameList[1][row - unmarkedCount];
+        };
+
+        for (vector<int>& part : partList)
+        {
+            sort(part.begin(), part.end(), [&](int lhs, int rhs)
+                 { return name_less(row_name(lhs), row_name(rhs)); });
+            batch.order.insert(batch.order.end(), part.begin(), part.end());
+        }
+
+        batch.finished = true;
+        this->post(std::move(batch));
+    }
+
+    void compare()
+    {
+        // List whole directory, which is done without stat calls
+        QSet<QString> imageSet;
+        QSet<QString> markSet;
+        QDirIterator it(this->dirPath, this->filter << "*" MARK_EXT,
+                        QDir::Files);
+        while (it.hasNext())
+        {
+            if (this->canceled())
+            {
+                return;
+            }
+
+            it.next();
+            QString name = it.fileName();
+            if (name.endsWith(MARK_EXT))
+            {
+                markSet.insert(name.left(name.size() - strlen(MARK_EXT)));
+            }
+            else
+            {
+                imageSet.insert(name);
+            }
+        }
+
+        Scanned diff = {this->generation, true};
+        for (const Entry& entry : this->known)
+        {
+            if (!imageSet.remove(entry.name))
+            {
+                diff.removed.append(entry.name);
+            }
+            else if (markSet.contains(entry.name) != entry.marked)
+            {
+                diff.changed.push_back({entry.name, !entry.marked});
+            }
+        }
+
+        for (const QString& name : imageSet)
+        {
+            diff.added.push_back({name, markSet.contains(name)});
+        }
+
+        this->post(std::move(diff));
+    }
+};
+
+SampleListModel::SampleListModel(const QSize& iconSize, QObject* parent,
+                                 int batchSize)
+    : QAbstractListModel(parent),
+      MemoryBudget::Client(MemoryBudget::ThumbnailPriority),
+      batchSize(batchSize),
+      generation(0)
+{
+    this->pool.setMaxThreadCount(1);
+
+    this->debounce.setSingleShot(true);
+    this->debounce.setInterval(rescanDelay);
+    connect(&this->debounce, &QTimer::timeout, this, &SampleListModel::rescan);
+    connect(&this->watcher, &QFileSystemWatcher::directoryChanged, this,
+            &SampleListModel::directory_changed);
+
+    // Show placeholder until thumbnail is ready
+    QPixmap pixmap(iconSize);
+    pixmap.fill(QColor(128, 128, 128));
+    this->placeholder = QIcon(pixmap);
+
+    this->thumbs.setMaxCost(thumbCapacity);
+    this->thumbCache = new ThumbnailCache(iconSize, this);
+    connect(this->thumbCache, &ThumbnailCache::thumbnailReady, this,
+            &SampleListModel::thumbnail_ready);
+}
+
+SampleListModel::~SampleListModel()
+{
+    this->generation++;
+    this->pool.clear();
+    this->pool.waitForDone();
+}
+
+qint64 SampleListModel::release_memory(qint64 bytes)
+{
+    // Lowering capacity evicts least recently used thumbnails
+    qint64 used = (qint64)this->thumbs.totalCost() << 10;
+    int maxCost = this->thumbs.maxCost();
+    this->thumbs.setMaxCost((int)(max<qint64>(used - bytes, 0) >> 10));
+    this->thumbs.setMaxCost(maxCost);
+
+    qint64 remain = (qint64)this->thumbs.totalCost() << 10;
+    this->account(MemoryBudget::Thumbnails, remain);
+    return used - remain;
+}
+
+qint64 SampleListModel::releasable_memory() const
+{
+    return (qint64)this->thumbs.totalCost() << 10;
+}
+
+void SampleListModel::set_directory(const QString& dirPath)
+{
+    // Drop results of previous directory
+    this->generation++;
+    this->pool.clear();
+    this->thumbCache->cancel_all();
+    this->debounce.stop();
+    if (!this->watcher.directories().isEmpty())
+    {
+        this->watcher.removePaths(this->watcher.directories());
+    }
+
+    this->beginResetModel();
+    this->dirPath = dirPath;
+    this->entries.clear();
+    this->markedBegin = 0;
+    this->sorted = true;
+    this->scanning = false;
+    this->dirty = false;
+    this->thumbs.clear();
+    this->requested.clear();
+    this->endResetModel();
+    this->account(MemoryBudget::Thumbnails, 0);
+
+    if (dirPath.isEmpty() || !QDir(dirPath).exists())
+    {
+        return;
+    }
+
+    // Changes during scanning are applied after that
+    this->watcher.addPath(dirPath);
+    this->sorted = false;
+    this->start_job(false);
+}
+
+const QString& SampleListModel::directory() const { return this->dirPath; }
+
+bool SampleListModel::is_scanning() const { return this->scanning; }
+
+QString SampleListModel::file_name(int row) const
+{
+    return (row >= 0 && row < this->entries.size()) ? this->entries[row].name
+                                                     : QString();
+}
+
+QString SampleListModel::file_path(int row) const
+{
+    return (row >= 0 && row < this->entries.size())
+               ? QDir(this->dirPath).filePath(this->entries[row].name)
+               : QString();
+}
+
+bool SampleListModel::is_marked(int row) const
+{
+    return row >= 0 && row < this->entries.size() && this->entries[row].marked;
+}
+
+void SampleListModel::set_marked(int row, bool marked)
+{
+    if (row < 0 || row >= this->entries.size() ||
+        this->entries[row].marked == marked)
+    {
+        return;
+    }
+
+    // Sample stays in its partition to keep view steady
+    this->entries[row].marked = marked;
+
+    QModelIndex ind = this->index(row);
+    emit dataChanged(ind, ind, {Qt::CheckStateRole});
+}
+
+int SampleListModel::rowCount(const QModelIndex& parent) const
+{
+    return parent.isValid() ? 0 : this->entries.size();
+}
+
+QVariant SampleListModel::data(const QModelIndex& index, int role) const
+{
+    if (!index.isValid() || index.row() >= this->entries.size())
+    {
+        return QVariant();
+    }
+
+    const Entry& entry = this->entries[index.row()];
+    switch (role)
+    {
+        case Qt::DisplayRole:
+            return entry.name;
+
+        case Qt::CheckStateRole:
+            return entry.marked ? Qt::Checked : Qt::Unchecked;
+
+        case Qt::DecorationRole:
+        {
+            // Views only ask for rows being shown
+            QIcon* icon = this->thumbs.object(entry.name);
+            if (icon)
+            {
+                return *icon;
+            }
+
+            if (!this->requested.contains(entry.name))
+            {
+                this->requested.insert(entry.name, index.row());
+                this->thumbCache->request(this->file_path(index.row()));
+            }
+
+            return this->placeholder;
+        }
+    }
+
+    return QVariant();
+}
+
+void SampleListModel::collect_scanned()
+{
+    vector<Scanned> scanned;
+    QMutexLocker locker(&this->scanMutex);
+    scanned.swap(this->scanList);
+    locker.unlock();
+
+    for (Scanned& result : scanned)
+    {
+        if (result.generation != this->generation.load())
+        {
+            continue;
+        }
+
+        if (!this->sorted)
+        {
+            // Streamed batch of initial scanning
+            this->append_entries(result.added);
+            if (result.finished)
+            {
+                this->finish_entries(result.changed, result.order);
+            }
+        }
+        else
+        {
+            // Difference to watched directory
+            for (const QString& name : result.removed)
+            {
+                this->remove_entry(name);
+            }
+
+            for (const Entry& entry : result.added)
+            {
+                this->insert_entry(entry);
+            }
+
+            for (const Entry& entry : result.changed)
+            {
+                this->set_marked(this->find_row(entry.name), entry.marked);
+            }
+        }
+
+        if (result.finished)
+        {
+            this->scanning = false;
+            if (this->dirty)
+            {
+                this->dirty = false;
+                this->debounce.start();
+            }
+        }
+    }
+}
+
+void SampleListModel::thumbnail_ready(const QString& imgPath,
+                                      const QImage& thumbnail)
+{
+    QString name = QFileInfo(imgPath).fileName();
+    if (!this->requested.contains(name))
+    {
+        return;
+    }
+
+    // Row hint is checked since rows may be moved after requesting
+    int row = this->requested.take(name);
+    if (row >= this->entries.size() || this->entries[row].name != name)
+    {
+        row = this->find_row(name);
+    }
+
+    qint64 bytes = (qint64)thumbnail.bytesPerLine() * thumbnail.height();
+    this->thumbs.insert(name, new QIcon(QPixmap::fromImage(thumbnail)),
+                        max(1, (int)(bytes >> 10)));
+    this->account(MemoryBudget::Thumbnails,
+                  (qint64)this->thumbs.totalCost() << 10);
+    if (row >= 0)
+    {
+        QModelIndex ind = this->index(row);
+        emit dataChanged(ind, ind, {Qt::DecorationRole});
+    }
+}
+
+void SampleListModel::directory_changed()
+{
+    // Writes of this application have updated marked states already
+    if (this->ownWrites > 0 || (this->ownWriteClock.isValid() &&
+                                this->ownWriteClock.elapsed() < ownWriteGrace))
+    {
+        return;
+    }
+
+    if (this->scanning)
+    {
+        this->dirty = true;
+    }
+    else
+    {
+        this->debounce.start();
+    }
+}
+
+void SampleListModel::rescan()
+{
+    if (this->scanning)
+    {
+        this->dirty = true;
+        return;
+    }
+
+    this->start_job(true);
+}
+
+void SampleListModel::begin_own_write() { this->ownWrites++; }
+
+void SampleListModel::end_own_write()
+{
+    this->ownWrites--;
+    this->ownWriteClock.start();
+}
+
+void SampleListModel::start_job(bool incremental)
+{
+    // Entries are shared with job until next modification
+    this->scanning = true;
+    this->pool.start(new Job(this, this->generation.load(), image_filters(),
+                             incremental ? this->entries : QVector<Entry>()));
+}
+
+void SampleListModel::append_entries(const QVector<Entry>& added)
+{
+    QVector<Entry> unmarked;
+    QVector<Entry> marked;
+    for (const Entry& entry : added)
+    {
+        (entry.marked ? marked : unmarked).push_back(entry);
+    }
+
+    // Unmarked ones are placed before marked partition
+    if (!unmarked.isEmpty())
+    {
+        int first = this->markedBegin;
+        this->beginInsertRows(QModelIndex(), first,
+                              first + unmarked.size() - 1);
+        this->entries.insert(this->entries.begin() + first, unmarked.size(),
+                             Entry());
+        copy(unmarked.begin(), unmarked.end(), this->entries.begin() + first);
+        this->markedBegin += unmarked.size();
+        this->endInsertRows();
+    }
+
+    if (!marked.isEmpty())
+    {
+        int first = this->entries.size();
+        this->beginInsertRows(QModelIndex(), first, first + marked.size() - 1);
+        this->entries.append(marked);
+        this->endInsertRows();
+    }
+}
+
+void SampleListModel::insert_entry(const Entry& entry)
+{
+    if (this->find_row(entry.name) >= 0)
+    {
+        return;
+    }
+
+    // Insert to sorted position of its partition
+    auto beg = this->entries.begin() + (entry.marked ? this->markedBegin : 0);
+    auto end = entry.marked ? this->entries.end()
+                            : this->entries.begin() + this->markedBegin;
+    auto pos = lower_bound(beg, end, entry,
+                           [](const Entry& lhs, const Entry& rhs)
+                           { return name_less(lhs.name, rhs.name); });
+
+    int row = pos - this->entries.begin();
+    this->beginInsertRows(QModelIndex(), row, row);
+    this->entries.insert(row, entry);
+    if (!entry.marked)
+    {
+        this->markedBegin++;
+    }
+
+    this->endInsertRows();
+}
+
+void SampleListModel::remove_entry(const QString& name)
+{
+    int row = this->find_row(name);
+    if (row < 0)
+    {
+        return;
+    }
+
+    this->beginRemoveRows(QModelIndex(), row, row);
+    this->entries.remove(row);
+    if (row < this->markedBegin)
+    {
+        this->markedBegin--;
+    }
+
+    this->endRemoveRows();
+
+    this->thumbs.remove(name);
+    this->requested.remove(name);
+    this->account(MemoryBudget::Thumbnails,
+                  (qint64)this->thumbs.totalCost() << 10);
+}
+
+void SampleListModel::finish_entries(const QVector<Entry>& changed,
+                                     const vector<int>& order)
+{
+    // Images with mark files enumerated after them join marked partition
+    QSet<QString> markedSet;
+    for (const Entry& entry : changed)
+    {
+        markedSet.insert(entry.name);
+    }
+
+    int marked = 0;
+    for (Entry& entry : this->entries)
+    {
+        entry.marked = entry.marked || markedSet.contains(entry.name);
+        marked += entry.marked;
+    }
+
+    this->sort_entries(order);
+    this->markedBegin = this->entries.size() - marked;
+    if (!changed.isEmpty())
+    {
+        emit dataChanged(this->index(0), this->index(this->entries.size() - 1),
+                         {Qt::CheckStateRole});
+    }
+}
+
+void SampleListModel::sort_entries(const vector<int>& order)
+{
+    emit layoutAboutToBeChanged();
+
+    QVector<Entry> sortedList;
+    sortedList.reserve(this->entries.size());
+    vector<int> newRow(order.size());
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        sortedList.push_back(this->entries[order[i]]);
+        newRow[order[i]] = (int)i;
+    }
+
+    this->entries.swap(sortedList);
+    this->sorted = true;
+
+    // Keep current and selected samples of views
+    QModelIndexList fromList = this->persistentIndexList();
+    QModelIndexList toList;
+    for (const QModelIndex& from : fromList)
+    {
+        toList.append(this->index(newRow[from.row()]));
+    }
+
+    this->changePersistentIndexList(fromList, toList);
+    for (int& row : this->requested)
+    {
+        row = (row < (int)newRow.size()) ? newRow[row] : row;
+    }
+
+    emit layoutChanged();
+}
+
+int SampleListModel::find_row(const QString& name) const
+{
+    if (!this->sorted)
+    {
+        for (int i = 0; i < this->entries.size(); i++)
+        {
+            if (this->entries[i].name == name)
+            {
+                return i;
+            }
+        }
+
+        return -1;
+    }
+
+    // Binary search on both partitions
+    auto less = [](const Entry& entry, const QString& key)
+    { return name_less(entry.name, key); };
+    int bound[3] = {0, this->markedBegin, this->entries.size()};
+    for (int i = 0; i < 2; i++)
+    {
+        auto end = this->entries.begin() + bound[i + 1];
+        auto pos =
+            lower_bound(this->entries.begin() + bound[i], end, name, less);
+        if (pos != end && pos->name == name)
+        {
+            return pos - this->entries.begin();
+        }
+    }
+
+    return -1;
+}
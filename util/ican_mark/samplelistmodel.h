@@ -0,0 +1,126 @@
+#ifndef SAMPLELISTMODEL_H
+#define SAMPLELISTMODEL_H
+
+#include <atomic>
+#include <vector>
+
+#include <QAbstractListModel>
+#include <QCache>
+#include <QElapsedTimer>
+#include <QFileSystemWatcher>
+#include <QHash>
+#include <QIcon>
+#include <QMutex>
+#include <QSize>
+#include <QString>
+#include <QStringList>
+#include <QThreadPool>
+#include <QTimer>
+#include <QVector>
+
+#include <mark_widget.h>
+
+#include "thumbnailcache.h"
+
+/**
+ * Image samples of a data directory, unmarked ones before marked ones.
+ *
+ * Directory is enumerated in background and entries are streamed into model
+ * in batches. Each partition is sorted by name once enumeration finished,
+ * after that the directory is watched and added or removed images and mark
+ * files are applied incrementally. Thumbnails are requested only for rows
+ * being shown by views.
+ */
+class SampleListModel : public QAbstractListModel,
+                        public MemoryBudget::Client
+{
+    Q_OBJECT
+
+   public:
+    explicit SampleListModel(const QSize& iconSize, QObject* parent = nullptr,
+                             int batchSize = 4096);
+    ~SampleListModel();
+
+    /** Thumbnails are reloaded from disk cache once shown again */
+    qint64 release_memory(qint64 bytes) override;
+    qint64 releasable_memory() const override;
+
+    /** Start scanning and watching of directory, empty path for none */
+    void set_directory(const QString& dirPath);
+    const QString& directory() const;
+    bool is_scanning() const;
+
+    QString file_name(int row) const;
+    QString file_path(int row) const;
+    bool is_marked(int row) const;
+    void set_marked(int row, bool marked);
+
+    /** Mark files written by this application, not to be rescanned */
+    void begin_own_write();
+    void end_own_write();
+
+    int rowCount(const QModelIndex& parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex& index,
+                  int role = Qt::DisplayRole) const override;
+
+   private slots:
+    void collect_scanned();
+    void thumbnail_ready(const QString& imgPath, const QImage& thumbnail);
+    void directory_changed();
+    void rescan();
+
+   private:
+    class Job;
+
+    struct Entry
+    {
+        QString name;
+        bool marked;
+    };
+
+    struct Scanned
+    {
+        int generation;
+        bool finished;
+        QVector<Entry> added;
+        QStringList removed;
+        QVector<Entry> changed;  // Images with flipped marked state
+        std::vector<int> order;  // Rows in sorted order, on scanning finished
+    };
+
+    int batchSize;
+    QString dirPath;
+
+    QVector<Entry> entries;
+    int markedBegin = 0;   // First row of marked partition
+    bool sorted = true;    // Partitions are sorted by name
+    bool scanning = false;
+    bool dirty = false;    // Directory changed during scanning
+
+    QThreadPool pool;  // Single scanning thread
+    std::atomic<int> generation;
+    QMutex scanMutex;
+    std::vector<Scanned> scanList;  // Guarded by scanMutex
+
+    QFileSystemWatcher watcher;
+    QTimer debounce;
+    int ownWrites = 0;            // Writes in progress
+    QElapsedTimer ownWriteClock;  // Time since last write finished
+
+    // Thumbnails of shown rows, requested ones are mapped to row hints
+    ThumbnailCache* thumbCache;
+    QIcon placeholder;
+    mutable QCache<QString, QIcon> thumbs;  // Cost in KiB
+    mutable QHash<QString, int> requested;
+
+    void start_job(bool incremental);
+    void append_entries(const QVector<Entry>& added);
+    void insert_entry(const Entry& entry);
+    void remove_entry(const QString& name);
+    void finish_entries(const QVector<Entry>& changed,
+                        const std::vector<int>& order);
+    void sort_entries(const std::vector<int>& order);
+    int find_row(const QString& name) const;
+};
+
+#endif  // SAMPLELISTMODEL_H
@@ -0,0 +1,191 @@
+#include "thumbnailcache.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QImageReader>
+#include <QMetaObject>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+using namespace std;
+
+namespace
+{
+const qint64 diskCapacity = 256 << 20;  // Bytes of thumbnails kept on disk
+}
+
+class ThumbnailCache::Job : public QRunnable
+{
+   public:
+    Job(ThumbnailCache* owner, const QString& imgPath, int generation)
+        : owner(owner), imgPath(imgPath), generation(generation)
+    {
+    }
+
+    void run() override
+    {
+        if (this->generation != this->owner->generation.load())
+        {
+            return;
+        }
+
+        QImage thumbnail = this->owner->generate(this->imgPath);
+
+        // Hand over result to owner thread
+        QMutexLocker locker(&this->owner->finMutex);
+        this->owner->finList.push_back(
+            {this->imgPath, this->generation, thumbnail});
+        locker.unlock();
+
+        QMetaObject::invokeMethod(this->owner, "collect_finished",
+                                  Qt::QueuedConnection);
+    }
+
+   private:
+    ThumbnailCache* owner;
+    QString imgPath;
+    int generation;
+};
+
+class ThumbnailCache::PruneJob : public QRunnable
+{
+   public:
+    explicit PruneJob(const QString& cacheDir) : cacheDir(cacheDir) {}
+
+    void run() override
+    {
+        // Keep most recently used thumbnails up to capacity
+        QFileInfoList fileList =
+            QDir(this->cacheDir)
+                .entryInfoList(QStringList("*.png"), QDir::Files, QDir::Time);
+
+        qint64 bytes = 0;
+        for (const QFileInfo& fileInfo : fileList)
+        {
+            bytes += fileInfo.size();
+            if (bytes > diskCapacity)
+            {
+                QFile::remove(fileInfo.absoluteFilePath());
+            }
+        }
+    }
+
+   private:
+    QString cacheDir;
+};
+
+ThumbnailCache::ThumbnailCache(const QSize& size, QObject* parent)
+    : QObject(parent), size(size), generation(0)
+{
+    this->cacheDir =
+        QStandardPaths::writableLocation(QStandardPaths::CacheLocation) +
+        QString("/thumbnails");
+    QDir().mkpath(this->cacheDir);
+
+    // Thumbnails of moved or modified images are never hit again, prune them
+    // with other least recently used ones
+    this->pool.start(new PruneJob(this->cacheDir));
+}
+
+ThumbnailCache::~ThumbnailCache()
+{
+    this->cancel_all();
+    this->pool.waitForDone();
+}
+
+void ThumbnailCache::request(const QString& imgPath)
+{
+    this->pool.start(new Job(this, imgPath, this->generation.load()));
+}
+
+void ThumbnailCache::cancel_all()
+{
+    this->generation++;
+    this->pool.clear();
+}
+
+QSize ThumbnailCache::thumbnail_size() const { return this->size; }
+QString ThumbnailCache::cache_dir() const { return this->cacheDir; }
+
+QString ThumbnailCache::cache_path(const QString& imgPath) const
+{
+    // Cache key is composed of path, modified time, file size and thumbnail
+    // size, so modified images never hit stale thumbnails
+    QFileInfo fileInfo(imgPath);
+    QString key = fileInfo.absoluteFilePath() + QString("\n") +
+                  QString::number(fileInfo.lastModified().toMSecsSinceEpoch()) +
+                  QString("\n") + QString::number(fileInfo.size()) +
+                  QString("\n") + QString::number(this->size.width()) +
+                  QString("x") + QString::number(this->size.height());
+
+    QByteArray hash =
+        QCryptographicHash::hash(key.toUtf8(), QCryptographicHash::Sha1);
+    return this->cacheDir + QString("/") + QString(hash.toHex()) +
+           QString(".png");
+}
+
+QImage ThumbnailCache::generate(const QString& imgPath) const
+{
+    // Load from disk cache
+    QString cachePath = this->cache_path(imgPath);
+
+    QImage thumbnail;
+    if (thumbnail.load(cachePath, "PNG"))
+    {
+#if QT_VERSION >= QT_VERSION_CHECK(5, 10, 0)
+        // Modified time orders thumbnails for pruning
+        QFile file(cachePath);
+        if (file.open(QIODevice::ReadWrite))
+        {
+            file.setFileTime(QDateTime::currentDateTime(),
+                             QFileDevice::FileModificationTime);
+        }
+#endif
+        return thumbnail;
+    }
+
+    // Decode with reduced size if image format supports it
+    QImageReader reader(imgPath);
+    QSize imgSize = reader.size();
+    if (imgSize.isValid())
+    {
+        reader.setScaledSize(imgSize.scaled(this->size, Qt::KeepAspectRatio));
+    }
+
+    thumbnail = reader.read();
+    if (thumbnail.isNull())
+    {
+        return thumbnail;
+    }
+
+    // Save to disk cache
+    QSaveFile file(cachePath);
+    if (file.open(QIODevice::WriteOnly) && thumbnail.save(&file, "PNG"))
+    {
+        file.commit();
+    }
+
+    return thumbnail;
+}
+
+void ThumbnailCache::collect_finished()
+{
+    vector<Finished> finished;
+    QMutexLocker locker(&this->finMutex);
+    finished.swap(this->finList);
+    locker.unlock();
+
+    for (const Finished& fin : finished)
+    {
+        if (fin.generation == this->generation.load() &&
+            !fin.thumbnail.isNull())
+        {
+            emit thumbnailReady(fin.imgPath, fin.thumbnail);
+        }
+    }
+}
@@ -0,0 +1,59 @@
+#ifndef THUMBNAILCACHE_H
+#define THUMBNAILCACHE_H
+
+#include <atomic>
+#include <vector>
+
+#include <QImage>
+#include <QMutex>
+#include <QObject>
+#include <QSize>
+#include <QString>
+#include <QThreadPool>
+
+class ThumbnailCache : public QObject
+{
+    Q_OBJECT
+
+   public:
+    explicit ThumbnailCache(const QSize& size, QObject* parent = nullptr);
+    ~ThumbnailCache();
+
+    /** Generate or load thumbnail asynchronously */
+    void request(const QString& imgPath);
+    void cancel_all();
+
+    QSize thumbnail_size() const;
+    QString cache_dir() const;
+
+   signals:
+    void thumbnailReady(const QString& imgPath, const QImage& thumbnail);
+
+   private slots:
+    void collect_finished();
+
+   private:
+    class Job;
+    class PruneJob;
+
+    struct Finished
+    {
+        QString imgPath;
+        int generation;
+        QImage thumbnail;
+    };
+
+    QSize size;
+    QString cacheDir;
+    QThreadPool pool;
+
+    std::atomic<int> generation;  // Increased by cancel_all()
+
+    QMutex finMutex;
+    std::vector<Finished> finList;  // Guarded by finMutex
+
+    QString cache_path(const QString& imgPath) const;
+    QImage generate(const QString& imgPath) const;
+};
+
+#endif  // THUMBNAILCACHE_H
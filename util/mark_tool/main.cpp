@@ -0,0 +1,198 @@
+#include "markcheck.h"
+#include "workpool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+#define FILES_PER_TASK 16
+
+static void print_usage(const char* name)
+{
+    cout << "Usage: " << name << " <command> [options] <data_dir>" << endl;
+    cout << endl;
+    cout << "Commands:" << endl;
+    cout << "    validate    Report unparsable, partial and non-canonical "
+            ".mark files"
+         << endl;
+    cout << "    stats       Print class counts, box size and angle histograms"
+         << endl;
+    cout << "    repair      Rewrite files in canonical form" << endl;
+    cout << endl;
+    cout << "Options:" << endl;
+    cout << "    -j <N>      Number of threads (default: all cores)" << endl;
+    cout << "    -r          Search sub-directories" << endl;
+    cout << "    --drop-partial" << endl;
+    cout << "                Drop instances lacking label or box on repair"
+         << endl;
+}
+
+static void print_issues(MarkStats& stats)
+{
+    sort(stats.issues.begin(), stats.issues.end());
+    for (const auto& issue : stats.issues)
+    {
+        cout << issue.first << ": " << issue.second << endl;
+    }
+
+    if (stats.issues.size())
+    {
+        cout << endl;
+    }
+}
+
+static void print_histograms(const MarkStats& stats)
+{
+    cout << "Class counts:" << endl;
+    for (auto it = stats.classCount.begin(); it != stats.classCount.end();
+         it++)
+    {
+        printf("    %6d: %zu\n", it->first, it->second);
+    }
+
+    cout << endl << "Box size (sqrt(w * h)):" << endl;
+    for (int i = 0; i < MarkStats::SIZE_BINS; i++)
+    {
+        printf("    >= %6.0f: %zu\n", MarkStats::size_bin_lower(i),
+               stats.sizeHist[i]);
+    }
+
+    cout << endl << "Angle (degree):" << endl;
+    for (int i = 0; i < MarkStats::ANGLE_BINS; i++)
+    {
+        printf("    >= %6.1f: %zu\n", MarkStats::angle_bin_lower(i),
+               stats.angleHist[i]);
+    }
+
+    cout << endl;
+}
+
+int main(int argc, char* argv[])
+try
+{
+    // Parse arguments
+    string command;
+    string dataDir;
+    int threads = 0;
+    bool recursive = false;
+    bool dropPartial = false;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+        {
+            threads = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-r") == 0)
+        {
+            recursive = true;
+        }
+        else if (strcmp(argv[i], "--drop-partial") == 0)
+        {
+            dropPartial = true;
+        }
+        else if (command.empty())
+        {
+            command = argv[i];
+        }
+        else if (dataDir.empty())
+        {
+            dataDir = argv[i];
+        }
+        else
+        {
+            print_usage(argv[0]);
+            return -1;
+        }
+    }
+
+    if ((command != "validate" && command != "stats" && command != "repair") ||
+        dataDir.empty())
+    {
+        print_usage(argv[0]);
+        return -1;
+    }
+
+    bool repair = (command == "repair");
+    auto start = chrono::steady_clock::now();
+
+    // Check files on worker threads, each worker accumulates its own stats
+    vector<string> fileList = mark_find_files(dataDir, recursive);
+
+    WorkPool pool(threads);
+    vector<MarkStats> workerStats(pool.thread_count());
+    for (size_t i = 0; i < fileList.size(); i += FILES_PER_TASK)
+    {
+        size_t end = min(i + FILES_PER_TASK, fileList.size());
+        pool.submit(
+            [&, i, end](int worker)
+            {
+                for (size_t j = i; j < end; j++)
+                {
+                    mark_check_file(fileList[j], repair, dropPartial,
+                                    workerStats[worker]);
+                }
+            });
+    }
+
+    pool.wait();
+
+    MarkStats stats;
+    for (const MarkStats& worker : workerStats)
+    {
+        stats.merge(worker);
+    }
+
+    chrono::duration<double> cost = chrono::steady_clock::now() - start;
+
+    // Report
+    if (command == "stats")
+    {
+        print_histograms(stats);
+    }
+    else
+    {
+        print_issues(stats);
+    }
+
+    cout << "Files: " << stats.files << ", instances: " << stats.instances
+         << endl;
+    cout << "Unparsable files: " << stats.unparsableFiles << endl;
+    cout << "Partial files: " << stats.partialFiles << " ("
+         << stats.partialInstances << " instances)" << endl;
+    cout << "Non-canonical files: " << stats.nonCanonicalFiles << endl;
+    if (repair)
+    {
+        cout << "Repaired files: " << stats.repairedFiles << endl;
+        cout << "Dropped instances: " << stats.droppedInstances << endl;
+    }
+
+    double sec = max(cost.count(), 1e-9);
+    printf("Processed in %.3f s with %d threads: %.1f files/s, %.2f MiB/s\n",
+           sec, pool.thread_count(), stats.files / sec,
+           stats.bytes / 1048576.0 / sec);
+
+    if (command == "validate" && (stats.unparsableFiles ||
+                                  stats.partialFiles ||
+                                  stats.nonCanonicalFiles))
+    {
+        return 1;
+    }
+
+    return 0;
+}
+catch (exception& ex)
+{
+    cout << endl;
+    cout << "Error!" << endl;
+    cout << ex.what() << endl;
+    cout << endl;
+    return -1;
+}
@@ -0,0 +1,305 @@
+#include "markcheck.h"
+
+#include <mark_codec.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <exception>
+#include <fstream>
+#include <iterator>
+#include <utility>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+using namespace std;
+using namespace ican_mark;
+
+#define MARK_EXT ".mark"
+
+void MarkStats::add_instances(const InstanceStore& instList)
+{
+    this->instances += instList.size();
+    for (size_t i = 0; i < instList.size(); i++)
+    {
+        Instance inst = instList[i];
+        if (inst.has_label())
+        {
+            this->classCount[inst.get_label()]++;
+        }
+
+        if (inst.has_w() && inst.has_h())
+        {
+            double size = sqrt(fabs(inst.get_w() * inst.get_h()));
+            int bin = (size < 8) ? 0 : (int)floor(log2(size)) - 2;
+            this->sizeHist[min(max(bin, 0), (int)SIZE_BINS - 1)]++;
+        }
+
+        if (inst.has_x() && inst.has_y() && inst.has_w() && inst.has_h())
+        {
+            double degree = inst.has_degree() ? inst.get_degree() : 0;
+            if (std::isfinite(degree))
+            {
+                degree = fmod(fmod(degree + 180, 360) + 360, 360);
+                int bin = (int)(degree / (360.0 / ANGLE_BINS));
+                this->angleHist[min(bin, (int)ANGLE_BINS - 1)]++;
+            }
+        }
+    }
+}
+
+void MarkStats::merge(const MarkStats& other)
+{
+    this->files += other.files;
+    this->bytes += other.bytes;
+    this->instances += other.instances;
+
+    this->unparsableFiles += other.unparsableFiles;
+    this->partialFiles += other.partialFiles;
+    this->partialInstances += other.partialInstances;
+    this->nonCanonicalFiles += other.nonCanonicalFiles;
+    this->repairedFiles += other.repairedFiles;
+    this->droppedInstances += other.droppedInstances;
+
+    for (auto it = other.classCount.begin(); it != other.classCount.end();
+         it++)
+    {
+        this->classCount[it->first] += it->second;
+    }
+
+    for (int i = 0; i < SIZE_BINS; i++)
+    {
+        this->sizeHist[i] += other.sizeHist[i];
+    }
+
+    for (int i = 0; i < ANGLE_BINS; i++)
+    {
+        this->angleHist[i] += other.angleHist[i];
+    }
+
+    this->issues.insert(this->issues.end(), other.issues.begin(),
+                        other.issues.end());
+}
+
+double MarkStats::size_bin_lower(int bin)
+{
+    return (bin == 0) ? 0 : pow(2.0, bin + 2);
+}
+
+double MarkStats::angle_bin_lower(int bin)
+{
+    return -180.0 + bin * (360.0 / ANGLE_BINS);
+}
+
+bool mark_instance_complete(const Instance& inst)
+{
+    return inst.has_label() && inst.has_x() && inst.has_y() && inst.has_w() &&
+           inst.has_h();
+}
+
+void mark_check_file(const string& path, bool repair, bool dropPartial,
+                     MarkStats& stats)
+{
+    stats.files++;
+
+    // Read file content
+    ifstream fReader(path, ios::binary);
+    if (!fReader)
+    {
+        stats.unparsableFiles++;
+        stats.issues.push_back({path, "failed to open"});
+        return;
+    }
+
+    string content((istreambuf_iterator<char>(fReader)),
+                   istreambuf_iterator<char>());
+    stats.bytes += content.size();
+
+    // Decode instances
+    InstanceStore instList;
+    try
+    {
+        instList = MarkCodec::decode(content);
+    }
+    catch (exception& ex)
+    {
+        stats.unparsableFiles++;
+        stats.issues.push_back({path, string("unparsable: ") + ex.what()});
+        return;
+    }
+
+    stats.add_instances(instList);
+
+    // Find partial instances
+    vector<size_t> partialList;
+    for (size_t i = 0; i < instList.size(); i++)
+    {
+        if (!mark_instance_complete(instList[i]))
+        {
+            partialList.push_back(i);
+        }
+    }
+
+    if (partialList.size())
+    {
+        stats.partialFiles++;
+        stats.partialInstances += partialList.size();
+        stats.issues.push_back(
+            {path, to_string(partialList.size()) + " partial instance(s)"});
+    }
+
+    // Compare with canonical form
+    string buf;
+    MarkCodec::encode(buf, instList);
+    bool canonical = (buf == content);
+    if (!canonical)
+    {
+        stats.nonCanonicalFiles++;
+        stats.issues.push_back({path, "not in canonical form"});
+    }
+
+    // Rewrite file, partial instances are kept unless asked to drop them
+    bool dropping = dropPartial && partialList.size();
+    if (repair && (dropping || !canonical))
+    {
+        if (dropping)
+        {
+            instList.erase(partialList);
+            buf.clear();
+            MarkCodec::encode(buf, instList);
+        }
+
+        string tmpPath = path + ".tmp";
+        ofstream fWriter(tmpPath, ios::binary);
+        fWriter.write(buf.data(), buf.size());
+        fWriter.close();
+
+#ifdef _WIN32
+        remove(path.c_str());
+#endif
+        if (!fWriter || rename(tmpPath.c_str(), path.c_str()) != 0)
+        {
+            remove(tmpPath.c_str());
+            stats.issues.push_back({path, "failed to rewrite"});
+        }
+        else
+        {
+            stats.repairedFiles++;
+            if (dropping)
+            {
+                stats.droppedInstances += partialList.size();
+                stats.issues.push_back(
+                    {path, "dropped " + to_string(partialList.size()) +
+                               " partial instance(s)"});
+            }
+        }
+    }
+}
+
+// List entries of a directory as (name, is directory)
+static bool list_dir(const string& dirPath,
+                     vector<pair<string, bool>>& entryList)
+{
+#ifdef _WIN32
+    WIN32_FIND_DATAA data;
+    HANDLE find = FindFirstFileA((dirPath + "\\*").c_str(), &data);
+    if (find == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+
+    do
+    {
+        entryList.push_back(
+            {data.cFileName,
+             (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0});
+    } while (FindNextFileA(find, &data));
+
+    FindClose(find);
+#else
+    DIR* dir = opendir(dirPath.c_str());
+    if (!dir)
+    {
+        return false;
+    }
+
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != nullptr)
+    {
+        // Avoid stat() if file type is provided by readdir()
+        string name = entry->d_name;
+        bool isDir;
+#ifdef _DIRENT_HAVE_D_TYPE
+        if (entry->d_type != DT_UNKNOWN && entry->d_type != DT_LNK)
+        {
+            isDir = (entry->d_type == DT_DIR);
+        }
+        else
+#endif
+        {
+            struct stat st;
+            if (stat((dirPath + "/" + name).c_str(), &st) != 0)
+            {
+                continue;
+            }
+
+            isDir = S_ISDIR(st.st_mode);
+        }
+
+        entryList.push_back({name, isDir});
+    }
+
+    closedir(dir);
+#endif
+
+    return true;
+}
+
+vector<string> mark_find_files(const string& dirPath, bool recursive)
+{
+    vector<string> ret;
+    vector<string> dirList = {dirPath};
+    vector<pair<string, bool>> entryList;
+    while (dirList.size())
+    {
+        string curDir = dirList.back();
+        dirList.pop_back();
+
+        entryList.clear();
+        if (!list_dir(curDir, entryList))
+        {
+            continue;
+        }
+
+        for (const auto& entry : entryList)
+        {
+            const string& name = entry.first;
+            if (name == "." || name == "..")
+            {
+                continue;
+            }
+
+            string path = curDir + "/" + name;
+            if (entry.second)
+            {
+                if (recursive)
+                {
+                    dirList.push_back(path);
+                }
+            }
+            else if (name.size() > sizeof(MARK_EXT) - 1 &&
+                     name.compare(name.size() - (sizeof(MARK_EXT) - 1),
+                                  string::npos, MARK_EXT) == 0)
+            {
+                ret.push_back(path);
+            }
+        }
+    }
+
+    sort(ret.begin(), ret.end());
+    return ret;
+}
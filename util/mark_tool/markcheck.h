@@ -0,0 +1,58 @@
+#ifndef MARKCHECK_H
+#define MARKCHECK_H
+
+#include <mark_instance.hpp>
+#include <array>
+#include <cstddef>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+/** Accumulated result of checking .mark files */
+struct MarkStats
+{
+    // Box size histogram with sqrt(w * h) in [0, 8), [8, 16), ..., [1024, inf)
+    enum
+    {
+        SIZE_BINS = 9,
+        ANGLE_BINS = 24  // 15 degrees per bin in [-180, 180)
+    };
+
+    size_t files = 0;
+    size_t bytes = 0;
+    size_t instances = 0;
+
+    size_t unparsableFiles = 0;
+    size_t partialFiles = 0;
+    size_t partialInstances = 0;
+    size_t nonCanonicalFiles = 0;
+    size_t repairedFiles = 0;
+    size_t droppedInstances = 0;
+
+    std::map<int, size_t> classCount;
+    std::array<size_t, SIZE_BINS> sizeHist = {};
+    std::array<size_t, ANGLE_BINS> angleHist = {};
+
+    std::vector<std::pair<std::string, std::string>> issues;  // Path, reason
+
+    void add_instances(const ican_mark::InstanceStore& instList);
+    void merge(const MarkStats& other);
+
+    static double size_bin_lower(int bin);
+    static double angle_bin_lower(int bin);
+};
+
+/** Instance with complete label and bounding box */
+bool mark_instance_complete(const ican_mark::Instance& inst);
+
+/** Check a .mark file and optionally rewrite it in canonical form,
+    partial instances are dropped only with dropPartial */
+void mark_check_file(const std::string& path, bool repair, bool dropPartial,
+                     MarkStats& stats);
+
+/** Find .mark files under directory */
+std::vector<std::string> mark_find_files(const std::string& dirPath,
+                                         bool recursive);
+
+#endif  // MARKCHECK_H
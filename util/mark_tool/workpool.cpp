@@ -0,0 +1,129 @@
+#include "workpool.h"
+
+#include <algorithm>
+#include <utility>
+
+using namespace std;
+
+WorkPool::WorkPool(int threads) : nextQueue(0)
+{
+    if (threads <= 0)
+    {
+        threads = max(1, (int)thread::hardware_concurrency());
+    }
+
+    for (int i = 0; i < threads; i++)
+    {
+        this->queues.emplace_back(new Queue());
+    }
+
+    for (int i = 0; i < threads; i++)
+    {
+        this->workers.emplace_back(&WorkPool::run, this, i);
+    }
+}
+
+WorkPool::~WorkPool()
+{
+    {
+        lock_guard<mutex> lock(this->stateMutex);
+        this->stop = true;
+    }
+
+    this->taskCond.notify_all();
+    for (thread& worker : this->workers)
+    {
+        worker.join();
+    }
+}
+
+void WorkPool::submit(Task task)
+{
+    // Distribute tasks to worker queues in round robin
+    Queue& queue = *this->queues[this->nextQueue++ % this->queues.size()];
+    {
+        lock_guard<mutex> lock(queue.mutex);
+        queue.tasks.push_back(std::move(task));
+    }
+
+    {
+        lock_guard<mutex> lock(this->stateMutex);
+        this->queued++;
+        this->pending++;
+    }
+
+    this->taskCond.notify_one();
+}
+
+void WorkPool::wait()
+{
+    unique_lock<mutex> lock(this->stateMutex);
+    this->doneCond.wait(lock, [this]() { return this->pending == 0; });
+}
+
+bool WorkPool::take(int worker, Task& task)
+{
+    int count = (int)this->queues.size();
+    for (int i = 0; i < count; i++)
+    {
+        Queue& queue = *this->queues[(worker + i) % count];
+        lock_guard<mutex> lock(queue.mutex);
+        if (queue.tasks.empty())
+        {
+            continue;
+        }
+
+        // Newest task from own queue, oldest task from the others
+        if (i == 0)
+        {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+        }
+        else
+        {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+        }
+
+        return true;
+    }
+
+    return false;
+}
+
+void WorkPool::run(int worker)
+{
+    while (true)
+    {
+        {
+            unique_lock<mutex> lock(this->stateMutex);
+            this->taskCond.wait(
+                lock, [this]() { return this->stop || this->queued > 0; });
+            if (this->stop)
+            {
+                return;
+            }
+        }
+
+        Task task;
+        if (!this->take(worker, task))
+        {
+            // Taken by other workers before counter being updated
+            this_thread::yield();
+            continue;
+        }
+
+        {
+            lock_guard<mutex> lock(this->stateMutex);
+            this->queued--;
+        }
+
+        task(worker);
+
+        lock_guard<mutex> lock(this->stateMutex);
+        if (--this->pending == 0)
+        {
+            this->doneCond.notify_all();
+        }
+    }
+}
@@ -0,0 +1,57 @@
+#ifndef WORKPOOL_H
+#define WORKPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Thread pool with one task queue per worker.
+ *
+ * Workers take tasks from the back of their own queue, and steal from the
+ * front of other queues when running out of tasks.
+ */
+class WorkPool
+{
+   public:
+    typedef std::function<void(int worker)> Task;
+
+    explicit WorkPool(int threads = 0);  // 0 for hardware concurrency
+    ~WorkPool();
+
+    WorkPool(const WorkPool&) = delete;
+    WorkPool& operator=(const WorkPool&) = delete;
+
+    int thread_count() const { return (int)this->workers.size(); }
+
+    void submit(Task task);
+    void wait();  // Wait until all submitted tasks finished
+
+   private:
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+    std::atomic<unsigned int> nextQueue;
+
+    std::mutex stateMutex;
+    std::condition_variable taskCond;
+    std::condition_variable doneCond;
+    size_t queued = 0;   // Tasks waiting in queues
+    size_t pending = 0;  // Tasks not finished yet
+    bool stop = false;
+
+    bool take(int worker, Task& task);
+    void run(int worker);
+};
+
+#endif  // WORKPOOL_H